@@ -0,0 +1,67 @@
+-- Compares two results of bench/suite.lua. Rows are matched by
+-- op, bits and type. A row is a regression if it's slower by more
+-- than threshold percent or if it allocates more per call. The
+-- script exits with a non-zero status if it finds a regression.
+--
+-- Usage: lua bench/compare.lua baseline.tsv results.tsv [threshold]
+
+local baseline = assert(arg and arg[1], "baseline file expected")
+local results = assert(arg and arg[2], "results file expected")
+local threshold = tonumber(arg and arg[3]) or 10
+
+local function readresults(name)
+	local rows, order = {}, {}
+	local file = assert(io.open(name))
+	for line in file:lines() do
+		local op, bits, kind, calls, ns, allocs =
+		    line:match("^([^\t]+)\t(%d+)\t([^\t]+)\t(%d+)\t([%d.]+)\t([^\t]+)")
+		if op then
+			local key = op .. "\t" .. bits .. "\t" .. kind
+			rows[key] = { ns = tonumber(ns), allocs = tonumber(allocs) }
+			order[#order + 1] = key
+		end
+	end
+	file:close()
+	return rows, order
+end
+
+local old = readresults(baseline)
+local new, order = readresults(results)
+
+local nregressions, logsum, count = 0, 0, 0
+
+print(string.format("%-24s %8s %4s %12s %12s %7s", "op", "bits", "type",
+    "baseline", "results", "ratio"))
+
+for _, key in ipairs(order) do
+	local a, b = old[key], new[key]
+	if a and a.ns > 0 and b.ns > 0 then
+		local ratio = b.ns / a.ns
+		local op, bits, kind = key:match("^(.-)\t(.-)\t(.*)$")
+		local mark = ""
+
+		if ratio > 1 + threshold / 100 then
+			mark = " slower"
+		end
+		if a.allocs and b.allocs and b.allocs > a.allocs + 0.5 then
+			mark = mark .. " allocs " .. a.allocs .. " -> " .. b.allocs
+		end
+		if mark ~= "" then
+			nregressions = nregressions + 1
+		end
+
+		logsum, count = logsum + math.log(ratio), count + 1
+		print(string.format("%-24s %8s %4s %10.1fns %10.1fns %7.3f%s",
+		    op, bits, kind, a.ns, b.ns, ratio, mark))
+	end
+end
+
+if count > 0 then
+	print(string.format("geometric mean of %d ratios: %.3f", count,
+	    math.exp(logsum / count)))
+end
+print(string.format("%d regressions above %g%%", nregressions, threshold))
+
+if nregressions > 0 then
+	os.exit(1)
+end
@@ -0,0 +1,46 @@
+-- Micro-benchmark of per-call overhead of bn operations.
+-- Operands are small enough for the call overhead to dominate.
+--
+-- Usage: lua bench/dispatch.lua [iterations]
+
+local bn = require "bn"
+
+local iterations = tonumber(arg and arg[1]) or 1000000
+
+-- Best of several runs to reduce noise from garbage collection.
+local function bench(name, f, a, b)
+	local best = math.huge
+	for run = 1, 5 do
+		collectgarbage()
+		local t = os.clock()
+		for i = 1, iterations do
+			f(a, b)
+		end
+		best = math.min(best, os.clock() - t)
+	end
+	print(string.format("%-24s %8.1f ns/call", name, best * 1e9 / iterations))
+end
+
+local ops = {
+	{ "__add",   function(a, b) return a + b end },
+	{ "__mul",   function(a, b) return a * b end },
+	{ "__div",   function(a, b) return a / b end },
+	{ "__mod",   function(a, b) return a % b end },
+	{ "__eq",    function(a, b) return a == b end },
+	{ "__lt",    function(a, b) return a < b end },
+	{ "bn.add",  bn.add },
+	{ "bn.mul",  bn.mul },
+	{ "bn.eq",   bn.eq },
+	{ "bn.cmp",  bn.cmp },
+	{ "bn.gcd",  bn.gcd },
+}
+
+for _, bits in ipairs { 128, 256 } do
+	local a = bn.number(2)^bits - 12345
+	local b = bn.number(2)^(bits / 2) + 67890
+	for _, op in ipairs(ops) do
+		bench(op[1] .. " " .. bits, op[2], a, b)
+	end
+	bench("__add number " .. bits, ops[1][2], a, 12345)
+	bench("bn.mul number " .. bits, bn.mul, a, 12345)
+end
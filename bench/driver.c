@@ -0,0 +1,185 @@
+/*
+ * Benchmark driver. It runs a Lua script with the bn module linked in
+ * and a global table "bench" with a monotonic clock and allocation
+ * counters of Lua and OpenSSL.
+ *
+ * Usage: bench/driver script.lua [args...]
+ */
+
+#include "luaBn.h"
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <openssl/crypto.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Counters are updated without locks, bn.genprime threads
+ * may lose a few increments.
+ */
+struct allocstats {
+	lua_Number count; /* Calls of malloc and realloc. */
+	lua_Number bytes; /* Bytes requested by these calls. */
+};
+
+static struct allocstats luastats, sslstats;
+
+static void *
+luaalloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	struct allocstats *st;
+
+	st = (struct allocstats *)ud;
+
+	if (nsize == 0) {
+		free(ptr);
+		return NULL;
+	}
+
+	/* Lua 5.2 and later pass a type of an object in osize. */
+	if (ptr == NULL)
+		osize = 0;
+
+	if (nsize > osize) {
+		st->count += 1;
+		st->bytes += nsize - osize;
+	}
+
+	return realloc(ptr, nsize);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+static void *
+sslmalloc(size_t n, const char *file, int line)
+#else
+static void *
+sslmalloc(size_t n)
+#endif
+{
+
+	sslstats.count += 1;
+	sslstats.bytes += n;
+	return malloc(n);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+static void *
+sslrealloc(void *ptr, size_t n, const char *file, int line)
+#else
+static void *
+sslrealloc(void *ptr, size_t n)
+#endif
+{
+
+	sslstats.count += 1;
+	sslstats.bytes += n;
+	return realloc(ptr, n);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+static void
+sslfree(void *ptr, const char *file, int line)
+#else
+static void
+sslfree(void *ptr)
+#endif
+{
+
+	free(ptr);
+}
+
+/* bench.clock() - monotonic time in seconds. */
+static int
+b_clock(lua_State *L)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	lua_pushnumber(L, ts.tv_sec + ts.tv_nsec * 1e-9);
+
+	return 1;
+}
+
+/*
+ * bench.allocs() - number of allocations and bytes allocated
+ * by Lua and by OpenSSL since the start.
+ */
+static int
+b_allocs(lua_State *L)
+{
+
+	lua_pushnumber(L, luastats.count);
+	lua_pushnumber(L, luastats.bytes);
+	lua_pushnumber(L, sslstats.count);
+	lua_pushnumber(L, sslstats.bytes);
+
+	return 4;
+}
+
+static luaL_Reg bench_functions[] = {
+	{ "clock",  b_clock  },
+	{ "allocs", b_allocs },
+	{ NULL, NULL }
+};
+
+int
+main(int argc, char *argv[])
+{
+	lua_State *L;
+	int i;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s script.lua [args...]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* Must be called before OpenSSL allocates anything. */
+	if (!CRYPTO_set_mem_functions(sslmalloc, sslrealloc, sslfree))
+		fprintf(stderr, "%s: OpenSSL allocations aren't counted\n",
+		    argv[0]);
+
+	L = lua_newstate(luaalloc, &luastats);
+	if (L == NULL) {
+		fprintf(stderr, "%s: cannot create Lua state\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	luaL_openlibs(L);
+
+	/* package.preload.bn = luaopen_bn */
+	lua_getglobal(L, "package");
+	lua_getfield(L, -1, "preload");
+	lua_pushcfunction(L, luaopen_bn);
+	lua_setfield(L, -2, "bn");
+	lua_pop(L, 2);
+
+#if LUA_VERSION_NUM <= 501
+	luaL_register(L, "bench", bench_functions);
+	lua_pop(L, 1);
+#else
+	luaL_newlib(L, bench_functions);
+	lua_setglobal(L, "bench");
+#endif
+
+	lua_createtable(L, argc - 2, 1);
+	for (i = 1; i < argc; i++) {
+		lua_pushstring(L, argv[i]);
+		lua_rawseti(L, -2, i - 1);
+	}
+	lua_setglobal(L, "arg");
+
+	if (luaL_loadfile(L, argv[1]) != 0 || lua_pcall(L, 0, 0, 0) != 0) {
+		fprintf(stderr, "%s: %s\n", argv[0], lua_tostring(L, -1));
+		lua_close(L);
+		return EXIT_FAILURE;
+	}
+
+	lua_close(L);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,65 @@
+-- Benchmark of balanced multiplication with BN_mul, one level of
+-- Toom-3 over BN_mul and NTT at different sizes. Use it to find
+-- crossover points and tune thresholds with bn.multhresholds().
+--
+-- Usage: lua bench/mul.lua [maxbits]
+
+local bn = require "bn"
+
+local maxbits = tonumber(arg and arg[1]) or 4194304
+local never = 2^30
+
+-- Operand of about the given size with all digits in use.
+local function operand(bits, base)
+	return bn.number(base)^math.floor(bits / (math.log(base) / math.log(2)))
+end
+
+-- Best of several runs, at least 0.05s each.
+local function bench(a, b)
+	local best, n = math.huge, 1
+	while true do
+		local t = os.clock()
+		for i = 1, n do
+			local r = a * b
+		end
+		t = os.clock() - t
+		if t >= 0.05 then
+			best = math.min(best, t / n)
+			if n > 1 or best > 0.5 then
+				break
+			end
+		end
+		n = n * 2
+	end
+	return best
+end
+
+local toom3, ntt = bn.multhresholds()
+
+print(string.format("%10s %12s %12s %12s", "bits", "BN_mul", "Toom-3", "NTT"))
+
+local bits = 2048
+while bits <= maxbits do
+	local a, b = operand(bits, 3), operand(bits, 7)
+	local times = {}
+
+	-- Toom-3 and NTT are used only at the top level.
+	bn.multhresholds(never, never)
+	times[1] = bits <= 1048576 and bench(a, b) or nil
+	bn.multhresholds(bits - 512, never)
+	times[2] = bench(a, b)
+	bn.multhresholds(bits - 512, bits - 512)
+	times[3] = bench(a, b)
+
+	local row = string.format("%10d", bits)
+	for i = 1, 3 do
+		row = row .. (times[i] and
+		    string.format(" %10.3fms", times[i] * 1e3) or
+		    string.format(" %12s", "-"))
+	end
+	print(row)
+
+	bits = bits * 2
+end
+
+bn.multhresholds(toom3, ntt)
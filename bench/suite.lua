@@ -0,0 +1,595 @@
+-- Benchmark of all bn functions and metamethods at operand sizes
+-- from 64 bits to 1M bits. Each row is tab-separated:
+--
+--   op bits type calls ns allocs bytes gc_ns
+--
+-- where type is a kind of the second operand (bn, num for a small
+-- Lua number or str for a decimal string), ns is time per call,
+-- allocs and bytes are allocations by Lua and OpenSSL per call and
+-- gc_ns is time per call of collecting the garbage left by the calls.
+-- The collector is stopped while calls are timed.
+--
+-- Run it with bench/driver (make bench) to get allocation counts,
+-- plain lua prints "-" in these columns and uses os.clock.
+--
+-- Usage: bench/driver bench/suite.lua [maxbits [pattern [mintime]]]
+
+local bn = require "bn"
+
+local maxbits = tonumber(arg and arg[1]) or 1048576
+local pattern = arg and arg[2] or ""
+local mintime = tonumber(arg and arg[3]) or 0.02
+local maxcalls = 1048576
+
+local clock = bench and bench.clock or os.clock
+local allocs = bench and bench.allocs
+
+local sizes = {}
+for _, bits in ipairs { 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576 } do
+	if bits <= maxbits then
+		sizes[#sizes + 1] = bits
+	end
+end
+
+local function totalallocs()
+	local lcount, lbytes, scount, sbytes = allocs()
+	return lcount + scount, lbytes + sbytes
+end
+
+-- Calls f until it runs for at least mintime.
+local function measure(f)
+	local n, t, a0, b0, a1, b1 = 1
+	collectgarbage()
+	collectgarbage("stop")
+	while true do
+		if allocs then
+			a0, b0 = totalallocs()
+		end
+		t = clock()
+		for i = 1, n do
+			f()
+		end
+		t = clock() - t
+		if allocs then
+			a1, b1 = totalallocs()
+		end
+		if t >= mintime or n >= maxcalls then
+			break
+		end
+		collectgarbage()
+		n = n * 2
+	end
+	collectgarbage("restart")
+	local gc = clock()
+	collectgarbage()
+	gc = clock() - gc
+	if not allocs then
+		return n, t / n, nil, nil, gc / n
+	end
+	return n, t / n, (a1 - a0) / n, (b1 - b0) / n, gc / n
+end
+
+local function report(name, bits, kind, f)
+	local n, t, a, b, gc = measure(f)
+	print(string.format("%s\t%d\t%s\t%d\t%.1f\t%s\t%s\t%.1f",
+	    name, bits, kind, n, t * 1e9,
+	    a and string.format("%.2f", a) or "-",
+	    b and string.format("%.1f", b) or "-", gc * 1e9))
+	io.stdout:flush()
+end
+
+-- Random operand of exactly bits bits.
+local function rand(bits)
+	return bn.rand(bits, 0)
+end
+
+local function oddrand(bits)
+	return bn.bor(bn.rand(bits, 0), 1)
+end
+
+local function vector(count, bits)
+	return bn.rand_vector(count, bits, 0)
+end
+
+-- Operators are compiled at run time, older Lua versions can't parse
+-- some of them.
+local function operator(op)
+	local f = (loadstring or load)("return function(a, b) return " ..
+	    op .. " end")
+	return f and f()
+end
+
+-- Each entry is { name, setup [, maxbits [, kinds]] }. setup(bits, kind)
+-- returns a function to benchmark or nil to skip that size and,
+-- optionally, a size to report. kind is a type of the second operand,
+-- only "bn" by default.
+local ops = {}
+
+local function add(name, setup, limit, kinds)
+	ops[#ops + 1] = { name, setup, limit or math.huge, kinds or { "bn" } }
+end
+
+-- Second operand of a binary operation of the given kind.
+local function second(bits, kind)
+	if kind == "num" then
+		return 12345
+	elseif kind == "str" then
+		return tostring(rand(bits))
+	end
+	return rand(bits)
+end
+
+local mixed = { "bn", "num", "str" }
+
+-- Binary function f(a, b), b has bits * scale bits.
+local function binary(name, f, limit, kinds, scale)
+	add(name, function(bits, kind)
+		local a = rand(bits)
+		local b = second(math.max(1, math.floor(bits * (scale or 1))), kind)
+		return function() return f(a, b) end
+	end, limit, kinds)
+end
+
+local function unary(name, f, limit)
+	add(name, function(bits)
+		local a = rand(bits)
+		return f and function() return f(a) end
+	end, limit)
+end
+
+-- Arithmetic and comparisons.
+for _, v in ipairs {
+	{ "add", bn.add }, { "sub", bn.sub }, { "mul", bn.mul },
+	{ "cmp", bn.cmp }, { "ucmp", bn.ucmp }, { "eq", bn.eq },
+	{ "band", bn.band }, { "bor", bn.bor }, { "bxor", bn.bxor },
+} do
+	binary(v[1], v[2], nil, mixed)
+end
+
+binary("div", bn.div, nil, mixed, 0.5)
+binary("idiv", bn.idiv, nil, mixed, 0.5)
+binary("nnmod", bn.nnmod, nil, mixed, 0.5)
+binary("gcd", bn.gcd, 262144)
+binary("gcdext", bn.gcdext, 65536)
+binary("lcm", bn.lcm, 262144)
+binary("swap", bn.swap)
+
+unary("bnot", bn.bnot)
+unary("numbits", bn.numbits)
+unary("popcount", bn.popcount)
+unary("isneg", bn.isneg)
+unary("iseven", bn.iseven)
+unary("isodd", bn.isodd)
+unary("isone", bn.isone)
+unary("iszero", bn.iszero)
+unary("isshared", bn.isshared)
+unary("tointeger", bn.tointeger)
+unary("sqr", bn.sqr)
+unary("sqrt", bn.sqrt)
+unary("sqrtrem", bn.sqrtrem)
+unary("isperfectpower", bn.isperfectpower, 65536)
+unary("key", bn.key)
+unary("intern", bn.intern)
+unary("number", bn.number)
+unary("tostring", tostring, 65536)
+unary("tobin", function(a) return a:tobin() end)
+
+for _, v in ipairs {
+	{ "lshift", bn.lshift }, { "rshift", bn.rshift },
+	{ "testbit", bn.testbit }, { "setbit", bn.setbit },
+	{ "clearbit", bn.clearbit },
+} do
+	add(v[1], function(bits)
+		local a, n = rand(bits), math.floor(bits / 2) + 1
+		local f = v[2]
+		return function() return f(a, n) end
+	end)
+end
+
+add("root", function(bits)
+	local a = rand(bits)
+	return function() return bn.root(a, 3) end
+end)
+
+add("pow", function(bits)
+	local a = rand(math.max(1, math.floor(bits / 7)))
+	return function() return bn.pow(a, 7) end
+end)
+
+-- Modular arithmetic with an odd modulus.
+for _, v in ipairs {
+	{ "modadd", bn.modadd }, { "modsub", bn.modsub },
+	{ "modmul", bn.modmul },
+} do
+	add(v[1], function(bits, kind)
+		local a, b, m = rand(bits), second(bits, kind), oddrand(bits)
+		local f = v[2]
+		return function() return f(a, b, m) end
+	end, 262144, mixed)
+end
+
+add("modsqr", function(bits)
+	local a, m = rand(bits), oddrand(bits)
+	return function() return bn.modsqr(a, m) end
+end, 262144)
+
+add("modpow", function(bits, kind)
+	local a, e, m = rand(bits), second(bits, kind), oddrand(bits)
+	return function() return bn.modpow(a, e, m) end
+end, 4096, mixed)
+
+add("modinv", function(bits)
+	local a, m = rand(bits), oddrand(bits)
+	return function() return bn.modinv(a, m) end
+end, 65536)
+
+add("jacobi", function(bits)
+	local a, m = rand(bits), oddrand(bits)
+	return function() return bn.jacobi(a, m) end
+end, 262144)
+
+-- Primes are generated once per size.
+local primes = {}
+local function prime(bits)
+	primes[bits] = primes[bits] or bn.genprime(bits)
+	return primes[bits]
+end
+
+add("modsqrt", function(bits)
+	local p = prime(bits)
+	local a = bn.modsqr(rand(bits), p)
+	return function() return bn.modsqrt(a, p) end
+end, 1024)
+
+add("isprime", function(bits)
+	local p = prime(bits)
+	return function() return bn.isprime(p) end
+end, 1024)
+
+add("nextprime", function(bits)
+	local a = rand(bits)
+	return function() return bn.nextprime(a) end
+end, 1024)
+
+add("genprime", function(bits)
+	return function() return bn.genprime(bits) end
+end, 256)
+
+-- Random numbers.
+add("rand", function(bits)
+	return function() return bn.rand(bits) end
+end)
+
+add("rand_range", function(bits)
+	local n = rand(bits)
+	return function() return bn.rand_range(n) end
+end)
+
+add("rand_vector", function(bits)
+	return function() return bn.rand_vector(16, bits) end
+end, 262144)
+
+-- Table functions, bits is a size of each of 16 elements.
+for _, v in ipairs {
+	{ "prod", bn.prod }, { "sum", bn.sum }, { "min", bn.min },
+	{ "max", bn.max }, { "argmax", bn.argmax }, { "unique", bn.unique },
+	{ "sort", bn.sort },
+} do
+	add(v[1], function(bits)
+		local t, f = vector(16, bits), v[2]
+		return function() return f(t) end
+	end, 262144)
+end
+
+add("dot", function(bits)
+	local t1, t2 = vector(16, bits), vector(16, bits)
+	return function() return bn.dot(t1, t2) end
+end, 262144)
+
+add("bsearch", function(bits)
+	local t = bn.sort(vector(16, bits))
+	local x = t[11]
+	return function() return bn.bsearch(t, x) end
+end, 262144)
+
+add("batchgcd", function(bits)
+	local t = vector(16, bits)
+	return function() return bn.batchgcd(t) end
+end, 16384)
+
+add("jacobi_many", function(bits)
+	local t, m = vector(16, bits), oddrand(bits)
+	return function() return bn.jacobi_many(t, m) end
+end, 65536)
+
+-- Chinese remainder reconstruction with 16 moduli of bits / 16 bits.
+local function moduli(bits)
+	local t, p = {}, rand(math.max(16, math.floor(bits / 16)))
+	for i = 1, 16 do
+		p = bn.nextprime(p)
+		t[i] = p
+	end
+	return t
+end
+
+add("crtctx", function(bits)
+	local t = moduli(bits)
+	return function() return bn.crtctx(t) end
+end, 65536)
+
+add("crtctx.combine", function(bits)
+	local c = bn.crtctx(moduli(bits))
+	local r = c:split(rand(bits))
+	return function() return c:combine(r) end
+end, 65536)
+
+add("crtctx.split", function(bits)
+	local c = bn.crtctx(moduli(bits))
+	local a = rand(bits)
+	return function() return c:split(a) end
+end, 65536)
+
+-- Lazy expression evaluated with fused kernels.
+add("lazy", function(bits)
+	local a, b, c, m = rand(bits), rand(bits), rand(bits), oddrand(bits)
+	local e = (bn.lazy(a) * b + c) % m
+	return function() return e:eval() end
+end, 262144)
+
+-- Fractions with numerators and denominators of bits / 2 bits.
+local function fraction(bits)
+	local half = math.max(1, math.floor(bits / 2))
+	return bn.rational(rand(half), oddrand(half))
+end
+
+add("rational", function(bits)
+	local a, b = rand(bits), oddrand(bits)
+	return function() return bn.rational(a, b) end
+end, 262144)
+
+add("rational.add", function(bits)
+	local x, y = fraction(bits), fraction(bits)
+	return function() return x + y end
+end, 262144)
+
+add("rational.mul", function(bits)
+	local x, y = fraction(bits), fraction(bits)
+	return function() return x * y end
+end, 262144)
+
+add("rational.lt", function(bits)
+	local x, y = fraction(bits), fraction(bits)
+	return function() return x < y end
+end, 262144)
+
+-- Random curve over a prime field of bits bits and its point (x, y).
+-- The real order isn't known, p stands in for it because only its
+-- size matters to precomputed tables.
+local function curveparams(bits)
+	local p = bn.nextprime(rand(bits))
+	local x, y, a = rand(bits) % p, rand(bits) % p, rand(bits) % p
+	local b = bn.nnmod(y * y - x * x * x - a * x, p)
+	return { p, a, b, x, y, p }
+end
+
+add("curve", function(bits)
+	local t = curveparams(bits)
+	return function() return bn.curve(t) end
+end, 4096)
+
+add("curve.add", function(bits)
+	local c = bn.curve(curveparams(bits))
+	local g = c:generator()
+	local p, q = c:mul(rand(bits), g), c:mul(rand(bits), g)
+	return function() return p + q end
+end, 4096)
+
+add("curve.mul", function(bits)
+	local c = bn.curve(curveparams(bits))
+	local g, k = c:generator(), rand(bits)
+	return function() return c:mul(k, g) end
+end, 1024)
+
+add("curve.mul_precomputed", function(bits)
+	local c = bn.curve(curveparams(bits))
+	local k = rand(bits)
+	c:precompute()
+	return function() return c:mul(k, nil, true) end
+end, 1024)
+
+add("curve.mul_vartime", function(bits)
+	local c = bn.curve(curveparams(bits))
+	local g, k = c:generator(), rand(bits)
+	return function() return c:mul(k, g, true) end
+end, 1024)
+
+add("curve.mulsum", function(bits)
+	local c = bn.curve(curveparams(bits))
+	local g, points = c:generator(), {}
+	for i = 1, 16 do
+		points[i] = c:mul(rand(bits), g)
+	end
+	local scalars = vector(16, bits)
+	return function() return c:mulsum(nil, points, scalars) end
+end, 1024)
+
+add("curve.affine", function(bits)
+	local c = bn.curve(curveparams(bits))
+	local g, points = c:generator(), {}
+	for i = 1, 16 do
+		points[i] = c:mul(rand(bits), g)
+	end
+	return function() return c:affine(points) end
+end, 4096)
+
+-- Arguments are sizes of results.
+add("factorial", function(bits)
+	local n = math.floor(bits / 8)
+	return function() return bn.factorial(n) end
+end, 262144)
+
+add("binomial", function(bits)
+	local n = math.floor(bits / 4)
+	return function() return bn.binomial(n, math.floor(n / 2)) end
+end, 262144)
+
+-- Parsing, 16 numbers of bits bits each.
+local function numbers(bits)
+	local t = {}
+	for i, v in ipairs(vector(16, bits)) do
+		t[i] = tostring(v)
+	end
+	return table.concat(t, " ")
+end
+
+add("parse_all", function(bits)
+	local s = numbers(bits)
+	return function() return bn.parse_all(s) end
+end, 16384)
+
+add("lines", function(bits)
+	local name = os.tmpname()
+	local file = assert(io.open(name, "w"))
+	file:write(numbers(bits))
+	file:close()
+	return function()
+		local f = assert(io.open(name))
+		for x in bn.lines(f) do
+		end
+		f:close()
+	end
+end, 16384)
+
+add("multhresholds", function()
+	return function() return bn.multhresholds() end
+end, 64)
+
+-- Instrumentation, bn.stats returns nil without -DLUABN_STATS.
+add("stats", function()
+	return function() return bn.stats() end
+end, 64)
+
+add("stats_reset", function()
+	return function() return bn.stats_reset() end
+end, 64)
+
+add("stats_enable", function()
+	return function() return bn.stats_enable(false) end
+end, 64)
+
+-- Sharing between Lua states.
+add("share", function(bits)
+	local a = rand(bits)
+	bn.unshare("bench")
+	bn.share("bench", a)
+	return function() return bn.share("bench", a) end
+end)
+
+add("shared", function(bits)
+	local a = rand(bits)
+	bn.unshare("bench")
+	bn.share("bench", a)
+	return function() return bn.shared("bench") end
+end)
+
+add("unshare", function(bits)
+	local a = rand(bits)
+	bn.unshare("bench")
+	return function()
+		bn.share("bench", a)
+		bn.unshare("bench")
+	end
+end)
+
+-- Fixed-width types at their own size only.
+for _, v in ipairs { { "u256", 256 }, { "u384", 384 }, { "u512", 512 } } do
+	local name, width = v[1], v[2]
+	local new = bn[name]
+	local function fixed(op, f)
+		add(name .. "." .. op, function(bits)
+			if bits ~= 256 then
+				return nil
+			end
+			local a, b = new(rand(width)), new(rand(width))
+			local m = new(oddrand(width))
+			return function() return f(a, b, m) end, width
+		end, 256)
+	end
+	fixed("new", function(a) return new(a) end)
+	fixed("__add", function(a, b) return a + b end)
+	fixed("__mul", function(a, b) return a * b end)
+	fixed("__lt", function(a, b) return a < b end)
+	fixed("montmul", function(a, b, m) return a:montmul(b, m) end)
+	fixed("tonumber", function(a) return a:tonumber() end)
+end
+
+-- Metamethods.
+for _, v in ipairs {
+	{ "__add", "a + b" }, { "__sub", "a - b" }, { "__mul", "a * b" },
+	{ "__div", "a / b", 0.5 }, { "__mod", "a % b", 0.5 },
+	{ "__idiv", "a // b", 0.5 }, { "__lt", "a < b" },
+	{ "__le", "a <= b" }, { "__band", "a & b" }, { "__bor", "a | b" },
+	{ "__bxor", "a ~ b" },
+} do
+	local f = operator(v[2])
+	if f then
+		-- Lua 5.1 and LuaJIT don't compare userdata with other types.
+		local kinds = mixed
+		if (v[1] == "__lt" or v[1] == "__le") and
+		    (_VERSION == "Lua 5.1" or jit) then
+			kinds = nil
+		end
+		binary(v[1], f, nil, kinds, v[3])
+	end
+end
+
+binary("__eq", function(a, b) return a == b end)
+unary("__unm", function(a) return -a end)
+unary("__bnot", operator("~a"))
+unary("__tostring", tostring, 65536)
+
+add("__shl", function(bits)
+	local f, a, n = operator("a << b"), rand(bits), 17
+	return f and function() return f(a, n) end
+end)
+
+add("__pow", function(bits)
+	local a = rand(math.max(1, math.floor(bits / 7)))
+	return function() return a ^ 7 end
+end)
+
+-- Creation and collection of short-lived numbers.
+add("__gc", function(bits)
+	local a = rand(bits)
+	return function() local r = a + 0 end
+end)
+
+print("op\tbits\ttype\tcalls\tns\tallocs\tbytes\tgc_ns")
+
+for _, op in ipairs(ops) do
+	local name, setup, limit, kinds = op[1], op[2], op[3], op[4]
+	if name:find(pattern) then
+		for _, bits in ipairs(sizes) do
+			for _, kind in ipairs(bits <= limit and kinds or {}) do
+				-- Conversion from decimal string is quadratic.
+				if kind ~= "str" or bits <= 16384 then
+					local f, size = setup(bits, kind)
+					if f then
+						report(name, size or bits, kind, f)
+					end
+				end
+			end
+		end
+	end
+end
+
+-- Functions which aren't benchmarked, keep this list empty.
+local covered = { u256 = true, u384 = true, u512 = true }
+for _, op in ipairs(ops) do
+	covered[op[1]] = true
+end
+for name in pairs(bn) do
+	if not covered[name] then
+		io.stderr:write("not benchmarked: bn.", name, "\n")
+	end
+end
@@ -0,0 +1,208 @@
+--[[
+LuaJIT FFI binding of the luaBn C interface, see luaBn-c-api(3).
+
+	local bnffi = require "bnffi"
+
+	local r = bnffi.new()
+	bnffi.mul(r, a, b) -- r = a * b
+
+Functions accept both BIGNUM * cdata objects and bn.number userdata.
+Like their C counterparts, operations store a result in the first
+argument and they don't allocate memory for it. Read-only shared
+handles of bn.share and bn.shared can't be results.
+FFI calls are compiled by the JIT compiler unlike calls of Lua C functions.
+--]]
+
+local ffi = require "ffi"
+local bn = require "bn"
+
+ffi.cdef [[
+typedef struct bignum_st BIGNUM;
+typedef struct bignum_ctx BN_CTX;
+
+BIGNUM *luaBn_new(void);
+void luaBn_free(BIGNUM *);
+BN_CTX *luaBn_ctx_new(void);
+void luaBn_ctx_free(BN_CTX *);
+int luaBn_copy(void *, const void *);
+int luaBn_setint(void *, int64_t);
+int luaBn_getint(const void *, int64_t *);
+int luaBn_cmp(const void *, const void *);
+int luaBn_ucmp(const void *, const void *);
+int luaBn_add(void *, const void *, const void *);
+int luaBn_sub(void *, const void *, const void *);
+int luaBn_mul(void *, const void *, const void *, BN_CTX *);
+int luaBn_sqr(void *, const void *, BN_CTX *);
+int luaBn_div(void *, const void *, const void *, BN_CTX *);
+int luaBn_mod(void *, const void *, const void *, BN_CTX *);
+int luaBn_nnmod(void *, const void *, const void *, BN_CTX *);
+int luaBn_modadd(void *, const void *, const void *, const void *, BN_CTX *);
+int luaBn_modsub(void *, const void *, const void *, const void *, BN_CTX *);
+int luaBn_modmul(void *, const void *, const void *, const void *, BN_CTX *);
+int luaBn_modpow(void *, const void *, const void *, const void *, BN_CTX *);
+int luaBn_lshift(void *, const void *, int);
+int luaBn_rshift(void *, const void *, int);
+]]
+
+-- Load the same library as require "bn" did.
+local C = ffi.load(package.searchpath("bn", package.cpath) or "luaBn")
+
+local ctx = ffi.gc(C.luaBn_ctx_new(), C.luaBn_ctx_free)
+if ctx == nil then
+	error("bnffi: luaBn_ctx_new failed")
+end
+
+local int64 = ffi.typeof("int64_t[1]")
+
+local function check(status, name)
+	if status == 0 then
+		error(name .. " failed", 3)
+	end
+end
+
+-- Raises an error if a result r is a read-only shared handle. Its
+-- digits are shared by all threads and must not be written.
+local function writable(r, name)
+	if type(r) == "userdata" and bn.isshared(r) then
+		error(name .. ": read-only shared number", 3)
+	end
+end
+
+local M = {}
+
+-- Copies v to r. v is a bn.number, a BIGNUM * or a value
+-- accepted by bn.number().
+function M.set(r, v)
+	writable(r, "bnffi.set")
+	if type(v) == "number" and v == math.floor(v)
+	    and math.abs(v) < 2^63 then
+		check(C.luaBn_setint(r, v), "bnffi.set")
+	else
+		if type(v) ~= "cdata" then
+			v = bn.number(v)
+		end
+		check(C.luaBn_copy(r, v), "bnffi.set")
+	end
+	return r
+end
+
+-- Creates a new BIGNUM * object with an optional value v.
+function M.new(v)
+	local r = C.luaBn_new()
+	if r == nil then
+		error("bnffi.new: no memory", 2)
+	end
+	r = ffi.gc(r, C.luaBn_free)
+	if v ~= nil then
+		M.set(r, v)
+	end
+	return r
+end
+
+-- Converts a to bn.number.
+function M.tonumber(a)
+	local r = bn.number(0)
+	check(C.luaBn_copy(r, a), "bnffi.tonumber")
+	return r
+end
+
+function M.tostring(a)
+	return tostring(M.tonumber(a))
+end
+
+-- Returns int64_t cdata or nil if a doesn't fit.
+function M.toint(a)
+	local v = int64()
+	if C.luaBn_getint(a, v) == 0 then
+		return nil
+	end
+	return v[0]
+end
+
+function M.cmp(a, b)
+	return C.luaBn_cmp(a, b)
+end
+
+function M.ucmp(a, b)
+	return C.luaBn_ucmp(a, b)
+end
+
+function M.add(r, a, b)
+	writable(r, "bnffi.add")
+	check(C.luaBn_add(r, a, b), "bnffi.add")
+	return r
+end
+
+function M.sub(r, a, b)
+	writable(r, "bnffi.sub")
+	check(C.luaBn_sub(r, a, b), "bnffi.sub")
+	return r
+end
+
+function M.mul(r, a, b)
+	writable(r, "bnffi.mul")
+	check(C.luaBn_mul(r, a, b, ctx), "bnffi.mul")
+	return r
+end
+
+function M.sqr(r, a)
+	writable(r, "bnffi.sqr")
+	check(C.luaBn_sqr(r, a, ctx), "bnffi.sqr")
+	return r
+end
+
+function M.div(r, a, b)
+	writable(r, "bnffi.div")
+	check(C.luaBn_div(r, a, b, ctx), "bnffi.div")
+	return r
+end
+
+function M.mod(r, a, b)
+	writable(r, "bnffi.mod")
+	check(C.luaBn_mod(r, a, b, ctx), "bnffi.mod")
+	return r
+end
+
+function M.nnmod(r, a, m)
+	writable(r, "bnffi.nnmod")
+	check(C.luaBn_nnmod(r, a, m, ctx), "bnffi.nnmod")
+	return r
+end
+
+function M.modadd(r, a, b, m)
+	writable(r, "bnffi.modadd")
+	check(C.luaBn_modadd(r, a, b, m, ctx), "bnffi.modadd")
+	return r
+end
+
+function M.modsub(r, a, b, m)
+	writable(r, "bnffi.modsub")
+	check(C.luaBn_modsub(r, a, b, m, ctx), "bnffi.modsub")
+	return r
+end
+
+function M.modmul(r, a, b, m)
+	writable(r, "bnffi.modmul")
+	check(C.luaBn_modmul(r, a, b, m, ctx), "bnffi.modmul")
+	return r
+end
+
+function M.modpow(r, a, p, m)
+	writable(r, "bnffi.modpow")
+	check(C.luaBn_modpow(r, a, p, m, ctx), "bnffi.modpow")
+	return r
+end
+
+function M.lshift(r, a, n)
+	writable(r, "bnffi.lshift")
+	check(C.luaBn_lshift(r, a, n), "bnffi.lshift")
+	return r
+end
+
+function M.rshift(r, a, n)
+	writable(r, "bnffi.rshift")
+	check(C.luaBn_rshift(r, a, n), "bnffi.rshift")
+	return r
+end
+
+return M
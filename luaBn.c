@@ -45,19 +45,50 @@
 #include <lauxlib.h>
 
 #include <openssl/bn.h>
+#include <openssl/ec.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
 
 #include <assert.h>
+#include <ctype.h>
+#include <float.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if LUA_VERSION_NUM <= 501
+#define lua_rawlen lua_objlen
+#endif
 
 #define BN_METATABLE "bn.number"
 #define CTX_METATABLE "bn.ctx"
+#define CRT_METATABLE "bn.crtctx"
+#define LAZY_METATABLE "bn.lazy"
+#define RAT_METATABLE "bn.rational"
+#define CURVE_METATABLE "bn.curve"
+#define POINT_METATABLE "bn.point"
+
+/*
+ * All functions registered by luaBn_open() share upvalues:
+ * BN_METATABLE metatable, BN_CTX object, metatables of
+ * fixed-width types (see fixedtypes), LAZY_METATABLE and
+ * RAT_METATABLE. They're faster to access than values in the registry.
+ */
+#define BN_MT_UPVALUE   lua_upvalueindex(1)
+#define CTX_UPVALUE     lua_upvalueindex(2)
+#define LAZY_MT_UPVALUE lua_upvalueindex(6)
+#define RAT_MT_UPVALUE  lua_upvalueindex(7)
+#define NUPVALUES       7
 
 #define getbn(L, narg) ((struct BN *)lua_touserdata(L, (narg)))
-#define checkbn(L, narg) ((struct BN *)luaL_checkudata(L, (narg), BN_METATABLE))
-#define checkbignum(L, narg) (&checkbn(L, narg)->bignum)
+#define getfixed(L, narg) ((fixedlimb *)lua_touserdata(L, (narg)))
+#define checkbignum(L, narg) \
+	(&((struct BN *)luaL_checkudata(L, (narg), BN_METATABLE))->bignum)
 
 #define negatebignum(bn) BN_set_negative((bn), !BN_is_negative((bn)))
 
@@ -67,6 +98,7 @@ typedef int64_t  luaBn_Int;
 typedef uint64_t luaBn_UInt;
 
 #define LUABN_UINT_MAX UINT64_MAX
+#define LUABN_NUMBER_DIGITS DBL_MANT_DIG
 
 #elif LUA_NUMBER_FLOAT
 
@@ -74,6 +106,7 @@ typedef int32_t  luaBn_Int;
 typedef uint32_t luaBn_UInt;
 
 #define LUABN_UINT_MAX UINT32_MAX
+#define LUABN_NUMBER_DIGITS FLT_MANT_DIG
 
 #else /* lua_Number is an integral type. */
 
@@ -81,6 +114,7 @@ typedef intmax_t  luaBn_Int;
 typedef uintmax_t luaBn_UInt;
 
 #define LUABN_UINT_MAX UINTMAX_MAX
+#define LUABN_NUMBER_DIGITS (CHAR_BIT * sizeof(luaBn_Int) - 1)
 
 #endif
 
@@ -94,21 +128,242 @@ struct BN
 	 * after the string is successfully pushed.
 	 */
 	char *str;
+
+	/*
+	 * Not NULL if the object is a read-only handle of a shared
+	 * number. The bignum aliases limbs of shared->bignum.
+	 */
+	struct shared *shared;
+
+	/* Result of b:key() or NULL, see f_key(). */
+	char *key;
+	size_t keylen;
+};
+
+/*
+ * Process-wide number registered with bn.share(). It's referenced
+ * by the store while it has a name and by every handle.
+ * All fields except bignum and name are protected by shared_lock.
+ */
+struct shared
+{
+	struct shared *next;
+	BIGNUM bignum;
+	BN_MONT_CTX *mont; /* Lazily created by shared_mont(). */
+	unsigned long refcnt;
+	char name[];
+};
+
+/*
+ * Default thresholds of bigmul() in bits. They can be changed
+ * at run-time with bn.multhresholds(), see bench/mul.lua.
+ * One level of Toom-3 doesn't beat Karatsuba of BN_mul on x86_64
+ * at any size where NTT isn't faster, so by default Toom-3 only
+ * splits operands which are too long for NTT.
+ */
+#ifndef LUABN_TOOM3_BITS
+#define LUABN_TOOM3_BITS 786432
+#endif
+#ifndef LUABN_NTT_BITS
+#define LUABN_NTT_BITS 786432
+#endif
+
+/* Minimal Toom-3 threshold in limbs which guarantees termination. */
+#define TOOM3_MINLIMBS 8
+
+/* Thresholds of bigmul() in limbs. */
+struct mulparams
+{
+	int toom3;
+	int ntt;
+};
+
+static const struct mulparams default_mulparams = {
+	(LUABN_TOOM3_BITS + BN_BITS2 - 1) / BN_BITS2,
+	(LUABN_NTT_BITS + BN_BITS2 - 1) / BN_BITS2
+};
+
+/* Number of cached 10^(2^k) values, see tenexp(). */
+#define POW10_CACHE 16
+
+#ifdef LUABN_STATS
+/*
+ * Instrumentation, compiled in with -DLUABN_STATS and enabled at
+ * run-time with bn.stats_enable(true). Every function registered
+ * by luaBn_open() is wrapped by statcall() which updates funcstats
+ * of that function. Counters are per Lua state, they're kept in
+ * CTX_UPVALUE.
+ */
+#define STATS_BUCKETS 32
+
+struct funcstats
+{
+	lua_CFunction func;
+	struct funcstats *next;
+	char name[48];
+	double time; /* Total time of calls which returned. */
+	unsigned long calls;
+	/* Calls which took [2^i, 2^(i+1)) nanoseconds. */
+	unsigned long latency[STATS_BUCKETS];
+	/* Calls with the largest bn.number argument of [2^i, 2^(i+1)) bits. */
+	unsigned long sizes[STATS_BUCKETS];
+};
+
+struct stats
+{
+	struct funcstats *funcs;
+	bool enabled;
+	unsigned long numbers;   /* Conversions from Lua numbers. */
+	unsigned long strings;   /* Conversions from strings. */
+	unsigned long fixed;     /* Conversions from fixed-width numbers. */
+	unsigned long created;   /* New bn.number objects. */
+	unsigned long collected; /* Calls of __gc of bn.number objects. */
+	unsigned long ctx;       /* Uses of BN_CTX. */
+};
+
+#define STATS_INC(L, field) do {					\
+	struct stats *st_;						\
+	st_ = &((struct ctxval *)lua_touserdata((L), CTX_UPVALUE))->stats; \
+	if (st_->enabled)						\
+		st_->field++;						\
+} while (0)
+#else
+#define STATS_INC(L, field) ((void)0)
+#endif
+
+/* Payload of CTX_UPVALUE. */
+struct ctxval
+{
+	BN_CTX *ctx;
+	struct mulparams mul;
+	BIGNUM *pow10[POW10_CACHE];
+	uint64_t hashkey[2]; /* Random key of limbhash(). */
+#ifdef LUABN_STATS
+	struct stats stats;
+#endif
+};
+
+static int bigmul(BIGNUM *, const BIGNUM *, const BIGNUM *,
+    const struct mulparams *, BN_CTX *);
+
+/* Nodes of bn.lazy expressions and operations of bn.rational. */
+enum lazyop
+{
+	LAZY_LEAF,
+	LAZY_ADD,
+	LAZY_SUB,
+	LAZY_MUL,
+	LAZY_DIV,
+	LAZY_MOD,
+	LAZY_POW,
+	LAZY_UNM
 };
 
+static int lazyarith(lua_State *, enum lazyop);
+static int ratarith(lua_State *, enum lazyop);
+static bool testrational(lua_State *, int);
+static int ratcompare(lua_State *);
+static int pointmul(lua_State *);
+static struct point *testpoint(lua_State *, int);
+
+/* True if an operand of a bn.number metamethod may be bn.lazy. */
+#define LAZYOPERANDS(L) \
+	(lua_type((L), 1) == LUA_TTABLE || lua_type((L), 2) == LUA_TTABLE)
+
+/*
+ * True if the second operand of a bn.number metamethod is bn.rational.
+ * A rational first operand has its own metamethods. The size check
+ * skips the metatable lookup for bn.number operands.
+ */
+#define RATOPERAND(L) \
+	(lua_type((L), 2) == LUA_TUSERDATA && \
+	lua_rawlen((L), 2) != sizeof(struct BN) && testrational((L), 2))
+
+/* Same as RATOPERAND() for bn.point, only __mul accepts it. */
+#define POINTOPERAND(L) \
+	(lua_type((L), 2) == LUA_TUSERDATA && \
+	lua_rawlen((L), 2) != sizeof(struct BN) && testpoint((L), 2) != NULL)
+
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct shared *shared_list;
+
 /*
- * Unique keys to access values in the Lua registry.
+ * Montgomery context of odd shared modulus or NULL. It's computed
+ * once and it's read-only afterwards, so it can be used by all threads.
  */
-static char ctx_key;
+static BN_MONT_CTX *
+shared_mont(struct shared *sh, BN_CTX *ctx)
+{
+	BN_MONT_CTX *mont;
+
+	if (!BN_is_odd(&sh->bignum))
+		return NULL;
+
+	pthread_mutex_lock(&shared_lock);
+
+	if (sh->mont == NULL && (mont = BN_MONT_CTX_new()) != NULL) {
+		if (BN_MONT_CTX_set(mont, &sh->bignum, ctx))
+			sh->mont = mont;
+		else
+			BN_MONT_CTX_free(mont);
+	}
+
+	mont = sh->mont;
+
+	pthread_mutex_unlock(&shared_lock);
+
+	return mont;
+}
+
+static void
+shared_free(struct shared *sh)
+{
+
+	BN_free(&sh->bignum);
+	if (sh->mont != NULL)
+		BN_MONT_CTX_free(sh->mont);
+	free(sh);
+}
+
+static void
+shared_release(struct shared *sh)
+{
+	bool last;
+
+	pthread_mutex_lock(&shared_lock);
+	last = (--sh->refcnt == 0);
+	pthread_mutex_unlock(&shared_lock);
+
+	if (last)
+		shared_free(sh);
+}
+
+/* Should be called with shared_lock held. */
+static struct shared **
+shared_lookup(const char *name)
+{
+	struct shared **p;
+
+	for (p = &shared_list; *p != NULL; p = &(*p)->next) {
+		if (strcmp((*p)->name, name) == 0)
+			break;
+	}
+
+	return p;
+}
 
 #if LUABN_UINT_MAX > ULONG_MAX
-/* Modulo val is used to negate values in numbertobignum(). */
+/*
+ * Unique key to access modulo val in the Lua registry.
+ * Modulo val is used to negate values in numbertobignum().
+ */
 static char modulo_key;
 #endif
 
 /* 
- * Aka luaL_testudata(L, narg, BN_METATABLE) but it also casts
- * from struct BN to BIGNUM.
+ * Aka luaL_testudata(L, narg, BN_METATABLE) but it compares
+ * a metatable with BN_MT_UPVALUE and it also casts from struct BN
+ * to BIGNUM.
  */
 static BIGNUM *
 testbignum(lua_State *L, int narg)
@@ -117,11 +372,12 @@ testbignum(lua_State *L, int narg)
 
 	udata = getbn(L, narg);
 
-	if (udata != NULL && lua_getmetatable(L, narg)) {
-		lua_getfield(L, LUA_REGISTRYINDEX, BN_METATABLE);
-		if (!lua_rawequal(L, -1, -2))
+	if (udata != NULL) {
+		if (!lua_getmetatable(L, narg))
+			return NULL;
+		if (!lua_rawequal(L, -1, BN_MT_UPVALUE))
 			udata = NULL;
-		lua_pop(L, 2);
+		lua_pop(L, 1);
 	}
 
 	return (udata != NULL) ? &udata->bignum : NULL;
@@ -140,6 +396,16 @@ typerror(lua_State *L, int narg, const char *tname)
 	return luaL_argerror(L, narg, msg);
 }
 
+static struct BN *
+checkbn(lua_State *L, int narg)
+{
+
+	if (testbignum(L, narg) == NULL)
+		typerror(L, narg, BN_METATABLE);
+
+	return getbn(L, narg);
+}
+
 /*
  * Converts absolute or relative stack index to absolute index.
  */
@@ -152,11 +418,27 @@ absindex(lua_State *L, int narg)
 }
 
 /*
- * If abs(d) can be converted BN_ULONG, returns abs(d). Otherwise, returns 0.
+ * If absolute value of a number at narg can be converted to BN_ULONG,
+ * returns that value and sets isneg. Otherwise, returns 0.
  */
 static inline BN_ULONG
-absnumber(lua_Number d)
+absnumber(lua_State *L, int narg, bool *isneg)
 {
+	lua_Number d;
+#if LUA_VERSION_NUM >= 503
+	lua_Integer i;
+	lua_Unsigned u;
+
+	if (lua_isinteger(L, narg)) {
+		i = lua_tointeger(L, narg);
+		u = (i < 0) ? 0u - (lua_Unsigned)i : (lua_Unsigned)i;
+		*isneg = (i < 0);
+		return (u == (BN_ULONG)u) ? (BN_ULONG)u : 0;
+	}
+#endif
+
+	d = lua_tonumber(L, narg);
+	*isneg = (d < 0);
 
 	if (d > 0 && d == (BN_ULONG)d)
 		return (BN_ULONG)d;
@@ -166,6 +448,55 @@ absnumber(lua_Number d)
 		return 0;
 }
 
+/*
+ * Sets abs(bn) to u. BN_ULONG may be narrower than uintmax_t.
+ */
+static int
+setumax(BIGNUM *bn, uintmax_t u)
+{
+	int shift;
+
+	if (u == (BN_ULONG)u)
+		return BN_set_word(bn, (BN_ULONG)u);
+
+	for (shift = 0; shift < (int)(CHAR_BIT * sizeof(u)); shift += 32) {
+		if ((u >> shift >> 16 >> 16) == 0)
+			break;
+	}
+
+	if (!BN_set_word(bn, (BN_ULONG)((u >> shift) & 0xffffffffu)))
+		return 0;
+
+	while (shift > 0) {
+		shift -= 32;
+		if (!BN_lshift(bn, bn, 32))
+			return 0;
+		if (!BN_add_word(bn, (BN_ULONG)((u >> shift) & 0xffffffffu)))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * If abs(bn) fits into uintmax_t, stores it in u and returns true.
+ */
+static bool
+getumax(const BIGNUM *bn, uintmax_t *u)
+{
+	unsigned char buf[sizeof(uintmax_t)];
+	int i, nbytes;
+
+	if (BN_num_bytes(bn) > (int)sizeof(buf))
+		return false;
+
+	nbytes = BN_bn2bin(bn, buf);
+	for (i = 0, *u = 0; i < nbytes; i++)
+		*u = (*u << CHAR_BIT) | buf[i];
+
+	return true;
+}
+
 static int
 bnerror(lua_State *L, const char *msg)
 {
@@ -184,64 +515,151 @@ bnerror(lua_State *L, const char *msg)
 }
 
 /*
- * Creates a new BN object and pushes it to stack.
+ * Creates a new BN object with a metatable at index mt
+ * and pushes it to stack.
  */
 static BIGNUM *
-newbignum(lua_State *L)
+newbignum_mt(lua_State *L, int mt)
 {
 	struct BN *udata;
 
 	udata = (struct BN *)lua_newuserdata(L, sizeof(struct BN));
 	udata->str = NULL;
+	udata->shared = NULL;
+	udata->key = NULL;
 	BN_init(&udata->bignum);
 
-	luaL_getmetatable(L, BN_METATABLE);
+	lua_pushvalue(L, mt);
 	lua_setmetatable(L, -2);
 
+	/* Only functions registered by luaBn_open() pass BN_MT_UPVALUE. */
+	if (mt == BN_MT_UPVALUE)
+		STATS_INC(L, created);
+
 	return &udata->bignum;
 }
 
-/* Replaces string at narg with bignum. */
+#define newbignum(L) newbignum_mt((L), BN_MT_UPVALUE)
+
+/*
+ * Parses decimal or hexadecimal (with "0x" prefix) number with
+ * an optional minus sign at s. Parsing stops at the first character
+ * which isn't a digit. Returns a number of characters consumed or 0
+ * on error.
+ */
+static int
+parsebignum(BIGNUM *rv, const char *s)
+{
+	const char *p;
+	size_t z;
+	int rvlen;
+
+	p = (s[0] == '-') ? s + 1 : s;
+
+	/* Some versions of BN_dec2bn() and BN_hex2bn() accept "-". */
+	z = (p[0] == '0') ? 1 : 0;
+	if (p[z] != 'x' && p[z] != 'X')
+		return isdigit((unsigned char)p[0]) ? BN_dec2bn(&rv, s) : 0;
+
+	p += z + 1;
+	if (!isxdigit((unsigned char)p[0]))
+		return 0;
+
+	rvlen = BN_hex2bn(&rv, p);
+	if (rvlen == 0)
+		return 0;
+
+	if (s[0] == '-')
+		BN_set_negative(rv, 1);
+
+	return rvlen + (p - s);
+}
+
+/*
+ * Same as parsebignum() but for values which fit into a word.
+ * Returns false if parsebignum() should be called instead.
+ */
+static bool
+parseword(const char *s, BN_ULONG *n, bool *isneg)
+{
+	const char *p;
+	BN_ULONG d;
+	size_t z;
+
+	p = (s[0] == '-') ? s + 1 : s;
+	*isneg = false;
+	*n = 0;
+
+	z = (p[0] == '0') ? 1 : 0;
+	if (p[z] != 'x' && p[z] != 'X') {
+		if (!isdigit((unsigned char)p[0]))
+			return false;
+		for (; isdigit((unsigned char)*p); p++) {
+			d = (BN_ULONG)(*p - '0');
+			if (*n > (BN_MASK2 - d) / 10)
+				return false;
+			*n = *n * 10 + d;
+		}
+	} else {
+		p += z + 1;
+		if (!isxdigit((unsigned char)p[0]))
+			return false;
+		for (; isxdigit((unsigned char)*p); p++) {
+			if (*n > (BN_MASK2 >> 4))
+				return false;
+			d = isdigit((unsigned char)*p) ? (BN_ULONG)(*p - '0') :
+			    (BN_ULONG)(tolower((unsigned char)*p) - 'a' + 10);
+			*n = (*n << 4) | d;
+		}
+	}
+
+	*isneg = (s[0] == '-' && *n != 0);
+	return true;
+}
+
+/* Replaces string at narg with bignum with a metatable at index mt. */
 static BIGNUM *
-stringtobignum(lua_State *L, int narg)
+stringtobignum(lua_State *L, int narg, int mt)
 {
 	BIGNUM *rv;
 	const char *s;
-	size_t z;
-	int rvlen;
 
 	s = lua_tostring(L, narg);
 	assert(s != NULL);
 
+	if (mt == BN_MT_UPVALUE)
+		STATS_INC(L, strings);
+
 	narg = absindex(L, narg);
-	rv = newbignum(L);
+	rv = newbignum_mt(L, mt);
 	lua_replace(L, narg);
 
-	/* XXX "-0xdeadbeef" */
-	z = (s[0] == '0') ? 1 : 0;
-	if (s[z] == 'x' || s[z] == 'X')
-		rvlen = BN_hex2bn(&rv, s + z + 1);
-	else
-		rvlen = BN_dec2bn(&rv, s);
-
-	if (rvlen == 0)
+	if (parsebignum(rv, s) == 0)
 		bnerror(L, "unable to parse " BN_METATABLE);
 
 	return rv;
 }
 
-static BN_CTX *
+static inline BN_CTX *
 get_ctx_val(lua_State *L)
 {
-	BN_CTX **udata;
 
-	lua_pushlightuserdata(L, &ctx_key);
-	lua_rawget(L, LUA_REGISTRYINDEX);
-	assert(luaL_checkudata(L, -1, CTX_METATABLE) != NULL);
-	udata = (BN_CTX **)lua_touserdata(L, -1);
-	lua_pop(L, 1);
+	STATS_INC(L, ctx);
+	return ((struct ctxval *)lua_touserdata(L, CTX_UPVALUE))->ctx;
+}
+
+static inline struct ctxval *
+get_ctxval(lua_State *L)
+{
+
+	return (struct ctxval *)lua_touserdata(L, CTX_UPVALUE);
+}
+
+static inline struct mulparams *
+get_mulparams(lua_State *L)
+{
 
-	return *udata;
+	return &get_ctxval(L)->mul;
 }
 
 #if LUABN_UINT_MAX > ULONG_MAX
@@ -252,7 +670,7 @@ get_modulo_val(lua_State *L)
 
 	lua_pushlightuserdata(L, &modulo_key);
 	lua_rawget(L, LUA_REGISTRYINDEX);
-	assert(testbignum(L, -1) != NULL);
+	assert(luaL_checkudata(L, -1, BN_METATABLE) != NULL);
 	bn = (struct BN *)lua_touserdata(L, -1);
 	lua_pop(L, 1);
 
@@ -260,15 +678,21 @@ get_modulo_val(lua_State *L)
 }
 #endif
 
-/* Replaces number at narg with bignum. */
+/* Replaces number at narg with bignum with a metatable at index mt. */
 static BIGNUM *
-numbertobignum(lua_State *L, int narg)
+numbertobignum(lua_State *L, int narg, int mt)
 {
 	BIGNUM *rv;
 	lua_Number d;
 	luaBn_UInt n, w;
+	BN_ULONG absn;
 	size_t i;
 	int shift;
+	bool isneg;
+#if LUA_VERSION_NUM >= 503
+	lua_Integer li;
+	lua_Unsigned lu;
+#endif
 
 	const int wshift = 32;
 	const unsigned long wmask = 0xffffffffu;
@@ -276,11 +700,39 @@ numbertobignum(lua_State *L, int narg)
 
 	assert(nwords > 0);
 
+	if (mt == BN_MT_UPVALUE)
+		STATS_INC(L, numbers);
+
+	narg = absindex(L, narg);
+	absn = absnumber(L, narg, &isneg);
+
+	rv = newbignum_mt(L, mt);
+
+	if (absn != 0) {
+		lua_replace(L, narg);
+		if (!BN_set_word(rv, absn))
+			bnerror(L, "BN_set_word in numbertobignum");
+		BN_set_negative(rv, isneg);
+		return rv;
+	}
+
+#if LUA_VERSION_NUM >= 503
+	if (lua_isinteger(L, narg)) {
+		/* BN_ULONG is narrower than lua_Integer. */
+		li = lua_tointeger(L, narg);
+		lu = (li < 0) ? 0u - (lua_Unsigned)li : (lua_Unsigned)li;
+		lua_replace(L, narg);
+
+		if (!setumax(rv, lu))
+			bnerror(L, "setumax in numbertobignum");
+		BN_set_negative(rv, li < 0);
+		return rv;
+	}
+#endif
+
 	d = lua_tonumber(L, narg);
 	n = (luaBn_Int)d;
 
-	narg = absindex(L, narg);
-	rv = newbignum(L);
 	lua_replace(L, narg);
 
 	if (!BN_zero(rv))
@@ -326,799 +778,8136 @@ numbertobignum(lua_State *L, int narg)
 BIGNUM *
 luaBn_tobignum(lua_State *L, int narg)
 {
+	BIGNUM *rv;
 
 	switch (lua_type(L, narg)) {
-		case LUA_TNUMBER:   return numbertobignum(L, narg);
-		case LUA_TSTRING:   return stringtobignum(L, narg);
-		case LUA_TUSERDATA: return checkbignum(L, narg);
+		case LUA_TNUMBER:
+		case LUA_TSTRING:
+			narg = absindex(L, narg);
+			luaL_getmetatable(L, BN_METATABLE);
+			if (lua_type(L, narg) == LUA_TNUMBER)
+				rv = numbertobignum(L, narg, lua_gettop(L));
+			else
+				rv = stringtobignum(L, narg, lua_gettop(L));
+			lua_pop(L, 1);
+			return rv;
+		case LUA_TUSERDATA:
+			return checkbignum(L, narg);
 	}
 
 	typerror(L, narg, "number, string or " BN_METATABLE);
 	return NULL;
 }
 
-static int
-f_number(lua_State *L)
-{
-
-	luaBn_tobignum(L, 1);
-	lua_pushvalue(L, 1);
-	return 1;
-}
-
-static int
-f_tobin(lua_State *L)
+/*
+ * Returns BIGNUM of bn.number object at index narg or NULL if
+ * the object isn't bn.number. Unlike luaBn_tobignum(), it
+ * never converts or allocates.
+ */
+BIGNUM *
+luaBn_testbignum(lua_State *L, int narg)
 {
-	luaL_Buffer buf;
-	struct BN *bn;
-	unsigned char *res;
-	int nbytes;
-
-	luaL_buffinit(L, &buf);
+	struct BN *udata;
 
-	bn = checkbn(L, 1);
-	nbytes = BN_num_bytes(&bn->bignum);
+	udata = getbn(L, narg);
 
-	if (nbytes <= LUAL_BUFFERSIZE) {
-		res = (unsigned char *)luaL_prepbuffer(&buf);
-		nbytes = BN_bn2bin(&bn->bignum, res);
-		luaL_addsize(&buf, nbytes);
-	} else {
-		if (bn->str != NULL)
-			OPENSSL_free(bn->str);
-		bn->str = OPENSSL_malloc(nbytes);
-		if (bn->str == NULL)
-			return bnerror(L, "bn.tobin: no memory");
-		res = (unsigned char *)bn->str;
-		nbytes = BN_bn2bin(&bn->bignum, res);
-		luaL_addlstring(&buf, bn->str, nbytes);
+	if (udata != NULL) {
+		if (!lua_getmetatable(L, narg))
+			return NULL;
+		luaL_getmetatable(L, BN_METATABLE);
+		if (!lua_rawequal(L, -1, -2))
+			udata = NULL;
+		lua_pop(L, 2);
 	}
 
-	luaL_pushresult(&buf);
+	return (udata != NULL) ? &udata->bignum : NULL;
+}
 
-	if (bn->str != NULL)
-		OPENSSL_free(bn->str);
-	bn->str = NULL;
+BIGNUM *
+luaBn_checkbignum(lua_State *L, int narg)
+{
+	BIGNUM *rv;
 
-	return 1;
+	if ((rv = luaBn_testbignum(L, narg)) == NULL)
+		typerror(L, narg, BN_METATABLE);
+
+	return rv;
 }
 
-static int
-m_tostring(lua_State *L)
+/*
+ * Pushes a new bn.number object with a value of zero.
+ */
+BIGNUM *
+luaBn_newbignum(lua_State *L)
 {
-	struct BN *bn;
+	BIGNUM *rv;
 
-	bn = checkbn(L, 1);
+	luaL_getmetatable(L, BN_METATABLE);
+	rv = newbignum_mt(L, lua_gettop(L));
+	lua_remove(L, -2);
 
-	if (bn->str != NULL)
-		OPENSSL_free(bn->str);
-	bn->str = BN_bn2dec(&bn->bignum);
+	return rv;
+}
 
-	lua_pushstring(L, bn->str);
+/*
+ * Pushes a new bn.number object with a copy of a.
+ */
+BIGNUM *
+luaBn_pushbignum(lua_State *L, const BIGNUM *a)
+{
+	BIGNUM *rv;
 
-	OPENSSL_free(bn->str);
-	bn->str = NULL;
+	rv = luaBn_newbignum(L);
+	if (!BN_copy(rv, a))
+		bnerror(L, "BN_copy in luaBn_pushbignum");
 
-	return 1;
+	return rv;
 }
 
+/*
+ * Pushes a new bn.number object and moves a value of a to it.
+ * Limbs aren't copied. The object a is freed with BN_free().
+ * If a Lua error is raised, a is left untouched.
+ */
+BIGNUM *
+luaBn_adoptbignum(lua_State *L, BIGNUM *a)
+{
+	BIGNUM *rv;
+
+	rv = luaBn_newbignum(L);
+	BN_swap(rv, a);
+	BN_free(a);
+
+	return rv;
+}
+
+/*
+ * Fixed-width unsigned types bn.u256, bn.u384 and bn.u512 keep
+ * limbs of BN_ULONG size (least significant first) directly in
+ * userdata. Their metatables are upvalues too. Limbs are 32-bit
+ * if the compiler has no integer type twice as wide as BN_ULONG.
+ */
+#if BN_BITS2 == 64 && defined(__SIZEOF_INT128__)
+typedef BN_ULONG fixedlimb;
+__extension__ typedef unsigned __int128 fixedwide;
+#else
+typedef uint32_t fixedlimb;
+typedef uint64_t fixedwide;
+#endif
+
+#define FIXED_LIMBBITS (8 * (int)sizeof(fixedlimb))
+#define FIXED_NLIMBS(N) ((N) / FIXED_LIMBBITS)
+#define FIXED_MAXLIMBS FIXED_NLIMBS(512)
+
+/*
+ * Kernels of one width called by helpers that take a type at run time.
+ * Arithmetic functions of each type call their kernels directly.
+ */
+struct fixedkernels
+{
+	void (*neg)(fixedlimb *, const fixedlimb *);
+	int (*cmp)(const fixedlimb *, const fixedlimb *);
+};
+
+/* Asks the compiler to unroll a loop with a constant trip count. */
+#if defined(__clang__)
+#define FIXED_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__) && __GNUC__ >= 8
+#define FIXED_UNROLL _Pragma("GCC unroll 16")
+#else
+#define FIXED_UNROLL
+#endif
+
+/*
+ * Generates limb kernels of N-bit numbers and their fixedN_kernels
+ * table. A limb count is a constant in every kernel, so their loops
+ * are unrolled. The result may be the same array as any of the
+ * operands.
+ */
+#define FIXED_KERNELS(N)						\
+static inline fixedlimb							\
+fixed##N##_add(fixedlimb *r, const fixedlimb *a, const fixedlimb *b)	\
+{									\
+	enum { n = FIXED_NLIMBS(N) };					\
+	fixedwide c;							\
+	int i;								\
+									\
+	FIXED_UNROLL							\
+	for (i = 0, c = 0; i < n; i++) {				\
+		c += (fixedwide)a[i] + b[i];				\
+		r[i] = (fixedlimb)c;					\
+		c >>= FIXED_LIMBBITS;					\
+	}								\
+									\
+	return (fixedlimb)c;						\
+}									\
+									\
+static inline fixedlimb							\
+fixed##N##_sub(fixedlimb *r, const fixedlimb *a, const fixedlimb *b)	\
+{									\
+	enum { n = FIXED_NLIMBS(N) };					\
+	fixedwide d;							\
+	fixedlimb borrow;						\
+	int i;								\
+									\
+	FIXED_UNROLL							\
+	for (i = 0, borrow = 0; i < n; i++) {				\
+		d = (fixedwide)a[i] - b[i] - borrow;			\
+		r[i] = (fixedlimb)d;					\
+		borrow = (fixedlimb)(d >> (2 * FIXED_LIMBBITS - 1));	\
+	}								\
+									\
+	return borrow;							\
+}									\
+									\
+static inline void							\
+fixed##N##_neg(fixedlimb *r, const fixedlimb *a)			\
+{									\
+	enum { n = FIXED_NLIMBS(N) };					\
+	fixedwide d;							\
+	fixedlimb borrow;						\
+	int i;								\
+									\
+	FIXED_UNROLL							\
+	for (i = 0, borrow = 0; i < n; i++) {				\
+		d = 0 - (fixedwide)a[i] - borrow;			\
+		r[i] = (fixedlimb)d;					\
+		borrow = (fixedlimb)(d >> (2 * FIXED_LIMBBITS - 1));	\
+	}								\
+}									\
+									\
+static inline int							\
+fixed##N##_cmp(const fixedlimb *a, const fixedlimb *b)			\
+{									\
+	enum { n = FIXED_NLIMBS(N) };					\
+	int i;								\
+									\
+	FIXED_UNROLL							\
+	for (i = n - 1; i >= 0; i--) {					\
+		if (a[i] != b[i])					\
+			return (a[i] < b[i]) ? -1 : 1;			\
+	}								\
+									\
+	return 0;							\
+}									\
+									\
+/* Low n limbs of a * b. */						\
+static inline void							\
+fixed##N##_mul(fixedlimb *r, const fixedlimb *a, const fixedlimb *b)	\
+{									\
+	enum { n = FIXED_NLIMBS(N) };					\
+	fixedlimb t[n];							\
+	fixedwide c;							\
+	int i, j;							\
+									\
+	memset(t, 0, sizeof(t));					\
+									\
+	FIXED_UNROLL							\
+	for (i = 0; i < n; i++) {					\
+		FIXED_UNROLL						\
+		for (j = 0, c = 0; j < n - i; j++) {			\
+			c += (fixedwide)a[i] * b[j] + t[i+j];		\
+			t[i+j] = (fixedlimb)c;				\
+			c >>= FIXED_LIMBBITS;				\
+		}							\
+	}								\
+									\
+	memcpy(r, t, sizeof(t));					\
+}									\
+									\
+/* a + b modulo m for a, b < m. */					\
+static inline void							\
+fixed##N##_modadd(fixedlimb *r, const fixedlimb *a, const fixedlimb *b,	\
+    const fixedlimb *m)							\
+{									\
+									\
+	if (fixed##N##_add(r, a, b) || fixed##N##_cmp(r, m) >= 0)	\
+		fixed##N##_sub(r, r, m);				\
+}									\
+									\
+/* a - b modulo m for a, b < m. */					\
+static inline void							\
+fixed##N##_modsub(fixedlimb *r, const fixedlimb *a, const fixedlimb *b,	\
+    const fixedlimb *m)							\
+{									\
+									\
+	if (fixed##N##_sub(r, a, b))					\
+		fixed##N##_add(r, r, m);				\
+}									\
+									\
+/*									\
+ * Montgomery multiplication a * b / 2^N modulo odd m for a, b < m	\
+ * (CIOS method with multiplication and reduction in one pass).		\
+ * minv is -1/m modulo 2^FIXED_LIMBBITS.				\
+ */									\
+static inline void							\
+fixed##N##_montmul(fixedlimb *r, const fixedlimb *a, const fixedlimb *b, \
+    const fixedlimb *m, fixedlimb minv)					\
+{									\
+	enum { n = FIXED_NLIMBS(N) };					\
+	fixedlimb t[n + 1], u;						\
+	fixedwide c, d;							\
+	int i, j;							\
+									\
+	memset(t, 0, sizeof(t));					\
+									\
+	FIXED_UNROLL							\
+	for (i = 0; i < n; i++) {					\
+		c = (fixedwide)a[0] * b[i] + t[0];			\
+		u = (fixedlimb)c * minv;				\
+		d = (fixedwide)u * m[0] + (fixedlimb)c;			\
+		c >>= FIXED_LIMBBITS;					\
+		d >>= FIXED_LIMBBITS;					\
+		FIXED_UNROLL						\
+		for (j = 1; j < n; j++) {				\
+			c += (fixedwide)a[j] * b[i] + t[j];		\
+			d += (fixedwide)u * m[j] + (fixedlimb)c;	\
+			t[j-1] = (fixedlimb)d;				\
+			c >>= FIXED_LIMBBITS;				\
+			d >>= FIXED_LIMBBITS;				\
+		}							\
+		c += t[n] + d;						\
+		t[n-1] = (fixedlimb)c;					\
+		t[n] = (fixedlimb)(c >> FIXED_LIMBBITS);		\
+	}								\
+									\
+	if (t[n] != 0 || fixed##N##_cmp(t, m) >= 0)			\
+		fixed##N##_sub(t, t, m);				\
+									\
+	memcpy(r, t, n * sizeof(t[0]));					\
+}									\
+									\
+static const struct fixedkernels fixed##N##_kernels = {			\
+	fixed##N##_neg,							\
+	fixed##N##_cmp							\
+};
+
+FIXED_KERNELS(256)
+FIXED_KERNELS(384)
+FIXED_KERNELS(512)
+
+/* Returns -1/m0 modulo 2^FIXED_LIMBBITS for odd m0. */
+static inline fixedlimb
+fixed_minv(fixedlimb m0)
+{
+	fixedlimb inv;
+	int i;
+
+	/* Each Newton step doubles a number of correct low bits. */
+	for (i = 0, inv = m0; i < 5; i++)
+		inv *= 2 - m0 * inv;
+
+	return 0 - inv;
+}
+
+struct fixedtype
+{
+	const char *tname;
+	int mt; /* Upvalue index of the metatable. */
+	int nlimbs;
+	const struct fixedkernels *k;
+};
+
+static const struct fixedtype fixedtypes[] = {
+	{ "bn.u256", lua_upvalueindex(3), FIXED_NLIMBS(256),
+	    &fixed256_kernels },
+	{ "bn.u384", lua_upvalueindex(4), FIXED_NLIMBS(384),
+	    &fixed384_kernels },
+	{ "bn.u512", lua_upvalueindex(5), FIXED_NLIMBS(512),
+	    &fixed512_kernels }
+};
+
+#define NFIXEDTYPES (sizeof(fixedtypes) / sizeof(fixedtypes[0]))
+
+static inline fixedlimb *
+testfixed(lua_State *L, int narg, const struct fixedtype *t)
+{
+	fixedlimb *rv;
+
+	rv = (fixedlimb *)lua_touserdata(L, narg);
+
+	if (rv != NULL) {
+		if (!lua_getmetatable(L, narg))
+			return NULL;
+		if (!lua_rawequal(L, -1, t->mt))
+			rv = NULL;
+		lua_pop(L, 1);
+	}
+
+	return rv;
+}
+
+/*
+ * Returns a type of a fixed-width object at index narg or NULL.
+ */
+static const struct fixedtype *
+fixedtypeof(lua_State *L, int narg)
+{
+	size_t i;
+
+	for (i = 0; i < NFIXEDTYPES; i++) {
+		if (testfixed(L, narg, &fixedtypes[i]) != NULL)
+			return &fixedtypes[i];
+	}
+
+	return NULL;
+}
+
+static int
+fixed_tobn(BIGNUM *bn, const fixedlimb *w, int n)
+{
+	unsigned char buf[sizeof(fixedlimb) * FIXED_MAXLIMBS];
+	unsigned char *p;
+	int i, j;
+
+	for (i = n - 1, p = buf; i >= 0; i--) {
+		for (j = FIXED_LIMBBITS - 8; j >= 0; j -= 8)
+			*p++ = (unsigned char)(w[i] >> j);
+	}
+
+	return BN_bin2bn(buf, n * sizeof(fixedlimb), bn) != NULL;
+}
+
+/* Stores bn modulo 2^N in w of type t. */
+static void
+fixed_frombn(fixedlimb *w, const struct fixedtype *t, const BIGNUM *bn)
+{
+	BN_ULONG d;
+	int i, j;
+
+	for (i = 0; i < t->nlimbs; i++) {
+		j = i * FIXED_LIMBBITS / BN_BITS2;
+		d = (j < bn->top) ? bn->d[j] : 0;
+		w[i] = (fixedlimb)(d >> (i * FIXED_LIMBBITS % BN_BITS2));
+	}
+
+	if (BN_is_negative(bn))
+		t->k->neg(w, w);
+}
+
+/*
+ * Same as luaBn_tobignum() but it's only safe to call
+ * from functions registered by luaBn_open().
+ */
+static BIGNUM *
+tobignum(lua_State *L, int narg)
+{
+	const struct fixedtype *t;
+	BIGNUM *rv;
+
+	switch (lua_type(L, narg)) {
+		case LUA_TNUMBER:
+			return numbertobignum(L, narg, BN_MT_UPVALUE);
+		case LUA_TSTRING:
+			return stringtobignum(L, narg, BN_MT_UPVALUE);
+		case LUA_TUSERDATA:
+			if ((rv = testbignum(L, narg)) != NULL)
+				return rv;
+			if ((t = fixedtypeof(L, narg)) != NULL) {
+				STATS_INC(L, fixed);
+				rv = newbignum(L);
+				if (!fixed_tobn(rv, getfixed(L, narg), t->nlimbs))
+					bnerror(L, "BN_bin2bn in tobignum");
+				lua_replace(L, narg);
+				return rv;
+			}
+			break;
+	}
+
+	typerror(L, narg, "number, string or " BN_METATABLE);
+	return NULL;
+}
+
+static int
+f_number(lua_State *L)
+{
+
+	tobignum(L, 1);
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+/*
+ * Fills a table of separator characters. White space characters
+ * are always separators.
+ */
+static void
+initseparators(bool sepset[/* UCHAR_MAX + 1 */], const char *sep, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i <= UCHAR_MAX; i++)
+		sepset[i] = false;
+
+	sepset[' '] = sepset['\t'] = sepset['\n'] = true;
+	sepset['\v'] = sepset['\f'] = sepset['\r'] = true;
+
+	for (i = 0; i < len; i++)
+		sepset[(unsigned char)sep[i]] = true;
+}
+
+/*
+ * Parses a number at offset pos of string s of length len and
+ * pushes it to stack. Returns an offset past the number. An offset
+ * in an error message is counted from base, an offset of s in a file.
+ */
+static size_t
+parseitem(lua_State *L, const char *s, size_t len, size_t pos,
+    size_t base, const bool sepset[/* UCHAR_MAX + 1 */],
+    const char *errmsg)
+{
+	BIGNUM *rv;
+	size_t end;
+	char offset[32];
+
+	rv = newbignum(L);
+	end = pos + parsebignum(rv, s + pos);
+
+	if (end == pos || (end < len && !sepset[(unsigned char)s[end]])) {
+		snprintf(offset, sizeof(offset), "%zu", base + pos + 1);
+		luaL_error(L, "%s: unable to parse " BN_METATABLE
+		    " at offset %s", errmsg, offset);
+	}
+
+	return end;
+}
+
+static int
+f_parse_all(lua_State *L)
+{
+	bool sepset[UCHAR_MAX + 1];
+	const char *s, *sep;
+	size_t len, seplen, pos;
+	int i;
+
+	s = luaL_checklstring(L, 1, &len);
+	sep = luaL_optlstring(L, 2, "", &seplen);
+
+	initseparators(sepset, sep, seplen);
+
+	lua_newtable(L);
+
+	for (i = 1, pos = 0; ; i++) {
+		while (pos < len && sepset[(unsigned char)s[pos]])
+			pos++;
+		if (pos == len)
+			break;
+
+		pos = parseitem(L, s, len, pos, 0, sepset, "bn.parse_all");
+		lua_rawseti(L, -2, i);
+	}
+
+	return 1;
+}
+
+/* Size of a block read by bn.lines() iterator. */
+#define LINES_BLOCKSIZE 65536
+
+/* Upvalues of bn.lines() iterator. */
+#define LINES_UPVALUE(i) lua_upvalueindex(NUPVALUES + (i))
+
+/*
+ * Reads next block from the file and stores it in a block upvalue.
+ * The block ends at the last separator read so far and the rest is
+ * kept for the next block to make sure that no number is split between
+ * two blocks. Only a number longer than a block extends a block,
+ * a file without newlines is still read one block at a time.
+ */
+static bool
+lines_read(lua_State *L, const bool sepset[/* UCHAR_MAX + 1 */])
+{
+	const char *s;
+	size_t len, end;
+
+	s = lua_tolstring(L, LINES_UPVALUE(2), &len);
+	lua_pushnumber(L, lua_tonumber(L, LINES_UPVALUE(6)) + len);
+	lua_replace(L, LINES_UPVALUE(6));
+
+	lua_pushvalue(L, LINES_UPVALUE(5));
+
+	for (;;) {
+		lua_getfield(L, LINES_UPVALUE(1), "read");
+		lua_pushvalue(L, LINES_UPVALUE(1));
+		lua_pushinteger(L, LINES_BLOCKSIZE);
+		lua_call(L, 2, 1);
+
+		if (!lua_isstring(L, -1)) {
+			lua_pop(L, 1);
+			s = lua_tolstring(L, -1, &len);
+			if (len == 0) {
+				lua_pop(L, 1);
+				return false;
+			}
+			lua_pushliteral(L, "");
+			break;
+		}
+
+		lua_concat(L, 2);
+		s = lua_tolstring(L, -1, &len);
+
+		for (end = len; end > 0; end--) {
+			if (sepset[(unsigned char)s[end - 1]])
+				break;
+		}
+
+		if (end > 0) {
+			lua_pushlstring(L, s, end);
+			lua_pushlstring(L, s + end, len - end);
+			lua_remove(L, -3);
+			break;
+		}
+	}
+
+	lua_replace(L, LINES_UPVALUE(5));
+	lua_replace(L, LINES_UPVALUE(2));
+	lua_pushinteger(L, 0);
+	lua_replace(L, LINES_UPVALUE(3));
+
+	return true;
+}
+
+/*
+ * Upvalues: file, current block, offset in the block, a table of
+ * separators, the rest of the last read after the block and an offset
+ * of the block in the file.
+ */
+static int
+lines_iter(lua_State *L)
+{
+	const bool *sepset;
+	const char *s;
+	size_t len, pos;
+
+	sepset = (const bool *)lua_touserdata(L, LINES_UPVALUE(4));
+
+	for (;;) {
+		s = lua_tolstring(L, LINES_UPVALUE(2), &len);
+		pos = (size_t)lua_tointeger(L, LINES_UPVALUE(3));
+
+		while (pos < len && sepset[(unsigned char)s[pos]])
+			pos++;
+		if (pos < len)
+			break;
+
+		if (!lines_read(L, sepset))
+			return 0;
+	}
+
+	pos = parseitem(L, s, len, pos,
+	    (size_t)lua_tonumber(L, LINES_UPVALUE(6)), sepset, "bn.lines");
+
+	lua_pushinteger(L, pos);
+	lua_replace(L, LINES_UPVALUE(3));
+
+	return 1;
+}
+
+static int
+f_lines(lua_State *L)
+{
+	bool *sepset;
+	const char *sep;
+	size_t seplen;
+	int i;
+
+	luaL_checkany(L, 1);
+	sep = luaL_optlstring(L, 2, "", &seplen);
+
+	/* The iterator shares all upvalues of bn functions. */
+	for (i = 1; i <= NUPVALUES; i++)
+		lua_pushvalue(L, lua_upvalueindex(i));
+	lua_pushvalue(L, 1);
+	lua_pushstring(L, "");
+	lua_pushinteger(L, 0);
+	sepset = (bool *)lua_newuserdata(L, (UCHAR_MAX + 1) * sizeof(bool));
+	initseparators(sepset, sep, seplen);
+	lua_pushliteral(L, "");
+	lua_pushnumber(L, 0);
+
+	lua_pushcclosure(L, lines_iter, NUPVALUES + 6);
+
+	return 1;
+}
+
+/*
+ * Converts bignum to a Lua integer (to an integral lua_Number prior
+ * to Lua 5.3). Returns nil if the value doesn't fit.
+ */
+static int
+f_tointeger(lua_State *L)
+{
+	BIGNUM *bn;
+	uintmax_t u;
+	bool fits;
+
+	bn = tobignum(L, 1);
+
+	if (!getumax(bn, &u)) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+#if LUA_VERSION_NUM >= 503
+	if (BN_is_negative(bn))
+		fits = (u - 1 <= (uintmax_t)LUA_MAXINTEGER);
+	else
+		fits = (u <= (uintmax_t)LUA_MAXINTEGER);
+
+	if (fits) {
+		lua_pushinteger(L, BN_is_negative(bn) ?
+		    (lua_Integer)(0u - u) : (lua_Integer)u);
+	}
+#else
+	/* Integers with more digits may not be represented exactly. */
+	fits = (BN_num_bits(bn) <= LUABN_NUMBER_DIGITS);
+
+	if (fits) {
+		lua_pushnumber(L, BN_is_negative(bn) ?
+		    -(lua_Number)u : (lua_Number)u);
+	}
+#endif
+
+	if (!fits)
+		lua_pushnil(L);
+
+	return 1;
+}
+
+static int
+f_tobin(lua_State *L)
+{
+	luaL_Buffer buf;
+	struct BN *bn;
+	unsigned char *res;
+	int nbytes;
+
+	luaL_buffinit(L, &buf);
+
+	bn = checkbn(L, 1);
+	nbytes = BN_num_bytes(&bn->bignum);
+
+	if (nbytes <= LUAL_BUFFERSIZE) {
+		res = (unsigned char *)luaL_prepbuffer(&buf);
+		nbytes = BN_bn2bin(&bn->bignum, res);
+		luaL_addsize(&buf, nbytes);
+	} else {
+		if (bn->str != NULL)
+			OPENSSL_free(bn->str);
+		bn->str = OPENSSL_malloc(nbytes);
+		if (bn->str == NULL)
+			return bnerror(L, "bn.tobin: no memory");
+		res = (unsigned char *)bn->str;
+		nbytes = BN_bn2bin(&bn->bignum, res);
+		luaL_addlstring(&buf, bn->str, nbytes);
+	}
+
+	luaL_pushresult(&buf);
+
+	if (bn->str != NULL)
+		OPENSSL_free(bn->str);
+	bn->str = NULL;
+
+	return 1;
+}
+
+static int
+m_tostring(lua_State *L)
+{
+	struct BN *bn;
+
+	bn = checkbn(L, 1);
+
+	if (bn->str != NULL)
+		OPENSSL_free(bn->str);
+	bn->str = BN_bn2dec(&bn->bignum);
+
+	lua_pushstring(L, bn->str);
+
+	OPENSSL_free(bn->str);
+	bn->str = NULL;
+
+	return 1;
+}
+
+/*
+ * If d isn't integral and its absolute value fits into a word, stores
+ * the integral part of the absolute value in w and returns true.
+ */
+static bool
+fracword(lua_Number d, BN_ULONG *w)
+{
+	lua_Number a;
+
+	a = (d < 0) ? -d : d;
+	if (!(a < (lua_Number)BN_MASK2 + 1))
+		return false;
+
+	*w = (BN_ULONG)a;
+	return (lua_Number)*w != a;
+}
+
+/* Result of h_cmp() if one of the operands is NaN. */
+#define CMP_UNORDERED INT_MIN
+
+/*
+ * If a value at narg is a Lua number or a string which fits into
+ * a word, compares bn with it and returns true. The value isn't
+ * converted to bn.number, the comparison is done on a sign and a word.
+ * A non-integral number is compared exactly: it lies between its
+ * integral part and the next integer. Infinities are greater than
+ * abs(bn) and NaN sets *res to CMP_UNORDERED.
+ */
+static bool
+cmpword(lua_State *L, int narg, const BIGNUM *bn, bool unsign, int *res)
+{
+	lua_Number d;
+	BN_ULONG n, w;
+	bool frac, isneg, nisneg;
+	int ntop;
+
+	frac = false;
+
+	switch (lua_type(L, narg)) {
+		case LUA_TNUMBER:
+			d = lua_tonumber(L, narg);
+			if (d != d) {
+				*res = CMP_UNORDERED;
+				return true;
+			}
+			if (d - d != 0) {
+				*res = (unsign || d > 0) ? -1 : 1;
+				return true;
+			}
+			n = absnumber(L, narg, &nisneg);
+			if (n == 0 && lua_tonumber(L, narg) != 0) {
+				frac = fracword(lua_tonumber(L, narg), &n);
+				if (!frac)
+					return false;
+			}
+			nisneg = nisneg && (n != 0 || frac);
+			break;
+		case LUA_TSTRING:
+			if (!parseword(lua_tostring(L, narg), &n, &nisneg))
+				return false;
+			break;
+		default:
+			return false;
+	}
+
+	/* Same result as BN_ucmp() which returns a difference of tops. */
+	ntop = (n != 0);
+	if (bn->top != ntop) {
+		*res = bn->top - ntop;
+	} else {
+		w = (ntop != 0) ? bn->d[0] : 0;
+		*res = (w > n) - (w < n);
+	}
+
+	/* abs(bn) == n is less than the absolute value of the number. */
+	if (frac && *res == 0)
+		*res = -1;
+
+	if (unsign)
+		return true;
+
+	*res = (*res > 0) - (*res < 0);
+	isneg = BN_is_negative(bn);
+	if (isneg != nisneg)
+		*res = isneg ? -1 : 1;
+	else if (isneg)
+		*res = -*res;
+
+	return true;
+}
+
+/*
+ * Compares values at index 1 and 2. A Lua number or a string
+ * is converted to bn.number only if it doesn't fit into a word.
+ * Returns CMP_UNORDERED if one of the values is NaN.
+ */
+static int
+h_cmp(lua_State *L, bool unsign)
+{
+	BIGNUM *a, *b;
+	int res;
+
+	a = testbignum(L, 1);
+	b = testbignum(L, 2);
+
+	if (a != NULL && b == NULL && cmpword(L, 2, a, unsign, &res))
+		return res;
+	if (a == NULL && b != NULL && cmpword(L, 1, b, unsign, &res))
+		return (res == CMP_UNORDERED) ? res : -res;
+
+	if (a == NULL)
+		a = tobignum(L, 1);
+	if (b == NULL)
+		b = tobignum(L, 2);
+
+	return unsign ? BN_ucmp(a, b) : BN_cmp(a, b);
+}
+
+/*
+ * Lua calls __eq only when both operands are userdata. In 5.3 and
+ * later, the other operand may have a different metatable.
+ */
+static int
+mt_eq(lua_State *L)
+{
+	BIGNUM *a, *b;
+
+	a = testbignum(L, 1);
+	b = testbignum(L, 2);
+
+	if (a != NULL && b == NULL && RATOPERAND(L)) {
+		lua_pushboolean(L, ratcompare(L) == 0);
+		return 1;
+	}
+
+	lua_pushboolean(L, a != NULL && b != NULL && BN_cmp(a, b) == 0);
+
+	return 1;
+}
+
+static int
+mt_lt(lua_State *L)
+{
+	int res;
+
+	if (RATOPERAND(L))
+		lua_pushboolean(L, ratcompare(L) < 0);
+	else
+		lua_pushboolean(L, (res = h_cmp(L, false)) < 0 &&
+		    res != CMP_UNORDERED);
+
+	return 1;
+}
+
+static int
+mt_le(lua_State *L)
+{
+	int res;
+
+	if (RATOPERAND(L))
+		lua_pushboolean(L, ratcompare(L) <= 0);
+	else
+		lua_pushboolean(L, (res = h_cmp(L, false)) <= 0 &&
+		    res != CMP_UNORDERED);
+
+	return 1;
+}
+
+static int
+mt_unm(lua_State *L)
+{
+	BIGNUM *o, *r;
+
+	assert(testbignum(L, 1) != NULL);
+	o = &getbn(L, 1)->bignum;
+	r = newbignum(L);
+
+	if (!BN_copy(r, o))
+		return bnerror(L, BN_METATABLE ".__unm");
+
+	negatebignum(r);
+
+	return 1;
+}
+
+/*
+ * Converts arguments 1 and 2 to BIGNUM objects and
+ * pushes one BIGNUM object.
+ * Use this function for a binary operation OP:
+ * bn[0] = bn[1] OP bn[2]
+ * when bn[0] can be the same object as bn[1] or bn[2].
+ */
+static int
+bn3(lua_State *L, BIGNUM *bn[/* 3 */])
+{
+	int narg;
+
+	if ((bn[2] = testbignum(L, 2)) == NULL) {
+		narg = 2;
+		bn[1] = tobignum(L, 1);
+	} else if ((bn[1] = testbignum(L, 1)) == NULL) {
+		narg = 1;
+	} else {
+		narg = 0;
+	}
+
+	if (narg == 0) {
+		bn[0] = newbignum(L);
+	} else {
+		bn[0] = bn[narg] = tobignum(L, narg);
+		lua_pushvalue(L, narg);
+	}
+
+	return narg;
+}
+
+/* Implementation of mt_add and mt_sub. */
+static inline int
+h_addsub(lua_State *L, int sign, const char *errmsg, bool ismt)
+{
+	BIGNUM *bn[3]; /* bn[0] = bn[1] +/- bn[2] */
+	BN_ULONG n;
+	int narg, status;
+	bool isneg;
+
+	if ((bn[2] = testbignum(L, 2)) == NULL) {
+		narg = 2;
+		if (ismt) {
+			assert(testbignum(L, 1) != NULL);
+			bn[1] = &getbn(L, 1)->bignum;
+		} else {
+			bn[1] = tobignum(L, 1);
+		}
+	} else if ((bn[1] = testbignum(L, 1)) == NULL) {
+		narg = 1;
+	} else {
+		narg = 0;
+	}
+
+	status = 0;
+
+	if (narg == 0) {
+		bn[0] = newbignum(L);
+		status = sign > 0 ? BN_add(bn[0], bn[1], bn[2])
+		                  : BN_sub(bn[0], bn[1], bn[2]);
+	} else {
+		n = absnumber(L, narg, &isneg);
+
+		if (n == 0) {
+			bn[0] = bn[narg] = tobignum(L, narg);
+			lua_pushvalue(L, narg);
+			status = sign > 0 ? BN_add(bn[0], bn[1], bn[2])
+			                  : BN_sub(bn[0], bn[1], bn[2]);
+		} else {
+			bn[0] = newbignum(L);
+			if (BN_copy(bn[0], bn[3-narg])) {
+				if ((sign > 0) != isneg)
+					status = BN_add_word(bn[0], n);
+				else
+					status = BN_sub_word(bn[0], n);
+				if (sign * narg == -1)
+					negatebignum(bn[0]);
+			}
+		}
+	}
+
+	if (status == 0)
+		return bnerror(L, errmsg);
+
+	return 1;
+}
+
+static int
+mt_add(lua_State *L)
+{
+
+	if (LAZYOPERANDS(L))
+		return lazyarith(L, LAZY_ADD);
+	if (RATOPERAND(L))
+		return ratarith(L, LAZY_ADD);
+
+	return h_addsub(L, 1, BN_METATABLE ".__add", true);
+}
+
+static int
+f_add(lua_State *L)
+{
+
+	return h_addsub(L, 1, "bn.add", false);
+}
+
+static int
+mt_sub(lua_State *L)
+{
+
+	if (LAZYOPERANDS(L))
+		return lazyarith(L, LAZY_SUB);
+	if (RATOPERAND(L))
+		return ratarith(L, LAZY_SUB);
+
+	return h_addsub(L, -1, BN_METATABLE ".__sub", true);
+}
+
+static int
+f_sub(lua_State *L)
+{
+
+	return h_addsub(L, -1, "bn.sub", false);
+}
+
+/*
+ * Multiplication engine. BN_mul tops out at Karatsuba, bigmul()
+ * switches to Toom-3 and then to NTT as operands grow. Thresholds
+ * are compared with a size of the smaller operand in limbs.
+ */
+
+/* Copies limbs [from, from + len) of |a| to r. */
+static int
+limbslice(BIGNUM *r, const BIGNUM *a, int from, int len)
+{
+
+	if (from + len > a->top)
+		len = a->top - from;
+	if (len <= 0) {
+		BN_zero(r);
+		return 1;
+	}
+
+	if (bn_wexpand(r, len) == NULL)
+		return 0;
+
+	memcpy(r->d, a->d + from, len * sizeof(BN_ULONG));
+	r->top = len;
+	r->neg = 0;
+	bn_correct_top(r);
+
+	return 1;
+}
+
+/* Stores a(1), a(-1) and a(-2) of a2*x^2 + a1*x + a0. */
+static int
+toom3_eval(BIGNUM *e1, BIGNUM *em1, BIGNUM *em2,
+    const BIGNUM *a0, const BIGNUM *a1, const BIGNUM *a2)
+{
+
+	return BN_add(e1, a0, a2) &&
+	    BN_sub(em1, e1, a1) &&
+	    BN_add(e1, e1, a1) &&
+	    BN_add(em2, em1, a2) &&
+	    BN_lshift1(em2, em2) &&
+	    BN_sub(em2, em2, a0);
+}
+
+/*
+ * Toom-3 multiplication of |a| and |b| with evaluation at 0, 1, -1,
+ * -2 and infinity and Bodrato's interpolation sequence. Smaller
+ * products are computed recursively with bigmul().
+ */
+static int
+toom3(BIGNUM *r, const BIGNUM *a, const BIGNUM *b,
+    const struct mulparams *mp, BN_CTX *ctx)
+{
+	BIGNUM *a0, *a1, *a2, *b0, *b1, *b2;
+	BIGNUM *ea[3], *eb[3], *w[5], *t;
+	bool sqr;
+	int i, k, status;
+
+	sqr = (a == b);
+	k = (a->top + 2) / 3;
+
+	BN_CTX_start(ctx);
+
+	a0 = BN_CTX_get(ctx);
+	a1 = BN_CTX_get(ctx);
+	a2 = BN_CTX_get(ctx);
+	b0 = BN_CTX_get(ctx);
+	b1 = BN_CTX_get(ctx);
+	b2 = BN_CTX_get(ctx);
+	for (i = 0; i < 3; i++) {
+		ea[i] = BN_CTX_get(ctx);
+		eb[i] = BN_CTX_get(ctx);
+	}
+	for (i = 0; i < 5; i++)
+		w[i] = BN_CTX_get(ctx);
+	t = BN_CTX_get(ctx);
+
+	status = (t != NULL) &&
+	    limbslice(a0, a, 0, k) &&
+	    limbslice(a1, a, k, k) &&
+	    limbslice(a2, a, 2 * k, k) &&
+	    toom3_eval(ea[0], ea[1], ea[2], a0, a1, a2);
+
+	if (status && !sqr) {
+		status = limbslice(b0, b, 0, k) &&
+		    limbslice(b1, b, k, k) &&
+		    limbslice(b2, b, 2 * k, k) &&
+		    toom3_eval(eb[0], eb[1], eb[2], b0, b1, b2);
+	}
+
+	if (sqr) {
+		b0 = a0;
+		b2 = a2;
+		for (i = 0; i < 3; i++)
+			eb[i] = ea[i];
+	}
+
+	/* w[] = r(0), r(1), r(-1), r(-2), r(inf) */
+	status = status &&
+	    bigmul(w[0], a0, b0, mp, ctx) &&
+	    bigmul(w[1], ea[0], eb[0], mp, ctx) &&
+	    bigmul(w[2], ea[1], eb[1], mp, ctx) &&
+	    bigmul(w[3], ea[2], eb[2], mp, ctx) &&
+	    bigmul(w[4], a2, b2, mp, ctx);
+
+	/* Interpolation, all divisions are exact. */
+	status = status &&
+	    BN_sub(w[3], w[3], w[1]) &&
+	    BN_div_word(w[3], 3) != (BN_ULONG)-1 &&
+	    BN_sub(w[1], w[1], w[2]) &&
+	    BN_rshift1(w[1], w[1]) &&
+	    BN_sub(w[2], w[2], w[0]) &&
+	    BN_sub(w[3], w[2], w[3]) &&
+	    BN_rshift1(w[3], w[3]) &&
+	    BN_lshift1(t, w[4]) &&
+	    BN_add(w[3], w[3], t) &&
+	    BN_add(w[2], w[2], w[1]) &&
+	    BN_sub(w[2], w[2], w[4]) &&
+	    BN_sub(w[1], w[1], w[3]);
+
+	/* Now w[i] is a coefficient of x^i. */
+	status = status && BN_copy(r, w[0]);
+	for (i = 1; status && i < 5; i++) {
+		status = BN_lshift(t, w[i], i * k * BN_BITS2) &&
+		    BN_add(r, r, t);
+	}
+
+	BN_CTX_end(ctx);
+
+	return status;
+}
+
+/*
+ * Multiplies |a| by |b| when a has at least twice as many limbs
+ * as b. Chunks of a with b's length are multiplied separately.
+ */
+static int
+unbalancedmul(BIGNUM *r, const BIGNUM *a, const BIGNUM *b,
+    const struct mulparams *mp, BN_CTX *ctx)
+{
+	BIGNUM *acc, *chunk, *t;
+	int i, status;
+
+	BN_CTX_start(ctx);
+
+	acc = BN_CTX_get(ctx);
+	chunk = BN_CTX_get(ctx);
+	t = BN_CTX_get(ctx);
+
+	status = (t != NULL);
+	if (status)
+		BN_zero(acc);
+
+	for (i = 0; status && i < a->top; i += b->top) {
+		status = limbslice(chunk, a, i, b->top) &&
+		    bigmul(t, chunk, b, mp, ctx) &&
+		    BN_lshift(t, t, i * BN_BITS2) &&
+		    BN_add(acc, acc, t);
+	}
+
+	status = status && BN_copy(r, acc);
+
+	BN_CTX_end(ctx);
+
+	return status;
+}
+
+/*
+ * Primes of NTT with 2^23 dividing p - 1. Multiplications modulo p
+ * are done in Montgomery form with R = 2^32.
+ */
+struct ntt_prime
+{
+	uint32_t p;
+	uint32_t g;    /* Primitive root. */
+	uint32_t pinv; /* -1/p modulo R */
+	uint32_t r2;   /* R^2 modulo p */
+};
+
+static const struct ntt_prime ntt_primes[2] = {
+	{ 998244353, 3, 0x3b7fffff, 932051910 },  /* 119 * 2^23 + 1 */
+	{ 754974721, 11, 0x2cffffff, 749009521 }  /* 45 * 2^24 + 1 */
+};
+
+/* 1 / ntt_primes[0].p modulo ntt_primes[1].p */
+#define NTT_P0INV 416537774u
+
+#define NTT_LOG2MAX 23
+#define NTT_DIGIT_BITS 16
+
+/* Returns a * b / R modulo p for a, b < p. */
+static inline uint32_t
+ntt_mul(uint32_t a, uint32_t b, const struct ntt_prime *pr)
+{
+	uint64_t t;
+	uint32_t m;
+
+	t = (uint64_t)a * b;
+	m = (uint32_t)t * pr->pinv;
+	t = (t + (uint64_t)m * pr->p) >> 32;
+
+	return (uint32_t)((t >= pr->p) ? t - pr->p : t);
+}
+
+static uint32_t
+ntt_pow(uint32_t b, uint32_t e, uint32_t p)
+{
+	uint64_t r, x;
+
+	for (r = 1, x = b; e != 0; e >>= 1, x = x * x % p) {
+		if (e & 1)
+			r = r * x % p;
+	}
+
+	return (uint32_t)r;
+}
+
+/*
+ * In-place number theoretic transform of length n (power of 2)
+ * modulo pr->p. The inverse transform isn't scaled by 1/n.
+ * w is a scratch array of n/2 elements.
+ */
+static void
+ntt(uint32_t *x, uint32_t *w, size_t n, const struct ntt_prime *pr,
+    bool inverse)
+{
+	uint32_t p, u, v, root;
+	size_t i, j, m, len;
+
+	p = pr->p;
+
+	for (i = 1, j = 0; i < n; i++) {
+		for (m = n >> 1; j & m; m >>= 1)
+			j ^= m;
+		j ^= m;
+		if (i < j) {
+			u = x[i];
+			x[i] = x[j];
+			x[j] = u;
+		}
+	}
+
+	for (len = 2; len <= n; len <<= 1) {
+		root = ntt_pow(pr->g, (p - 1) / len, p);
+		if (inverse)
+			root = ntt_pow(root, p - 2, p);
+
+		/* Twiddle factors in Montgomery form. */
+		root = ntt_mul(root, pr->r2, pr);
+		w[0] = ntt_mul(1, pr->r2, pr);
+		for (j = 1; j < len / 2; j++)
+			w[j] = ntt_mul(w[j-1], root, pr);
+
+		for (i = 0; i < n; i += len) {
+			for (j = 0; j < len / 2; j++) {
+				u = x[i+j];
+				v = ntt_mul(x[i+j+len/2], w[j], pr);
+				x[i+j] = (u + v >= p) ? u + v - p : u + v;
+				x[i+j+len/2] = (u >= v) ? u - v : u + p - v;
+			}
+		}
+	}
+}
+
+/* Splits |a| into n NTT_DIGIT_BITS-bit digits. */
+static void
+ntt_digits(uint32_t *x, size_t n, const BIGNUM *a)
+{
+	size_t i, per;
+
+	per = BN_BITS2 / NTT_DIGIT_BITS;
+
+	for (i = 0; i < n; i++) {
+		x[i] = (i / per < (size_t)a->top) ?
+		    (uint32_t)(a->d[i/per] >>
+		    (i % per * NTT_DIGIT_BITS)) & 0xffff : 0;
+	}
+}
+
+/*
+ * Multiplies |a| by |b| with two NTTs modulo primes from ntt_primes
+ * followed by CRT. Returns -1 if operands are too long.
+ */
+static int
+nttmul(BIGNUM *r, const BIGNUM *a, const BIGNUM *b)
+{
+	const struct ntt_prime *pr;
+	uint32_t *buf, *x[2], *y[2], *w;
+	uint32_t scale;
+	uint64_t c, carry, x0, x1;
+	size_t i, n, na, nb, per, words;
+	bool sqr;
+	int k;
+
+	sqr = (a == b);
+	per = BN_BITS2 / NTT_DIGIT_BITS;
+	na = (size_t)a->top * per;
+	nb = (size_t)b->top * per;
+
+	for (n = 1; n < na + nb; n <<= 1) {
+		if (n >= ((size_t)1 << NTT_LOG2MAX))
+			return -1;
+	}
+
+	buf = OPENSSL_malloc((sqr ? 2 : 4) * n * sizeof(uint32_t) +
+	    n / 2 * sizeof(uint32_t));
+	if (buf == NULL)
+		return 0;
+
+	x[0] = buf;
+	x[1] = buf + n;
+	y[0] = sqr ? x[0] : buf + 2 * n;
+	y[1] = sqr ? x[1] : buf + 3 * n;
+	w = buf + (sqr ? 2 : 4) * n;
+
+	for (k = 0; k < 2; k++) {
+		pr = &ntt_primes[k];
+
+		ntt_digits(x[k], n, a);
+		ntt(x[k], w, n, pr, false);
+		if (!sqr) {
+			ntt_digits(y[k], n, b);
+			ntt(y[k], w, n, pr, false);
+		}
+
+		/* Pointwise products are divided by R, scale is R/n. */
+		for (i = 0; i < n; i++)
+			x[k][i] = ntt_mul(x[k][i], y[k][i], pr);
+		ntt(x[k], w, n, pr, true);
+
+		scale = ntt_pow((uint32_t)n, pr->p - 2, pr->p);
+		scale = ntt_mul(ntt_mul(scale, pr->r2, pr), pr->r2, pr);
+		for (i = 0; i < n; i++)
+			x[k][i] = ntt_mul(x[k][i], scale, pr);
+	}
+
+	words = (na + nb + per - 1) / per + 1;
+	if (bn_wexpand(r, (int)words) == NULL) {
+		OPENSSL_free(buf);
+		return 0;
+	}
+
+	memset(r->d, 0, words * sizeof(BN_ULONG));
+
+	/* CRT: c = x0 + p0 * ((x1 - x0) / p0 modulo p1). */
+	for (i = 0, carry = 0; i < n; i++) {
+		x0 = x[0][i];
+		x1 = (x[1][i] + ntt_primes[1].p - x0 % ntt_primes[1].p) %
+		    ntt_primes[1].p * NTT_P0INV % ntt_primes[1].p;
+		c = x0 + ntt_primes[0].p * x1 + carry;
+		carry = c >> NTT_DIGIT_BITS;
+		if (i / per < words) {
+			r->d[i/per] |= (BN_ULONG)(c & 0xffff) <<
+			    (i % per * NTT_DIGIT_BITS);
+		}
+	}
+
+	OPENSSL_free(buf);
+
+	r->top = (int)words;
+	r->neg = 0;
+	bn_correct_top(r);
+
+	return 1;
+}
+
+/*
+ * Same as BN_mul but it uses Toom-3 and NTT for large operands.
+ * r may be the same as a or b.
+ */
+static int
+bigmul(BIGNUM *r, const BIGNUM *a, const BIGNUM *b,
+    const struct mulparams *mp, BN_CTX *ctx)
+{
+	const BIGNUM *t;
+	int neg, status;
+
+	if (a->top < b->top) {
+		t = a;
+		a = b;
+		b = t;
+	}
+
+	if (b->top < mp->toom3)
+		return (a == b) ? BN_sqr(r, a, ctx) : BN_mul(r, a, b, ctx);
+
+	neg = BN_is_negative(a) != BN_is_negative(b);
+
+	if (b->top >= mp->ntt && (status = nttmul(r, a, b)) >= 0)
+		;
+	else if (b->top * 2 <= a->top)
+		status = unbalancedmul(r, a, b, mp, ctx);
+	else
+		status = toom3(r, a, b, mp, ctx);
+
+	if (status)
+		BN_set_negative(r, neg);
+
+	return status;
+}
+
+/* Guard bits of approximate reciprocals, see recip(). */
+#define RECIP_GUARD 32
+
+/* Precision in bits below which recip() uses BN_div. */
+#define RECIP_BASEBITS 8192
+
+/*
+ * Approximates floor(2^(n + s) / m), n = BN_num_bits(m), by Newton's
+ * iteration with precision doubling. Only leading s + RECIP_GUARD bits
+ * of m are used. The error is a few units.
+ */
+static int
+recip(BIGNUM *y, const BIGNUM *m, int s, const struct mulparams *mp,
+    BN_CTX *ctx)
+{
+	BIGNUM *mt, *z, *t;
+	int d, nt, s2, status;
+
+	d = BN_num_bits(m) - (s + RECIP_GUARD);
+	if (d < 0)
+		d = 0;
+
+	BN_CTX_start(ctx);
+
+	mt = BN_CTX_get(ctx);
+	z = BN_CTX_get(ctx);
+	t = BN_CTX_get(ctx);
+
+	status = (t != NULL) && BN_rshift(mt, m, d);
+	nt = BN_num_bits(mt);
+
+	if (status && s <= RECIP_BASEBITS) {
+		BN_zero(t);
+		status = BN_set_bit(t, nt + s) &&
+		    BN_div(y, NULL, t, mt, ctx);
+	} else if (status) {
+		/* y = z * 2^(s - s2 + 1) - mt * z^2 / 2^(nt + 2 * s2 - s) */
+		s2 = s / 2 + RECIP_GUARD;
+		status = recip(z, mt, s2, mp, ctx) &&
+		    bigmul(t, z, z, mp, ctx) &&
+		    bigmul(t, t, mt, mp, ctx) &&
+		    BN_rshift(t, t, nt + 2 * s2 - s) &&
+		    BN_lshift(y, z, s - s2 + 1) &&
+		    BN_sub(y, y, t);
+	}
+
+	BN_CTX_end(ctx);
+
+	return status;
+}
+
+/*
+ * Same as BN_mod for nonnegative a and positive m but it uses Barrett
+ * reduction with a reciprocal from recip() for huge operands, so
+ * the cost is a few multiplications by bigmul().
+ */
+static int
+bigmod(BIGNUM *r, const BIGNUM *a, const BIGNUM *m,
+    const struct mulparams *mp, BN_CTX *ctx)
+{
+	BIGNUM *y, *q, *t;
+	int i, n, s, status;
+
+	n = BN_num_bits(m);
+	s = BN_num_bits(a) - n + 1;
+
+	/* Barrett reduction pays off only with NTT multiplication. */
+	if (m->top < mp->ntt / 2 || s < n / 2)
+		return BN_mod(r, a, m, ctx);
+
+	BN_CTX_start(ctx);
+
+	y = BN_CTX_get(ctx);
+	q = BN_CTX_get(ctx);
+	t = BN_CTX_get(ctx);
+
+	/* q = floor(a / 2^(n - 1)) * y / 2^(s + 1) */
+	status = (t != NULL) &&
+	    recip(y, m, s, mp, ctx) &&
+	    BN_rshift(q, a, n - 1) &&
+	    bigmul(q, q, y, mp, ctx) &&
+	    BN_rshift(q, q, s + 1) &&
+	    bigmul(t, q, m, mp, ctx) &&
+	    BN_sub(t, a, t);
+
+	/* The quotient is off by a few units. */
+	for (i = 0; status && i < 4 && BN_is_negative(t); i++)
+		status = BN_add(t, t, m);
+	for (i = 0; status && i < 4 && BN_ucmp(t, m) >= 0; i++)
+		status = BN_sub(t, t, m);
+
+	if (status && (BN_is_negative(t) || BN_ucmp(t, m) >= 0))
+		status = BN_nnmod(t, t, m, ctx);
+
+	status = status && BN_copy(r, t);
+
+	BN_CTX_end(ctx);
+
+	return status;
+}
+
+/*
+ * Converts integer argument at narg to int. It's used for bit indices
+ * and shift counts.
+ */
+static int
+checkint(lua_State *L, int narg)
+{
+	lua_Integer n;
+
+	n = luaL_checkinteger(L, narg);
+	luaL_argcheck(L, n >= -INT_MAX && n <= INT_MAX, narg, "out of range");
+
+	return (int)n;
+}
+
+/* Converts a threshold in bits at narg to limbs. */
+static int
+checkthreshold(lua_State *L, int narg, int minlimbs)
+{
+	int bits, limbs;
+
+	bits = checkint(L, narg);
+	luaL_argcheck(L, bits >= 0, narg, "out of range");
+
+	limbs = bits / BN_BITS2 + (bits % BN_BITS2 != 0);
+
+	return (limbs > minlimbs) ? limbs : minlimbs;
+}
+
+/*
+ * Returns current thresholds of Toom-3 and NTT multiplication in bits
+ * and optionally sets new values.
+ */
+static int
+f_multhresholds(lua_State *L)
+{
+	struct mulparams *mp;
+
+	mp = get_mulparams(L);
+
+	lua_pushinteger(L, (lua_Integer)mp->toom3 * BN_BITS2);
+	lua_pushinteger(L, (lua_Integer)mp->ntt * BN_BITS2);
+
+	if (!lua_isnoneornil(L, 1))
+		mp->toom3 = checkthreshold(L, 1, TOOM3_MINLIMBS);
+	if (!lua_isnoneornil(L, 2))
+		mp->ntt = checkthreshold(L, 2, 1);
+
+	return 2;
+}
+
+static int
+h_mul(lua_State *L, const char *errmsg, bool ismt)
+{
+	BIGNUM *bn[3]; /* bn[0] = bn[1] * bn[2] */
+	BN_CTX *ctx;
+	BN_ULONG n;
+	int narg, status;
+	bool isneg;
+
+	if ((bn[1] = testbignum(L, 1)) == NULL) {
+		narg = 1;
+		if (ismt) {
+			assert(testbignum(L, 2) != NULL);
+			bn[2] = &getbn(L, 2)->bignum;
+		} else {
+			bn[2] = tobignum(L, 2);
+		}
+	} else if ((bn[2] = testbignum(L, 2)) == NULL) {
+		narg = 2;
+	} else {
+		narg = 0;
+	}
+
+	status = 0;
+
+	if (narg == 0) {
+		bn[0] = newbignum(L);
+		ctx = get_ctx_val(L);
+		status = bigmul(bn[0], bn[1], bn[2], get_mulparams(L), ctx);
+	} else {
+		n = absnumber(L, narg, &isneg);
+
+		if (n == 0) {
+			bn[0] = bn[narg] = tobignum(L, narg);
+			lua_pushvalue(L, narg);
+			ctx = get_ctx_val(L);
+			status = bigmul(bn[0], bn[1], bn[2],
+			    get_mulparams(L), ctx);
+		} else {
+			bn[0] = newbignum(L);
+			if (BN_copy(bn[0], bn[3-narg])) {
+				if (isneg)
+					negatebignum(bn[0]);
+				status = BN_mul_word(bn[0], n);
+			}
+		}
+	}
+
+	if (status == 0)
+		return bnerror(L, errmsg);
+
+	return 1;
+}
+
+static int
+mt_mul(lua_State *L)
+{
+
+	if (LAZYOPERANDS(L))
+		return lazyarith(L, LAZY_MUL);
+	if (RATOPERAND(L))
+		return ratarith(L, LAZY_MUL);
+	if (POINTOPERAND(L))
+		return pointmul(L);
+
+	return h_mul(L, BN_METATABLE ".__mul", true);
+}
+
+static int
+f_mul(lua_State *L)
+{
+
+	return h_mul(L, "bn.mul", false);
+}
+
+static int
+h_div(lua_State *L, const char *errmsg, bool ismt)
+{
+	BIGNUM *bn[3]; /* bn[0] = bn[1] / bn[2] */
+	BN_CTX *ctx;
+	BN_ULONG n, rem;
+	int status;
+	bool isneg;
+
+	/*
+	 * Unlike many other operations (e.g. BN_add or BN_mul),
+	 * documentation for BN_div doesn't specify that the result
+	 * may be the same variable as one of the operands.
+	 * Thus, always allocate a new BIGNUM object for the result.
+	 */
+	bn[0] = newbignum(L);
+
+	n = 0;
+	status = 0;
+
+	if ((bn[2] = testbignum(L, 2)) != NULL) {
+		bn[1] = tobignum(L, 1);
+	} else {
+		if (ismt) {
+			assert(testbignum(L, 1) != NULL);
+			bn[1] = &getbn(L, 1)->bignum;
+		} else {
+			bn[1] = tobignum(L, 1);
+		}
+
+		n = absnumber(L, 2, &isneg);
+
+		if (n == 0) {
+			bn[2] = tobignum(L, 2);
+		} else if (BN_copy(bn[0], bn[1])) {
+			if (isneg)
+				negatebignum(bn[0]);
+			rem = BN_div_word(bn[0], n);
+			/*
+			 * Code inspection shows that BN_div_word() doesn't
+			 * set error only when n == 0. Therefore, bnerror()
+			 * call is valid if BN_div_word() fails.
+			 */
+			status = (rem != (BN_ULONG)-1);
+		}
+	}
+
+	if (n == 0) {
+		ctx = get_ctx_val(L);
+		status = BN_div(bn[0], NULL, bn[1], bn[2], ctx);
+	}
+
+	if (status == 0)
+		return bnerror(L, errmsg);
+
+	return 1;
+}
+
+static int
+mt_div(lua_State *L)
+{
+
+	if (LAZYOPERANDS(L))
+		return lazyarith(L, LAZY_DIV);
+	if (RATOPERAND(L))
+		return ratarith(L, LAZY_DIV);
+
+	return h_div(L, BN_METATABLE ".__div", true);
+}
+
+static int
+f_div(lua_State *L)
+{
+
+	return h_div(L, "bn.div", false);
+}
+
+static int
+mt_mod(lua_State *L)
+{
+	BIGNUM *bn[3]; /* bn[0] = bn[1] % bn[2] */
+	BN_CTX *ctx;
+	BN_ULONG n, rem;
+	int status;
+	bool isneg;
+
+	if (LAZYOPERANDS(L))
+		return lazyarith(L, LAZY_MOD);
+	if (RATOPERAND(L))
+		return ratarith(L, LAZY_MOD);
+
+	/*
+	 * Unlike many other operations (e.g. BN_add or BN_mul),
+	 * documentation for BN_div doesn't specify that the result
+	 * may be the same variable as one of the operands.
+	 * Thus, always allocate a new BIGNUM object for the result.
+	 */
+	bn[0] = newbignum(L);
+
+	n = 0;
+	status = 0;
+
+	if ((bn[2] = testbignum(L, 2)) != NULL) {
+		bn[1] = tobignum(L, 1);
+	} else {
+		assert(testbignum(L, 1) != NULL);
+		bn[1] = &getbn(L, 1)->bignum;
+
+		n = absnumber(L, 2, &isneg);
+
+		if (n == 0) {
+			bn[2] = tobignum(L, 2);
+		} else {
+			rem = BN_mod_word(bn[1], n);
+			/*
+			 * Code inspection shows that BN_mod_word() never
+			 * fails for n != 0.
+			 */
+			assert(rem < n);
+			status = BN_set_word(bn[0], rem);
+			if (status != 0)
+				BN_set_negative(bn[0], BN_is_negative(bn[1]));
+		}
+	}
+
+	if (n == 0) {
+		ctx = get_ctx_val(L);
+		status = BN_div(NULL, bn[0], bn[1], bn[2], ctx);
+	}
+
+	if (status == 0)
+		return bnerror(L, BN_METATABLE ".__mod");
+
+	return 1;
+}
+
+/* Raises an error if h_cmp() result res is CMP_UNORDERED. */
+static int
+checkordered(lua_State *L, int res)
+{
+
+	if (res == CMP_UNORDERED)
+		luaL_argerror(L, lua_type(L, 1) == LUA_TNUMBER ? 1 : 2,
+		    "NaN can't be compared");
+
+	return res;
+}
+
+static int
+f_cmp(lua_State *L)
+{
+
+	lua_pushinteger(L, checkordered(L, h_cmp(L, false)));
+
+	return 1;
+}
+
+static int
+f_ucmp(lua_State *L)
+{
+
+	lua_pushinteger(L, checkordered(L, h_cmp(L, true)));
+
+	return 1;
+}
+
+static int
+f_gcd(lua_State *L)
+{
+	BIGNUM *bn[3]; /* bn[0] = gcd(bn[1], bn[2]) */
+	BN_CTX *ctx;
+
+	bn3(L, bn);
+
+	ctx = get_ctx_val(L);
+
+	if (!BN_gcd(bn[0], bn[1], bn[2], ctx))
+		return bnerror(L, "bn.gcd");
+
+	return 1;
+}
+
+/* Bits of leading parts of numbers in Lehmer's algorithm. */
+#define LEHMER_BITS (BN_BITS2 < 60 ? BN_BITS2 : 60)
+
+/* r = cx * x + cy * y, t is a temporary. */
+static int
+lincomb(BIGNUM *r, int64_t cx, const BIGNUM *x, int64_t cy,
+    const BIGNUM *y, BIGNUM *t)
+{
+
+	if (!BN_copy(r, x) || !BN_mul_word(r, cx < 0 ? -cx : cx))
+		return 0;
+	if (cx < 0)
+		BN_set_negative(r, !BN_is_negative(r));
+
+	if (!BN_copy(t, y) || !BN_mul_word(t, cy < 0 ? -cy : cy))
+		return 0;
+	if (cy < 0)
+		BN_set_negative(t, !BN_is_negative(t));
+
+	return BN_add(r, r, t);
+}
+
+/*
+ * Computes single precision Lehmer matrix (ca cb; cc cd) from leading
+ * bits of A >= B with conditions from Knuth's Algorithm L. Returns
+ * false if no step can be made.
+ */
+static bool
+lehmer(const BIGNUM *A, const BIGNUM *B, int64_t m[4], BIGNUM *t)
+{
+	int64_t ah, bh, q, tmp;
+	int k;
+
+	k = BN_num_bits(A) - LEHMER_BITS;
+	if (!BN_rshift(t, A, k))
+		return false;
+	ah = BN_get_word(t);
+	if (!BN_rshift(t, B, k))
+		return false;
+	bh = BN_get_word(t);
+
+	m[0] = m[3] = 1;
+	m[1] = m[2] = 0;
+
+	for (;;) {
+		if (bh + m[2] <= 0 || bh + m[3] <= 0 ||
+		    ah + m[0] < 0 || ah + m[1] < 0)
+			break;
+
+		q = (ah + m[0]) / (bh + m[2]);
+		if (q != (ah + m[1]) / (bh + m[3]))
+			break;
+
+		tmp = m[0] - q * m[2];
+		m[0] = m[2];
+		m[2] = tmp;
+
+		tmp = m[1] - q * m[3];
+		m[1] = m[3];
+		m[3] = tmp;
+
+		tmp = ah - q * bh;
+		ah = bh;
+		bh = tmp;
+	}
+
+	return m[1] != 0;
+}
+
+/*
+ * Extended Euclid's algorithm with Lehmer's single precision steps:
+ * g = gcd(a, b) = a * x + b * y. Only the cofactor of a is tracked,
+ * y is recovered by an exact division at the end.
+ */
+static int
+gcdext(BIGNUM *g, BIGNUM *x, BIGNUM *y, const BIGNUM *a, const BIGNUM *b,
+    BN_CTX *ctx)
+{
+	BIGNUM *A, *B, *u0, *u1, *q, *r, *t;
+	int64_t m[4];
+	int status;
+
+	BN_CTX_start(ctx);
+
+	A = BN_CTX_get(ctx);
+	B = BN_CTX_get(ctx);
+	u0 = BN_CTX_get(ctx);
+	u1 = BN_CTX_get(ctx);
+	q = BN_CTX_get(ctx);
+	r = BN_CTX_get(ctx);
+	t = BN_CTX_get(ctx);
+
+	status = (t != NULL) &&
+	    BN_copy(A, a) &&
+	    BN_copy(B, b) &&
+	    BN_one(u0);
+	BN_zero(u1);
+
+	if (status) {
+		BN_set_negative(A, 0);
+		BN_set_negative(B, 0);
+	}
+
+	while (status && !BN_is_zero(B)) {
+		if (BN_num_bits(B) > LEHMER_BITS && BN_ucmp(A, B) >= 0 &&
+		    lehmer(A, B, m, t)) {
+			status = lincomb(q, m[0], A, m[1], B, t) &&
+			    lincomb(r, m[2], A, m[3], B, t);
+			BN_swap(A, q);
+			BN_swap(B, r);
+
+			status = status &&
+			    lincomb(q, m[0], u0, m[1], u1, t) &&
+			    lincomb(r, m[2], u0, m[3], u1, t);
+			BN_swap(u0, q);
+			BN_swap(u1, r);
+		} else {
+			status = BN_div(q, r, A, B, ctx);
+			BN_swap(A, B);
+			BN_swap(B, r);
+
+			status = status &&
+			    BN_mul(t, q, u1, ctx) &&
+			    BN_sub(t, u0, t);
+			BN_swap(u0, u1);
+			BN_swap(u1, t);
+		}
+	}
+
+	status = status && BN_copy(x, u0);
+	if (status && BN_is_negative(a))
+		BN_set_negative(x, !BN_is_negative(x));
+
+	if (status && BN_is_zero(b)) {
+		BN_zero(y);
+	} else if (status) {
+		/* y = (g - a * x) / b */
+		status = BN_mul(t, a, x, ctx) &&
+		    BN_sub(t, A, t) &&
+		    BN_div(y, NULL, t, b, ctx);
+	}
+
+	status = status && BN_copy(g, A);
+
+	BN_CTX_end(ctx);
+
+	return status;
+}
+
+/*
+ * Same as gcdext() without cofactors. It's faster than BN_gcd()
+ * unless both numbers are shorter than LEHMER_GCD_MIN bits.
+ */
+#define LEHMER_GCD_MIN 512
+
+static int
+lehmergcd(BIGNUM *g, const BIGNUM *a, const BIGNUM *b, BN_CTX *ctx)
+{
+	BIGNUM *A, *B, *q, *r, *t;
+	int64_t m[4];
+	int status;
+
+	if (BN_num_bits(a) < LEHMER_GCD_MIN && BN_num_bits(b) < LEHMER_GCD_MIN)
+		return BN_gcd(g, a, b, ctx);
+
+	BN_CTX_start(ctx);
+
+	A = BN_CTX_get(ctx);
+	B = BN_CTX_get(ctx);
+	q = BN_CTX_get(ctx);
+	r = BN_CTX_get(ctx);
+	t = BN_CTX_get(ctx);
+
+	status = (t != NULL) &&
+	    BN_copy(A, a) &&
+	    BN_copy(B, b);
+
+	if (status) {
+		BN_set_negative(A, 0);
+		BN_set_negative(B, 0);
+	}
+
+	while (status && !BN_is_zero(B)) {
+		if (BN_num_bits(B) > LEHMER_BITS && BN_ucmp(A, B) >= 0 &&
+		    lehmer(A, B, m, t)) {
+			status = lincomb(q, m[0], A, m[1], B, t) &&
+			    lincomb(r, m[2], A, m[3], B, t);
+			BN_swap(A, q);
+			BN_swap(B, r);
+		} else {
+			status = BN_div(NULL, r, A, B, ctx);
+			BN_swap(A, B);
+			BN_swap(B, r);
+		}
+	}
+
+	status = status && BN_copy(g, A);
+
+	BN_CTX_end(ctx);
+
+	return status;
+}
+
+static int
+f_gcdext(lua_State *L)
+{
+	BIGNUM *a, *b, *g, *x, *y;
+
+	a = tobignum(L, 1);
+	b = tobignum(L, 2);
+	g = newbignum(L);
+	x = newbignum(L);
+	y = newbignum(L);
+
+	if (!gcdext(g, x, y, a, b, get_ctx_val(L)))
+		return bnerror(L, "bn.gcdext");
+
+	return 3;
+}
+
+static int
+f_lcm(lua_State *L)
+{
+	BIGNUM *a, *b, *g, *r;
+	BN_CTX *ctx;
+	int status;
+
+	a = tobignum(L, 1);
+	b = tobignum(L, 2);
+	r = newbignum(L);
+
+	if (BN_is_zero(a) || BN_is_zero(b))
+		return 1;
+
+	ctx = get_ctx_val(L);
+
+	BN_CTX_start(ctx);
+
+	/* lcm = |a| / gcd(a, b) * |b| */
+	status = (g = BN_CTX_get(ctx)) != NULL &&
+	    BN_gcd(g, a, b, ctx) &&
+	    BN_div(r, NULL, a, g, ctx) &&
+	    bigmul(r, r, b, get_mulparams(L), ctx);
+	BN_set_negative(r, 0);
+
+	BN_CTX_end(ctx);
+
+	if (status == 0)
+		return bnerror(L, "bn.lcm");
+
+	return 1;
+}
+
+static int
+f_modinv(lua_State *L)
+{
+	BIGNUM *a, *n, *r;
+	unsigned long err;
+
+	a = tobignum(L, 1);
+	n = tobignum(L, 2);
+	luaL_argcheck(L, !BN_is_zero(n), 2, "zero modulus");
+
+	r = newbignum(L);
+
+	if (BN_mod_inverse(r, a, n, get_ctx_val(L)) == NULL) {
+		err = ERR_peek_last_error();
+		if (ERR_GET_LIB(err) != ERR_LIB_BN ||
+		    ERR_GET_REASON(err) != BN_R_NO_INVERSE)
+			return bnerror(L, "bn.modinv");
+
+		ERR_clear_error();
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+static int
+f_modsqrt(lua_State *L)
+{
+	BIGNUM *a, *p, *r;
+	unsigned long err;
+
+	a = tobignum(L, 1);
+	p = tobignum(L, 2);
+	luaL_argcheck(L, BN_is_odd(p) && !BN_is_negative(p), 2,
+	    "odd prime expected");
+
+	r = newbignum(L);
+
+	/* Tonelli-Shanks, Atkin's algorithm for p == 5 (mod 8). */
+	if (BN_mod_sqrt(r, a, p, get_ctx_val(L)) == NULL) {
+		err = ERR_peek_last_error();
+		if (ERR_GET_LIB(err) != ERR_LIB_BN ||
+		    ERR_GET_REASON(err) != BN_R_NOT_A_SQUARE)
+			return bnerror(L, "bn.modsqrt");
+
+		ERR_clear_error();
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+/*
+ * Shifts out trailing zero bits of nonzero x of *len limbs.
+ * Returns the number of bits shifted out.
+ */
+static int
+limbshiftout(BN_ULONG *x, int *len)
+{
+	int b, i, n, z;
+
+	for (z = 0; x[z] == 0; z++)
+		continue;
+	for (b = 0; !((x[z] >> b) & 1); b++)
+		continue;
+
+	n = *len - z;
+	for (i = 0; i < n; i++) {
+		x[i] = x[i + z] >> b;
+		if (b > 0 && i + z + 1 < *len)
+			x[i] |= x[i + z + 1] << (BN_BITS2 - b);
+	}
+
+	while (n > 0 && x[n - 1] == 0)
+		n--;
+	*len = n;
+
+	return z * BN_BITS2 + b;
+}
+
+/* Compares x of xl limbs and y of yl limbs. */
+static int
+limbcmp(const BN_ULONG *x, int xl, const BN_ULONG *y, int yl)
+{
+	int i;
+
+	if (xl != yl)
+		return xl < yl ? -1 : 1;
+
+	for (i = xl - 1; i >= 0; i--) {
+		if (x[i] != y[i])
+			return x[i] < y[i] ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/* x = x - y for x > y, updates *xl. */
+static void
+limbsub(BN_ULONG *x, int *xl, const BN_ULONG *y, int yl)
+{
+	BN_ULONG borrow, d, t, w;
+	int i;
+
+	for (i = 0, borrow = 0; i < *xl; i++) {
+		w = (i < yl) ? y[i] : 0;
+		t = x[i];
+		d = t - w;
+		x[i] = d - borrow;
+		borrow = (d > t) | (x[i] > d);
+	}
+
+	while (*xl > 0 && x[*xl - 1] == 0)
+		(*xl)--;
+}
+
+/* Sign of (2/n)^s for odd n. */
+#define JACOBI2(s, n) (((s) & 1) && (((n) & 7) == 3 || ((n) & 7) == 5))
+
+/* Binary algorithm for odd one-word x and y. */
+static int
+wordjacobi(BN_ULONG x, BN_ULONG y, int t)
+{
+	BN_ULONG tmp;
+	int s;
+
+	while (x != y) {
+		if (x < y) {
+			tmp = x;
+			x = y;
+			y = tmp;
+			if ((x & 3) == 3 && (y & 3) == 3)
+				t = -t;
+		}
+
+		x -= y;
+		for (s = 0; !(x & 1); s++)
+			x >>= 1;
+		if (JACOBI2(s, y))
+			t = -t;
+	}
+
+	return (x == 1) ? t : 0;
+}
+
+/*
+ * Jacobi symbol (a/n) for odd positive n computed with the binary
+ * algorithm on raw limbs: no divisions and no allocations after
+ * the initial reduction. Returns -2 on error.
+ */
+static int
+jacobi(const BIGNUM *a, const BIGNUM *n, BN_CTX *ctx)
+{
+	BIGNUM *x, *y;
+	BN_ULONG *xd, *yd, *td;
+	int res, t, tl, xl, yl;
+
+	BN_CTX_start(ctx);
+
+	x = BN_CTX_get(ctx);
+	y = BN_CTX_get(ctx);
+
+	if (y == NULL || !BN_nnmod(x, a, n, ctx) || !BN_copy(y, n)) {
+		BN_CTX_end(ctx);
+		return -2;
+	}
+
+	xd = x->d;
+	xl = x->top;
+	yd = y->d;
+	yl = y->top;
+	t = 1;
+
+	/* (0/n) is 1 only for n = 1. */
+	res = BN_is_one(n);
+
+	while (xl > 0) {
+		if (JACOBI2(limbshiftout(xd, &xl), yd[0]))
+			t = -t;
+
+		if (xl == 1 && yl == 1) {
+			res = wordjacobi(xd[0], yd[0], t);
+			break;
+		}
+
+		switch (limbcmp(xd, xl, yd, yl)) {
+		case 0:
+			res = (yl == 1 && yd[0] == 1) ? t : 0;
+			xl = 0;
+			continue;
+		case -1:
+			td = xd;
+			xd = yd;
+			yd = td;
+			tl = xl;
+			xl = yl;
+			yl = tl;
+			if ((xd[0] & 3) == 3 && (yd[0] & 3) == 3)
+				t = -t;
+			break;
+		}
+
+		limbsub(xd, &xl, yd, yl);
+	}
+
+	/* Limbs have been modified behind the back of x and y. */
+	BN_zero(x);
+	BN_zero(y);
+
+	BN_CTX_end(ctx);
+
+	return res;
+}
+
+/* Checks that the argument at narg is odd and positive. */
+static BIGNUM *
+checkjacobin(lua_State *L, int narg)
+{
+	BIGNUM *n;
+
+	n = tobignum(L, narg);
+	luaL_argcheck(L, BN_is_odd(n) && !BN_is_negative(n), narg,
+	    "odd positive number expected");
+
+	return n;
+}
+
+static int
+f_jacobi(lua_State *L)
+{
+	BIGNUM *a, *n;
+	int j;
+
+	a = tobignum(L, 1);
+	n = checkjacobin(L, 2);
+
+	if ((j = jacobi(a, n, get_ctx_val(L))) == -2)
+		return bnerror(L, "bn.jacobi");
+
+	lua_pushinteger(L, j);
+	return 1;
+}
+
+static int
+f_isneg(lua_State *L)
+{
+	BIGNUM *bn;
+
+	bn = tobignum(L, 1);
+	lua_pushboolean(L, BN_is_negative(bn) != 0);
+
+	return 1;
+}
+
+static int
+f_iseven(lua_State *L)
+{
+	BIGNUM *bn;
+
+	bn = tobignum(L, 1);
+	lua_pushboolean(L, BN_is_odd(bn) == 0);
+
+	return 1;
+}
+
+static int
+f_isodd(lua_State *L)
+{
+	BIGNUM *bn;
+
+	bn = tobignum(L, 1);
+	lua_pushboolean(L, BN_is_odd(bn) != 0);
+
+	return 1;
+}
+
+static int
+f_isone(lua_State *L)
+{
+	BIGNUM *bn;
+
+	bn = tobignum(L, 1);
+	lua_pushboolean(L, BN_is_one(bn));
+
+	return 1;
+}
+
+static int
+f_iszero(lua_State *L)
+{
+	BIGNUM *bn;
+
+	bn = tobignum(L, 1);
+	lua_pushboolean(L, BN_is_zero(bn));
+
+	return 1;
+}
+
+static int
+f_eq(lua_State *L)
+{
+
+	lua_pushboolean(L, h_cmp(L, false) == 0);
+
+	return 1;
+}
+
+static int
+f_modadd(lua_State *L)
+{
+	BIGNUM *mod;
+	BIGNUM *bn[3]; /* bn[0] = bn[1] + bn[2] modulo mod */
+	BN_CTX *ctx;
+
+	bn[0] = newbignum(L);
+
+	bn[1] = tobignum(L, 1);
+	bn[2] = tobignum(L, 2);
+	mod   = tobignum(L, 3);
+
+	ctx = get_ctx_val(L);
+
+	if (!BN_mod_add(bn[0], bn[1], bn[2], mod, ctx))
+		return bnerror(L, "bn.modadd");
+
+	return 1;
+}
+
+static int
+f_modsub(lua_State *L)
+{
+	BIGNUM *mod;
+	BIGNUM *bn[3]; /* bn[0] = bn[1] - bn[2] modulo mod */
+	BN_CTX *ctx;
+
+	bn[0] = newbignum(L);
+
+	bn[1] = tobignum(L, 1);
+	bn[2] = tobignum(L, 2);
+	mod   = tobignum(L, 3);
+
+	ctx = get_ctx_val(L);
+
+	if (!BN_mod_sub(bn[0], bn[1], bn[2], mod, ctx))
+		return bnerror(L, "bn.modsub");
+
+	return 1;
+}
+
+static int
+f_modmul(lua_State *L)
+{
+	BIGNUM *mod;
+	BIGNUM *bn[3]; /* bn[0] = bn[1] * bn[2] modulo mod */
+	BN_CTX *ctx;
+
+	bn3(L, bn);
+
+	mod = tobignum(L, 3);
+
+	ctx = get_ctx_val(L);
+
+	if (!BN_mod_mul(bn[0], bn[1], bn[2], mod, ctx))
+		return bnerror(L, "bn.modmul");
+
+	return 1;
+}
+
+static int
+f_modpow(lua_State *L)
+{
+	BIGNUM *mod;
+	BIGNUM *bn[3]; /* bn[0] = bn[1] ^ bn[2] modulo mod */
+	BN_CTX *ctx;
+	BN_MONT_CTX *mont;
+	struct shared *sh;
+	int status;
+
+	bn[0] = newbignum(L);
+	bn[1] = tobignum(L, 1);
+	bn[2] = tobignum(L, 2);
+	mod   = tobignum(L, 3);
+
+	ctx = get_ctx_val(L);
+
+	sh = ((struct BN *)mod)->shared;
+	mont = (sh != NULL) ? shared_mont(sh, ctx) : NULL;
+
+	if (mont == NULL)
+		status = BN_mod_exp(bn[0], bn[1], bn[2], mod, ctx);
+	else if (bn[1]->top == 1 && !BN_is_negative(bn[1]))
+		status = BN_mod_exp_mont_word(bn[0], bn[1]->d[0],
+		    bn[2], mod, ctx, mont);
+	else
+		status = BN_mod_exp_mont(bn[0], bn[1], bn[2], mod, ctx, mont);
+
+	if (!status)
+		return bnerror(L, "bn.modpow");
+
+	return 1;
+}
+
+static int
+f_modsqr(lua_State *L)
+{
+	BIGNUM *mod;
+	BIGNUM *bn[2]; /* bn[0] = sqr(bn[1]) modulo mod */
+	BN_CTX *ctx;
+
+	bn[0] = newbignum(L);
+	bn[1] = tobignum(L, 1);
+	mod   = tobignum(L, 2);
+
+	ctx = get_ctx_val(L);
+
+	if (!BN_mod_sqr(bn[0], bn[1], mod, ctx))
+		return bnerror(L, "bn.modsqr");
+
+	return 1;
+}
+
+static int
+f_nnmod(lua_State *L)
+{
+	BIGNUM *mod;
+	BIGNUM *bn[2]; /* bn[0] = nnmod(bn[1], mod) */
+	BN_CTX *ctx;
+
+	bn[0] = newbignum(L);
+	bn[1] = tobignum(L, 1);
+	mod   = tobignum(L, 2);
+
+	ctx = get_ctx_val(L);
+
+	if (!BN_nnmod(bn[0], bn[1], mod, ctx))
+		return bnerror(L, "bn.nnmod");
+
+	return 1;
+}
+
+/*
+ * Same as BN_exp but squares and products are computed with bigmul().
+ * Like BN_exp, it uses an absolute value of p.
+ */
+static int
+bigexp(BIGNUM *r, const BIGNUM *a, const BIGNUM *p,
+    const struct mulparams *mp, BN_CTX *ctx)
+{
+	BIGNUM *t;
+	int i, status;
+
+	BN_CTX_start(ctx);
+
+	status = (t = BN_CTX_get(ctx)) != NULL &&
+	    BN_copy(t, a) && BN_one(r);
+
+	for (i = BN_num_bits(p) - 1; status && i >= 0; i--) {
+		status = bigmul(r, r, r, mp, ctx);
+		if (status && BN_is_bit_set(p, i))
+			status = bigmul(r, r, t, mp, ctx);
+	}
+
+	BN_CTX_end(ctx);
+
+	return status;
+}
+
+/*
+ * Stores a^e in r, or w^e if a is NULL.
+ */
+static int
+bigexp_word(BIGNUM *r, const BIGNUM *a, BN_ULONG w, BN_ULONG e,
+    const struct mulparams *mp, BN_CTX *ctx)
+{
+	BIGNUM *t;
+	int i, status;
+
+	BN_CTX_start(ctx);
+
+	t = NULL;
+	status = BN_one(r);
+	if (status && a != NULL)
+		status = (t = BN_CTX_get(ctx)) != NULL && BN_copy(t, a);
+
+	for (i = BN_BITS2 - 1; i >= 0 && (e >> i & 1) == 0; i--)
+		continue;
+
+	for (; status && i >= 0; i--) {
+		status = bigmul(r, r, r, mp, ctx);
+		if (status && (e >> i & 1)) {
+			status = (a != NULL) ? bigmul(r, r, t, mp, ctx)
+			                     : BN_mul_word(r, w);
+		}
+	}
+
+	BN_CTX_end(ctx);
+
+	return status;
+}
+
+/*
+ * Stores 10^e in r. Values of 10^(2^k) for k < POW10_CACHE are
+ * cached in cv, so only multiplications are left.
+ */
+static int
+tenexp(BIGNUM *r, BN_ULONG e, struct ctxval *cv, BN_CTX *ctx)
+{
+	const BIGNUM *p;
+	BIGNUM *t, **c;
+	int k, status;
+
+	BN_CTX_start(ctx);
+
+	status = (t = BN_CTX_get(ctx)) != NULL && BN_one(r);
+
+	for (k = 0, p = NULL; status && k < BN_BITS2 && (e >> k) != 0; k++) {
+		if (k < POW10_CACHE) {
+			c = &cv->pow10[k];
+			if (*c == NULL && (*c = BN_new()) != NULL) {
+				status = (k == 0) ? BN_set_word(*c, 10) :
+				    bigmul(*c, p, p, &cv->mul, ctx);
+				if (!status) {
+					BN_free(*c);
+					*c = NULL;
+				}
+			}
+			status = status && *c != NULL;
+			p = *c;
+		} else {
+			status = bigmul(t, p, p, &cv->mul, ctx);
+			p = t;
+		}
+
+		if (status && (e >> k & 1))
+			status = bigmul(r, r, p, &cv->mul, ctx);
+	}
+
+	BN_CTX_end(ctx);
+
+	return status;
+}
+
+/* Returns log2(|a|) if |a| is a power of two or -1 otherwise. */
+static int
+abslog2(const BIGNUM *a)
+{
+	BN_ULONG top;
+	int i;
+
+	if (BN_is_zero(a))
+		return -1;
+
+	for (i = 0; i < a->top - 1; i++) {
+		if (a->d[i] != 0)
+			return -1;
+	}
+
+	top = a->d[a->top-1];
+
+	return ((top & (top - 1)) == 0) ? BN_num_bits(a) - 1 : -1;
+}
+
+/*
+ * Returns true if a value at narg is a Lua number which can be
+ * represented as a word with a sign.
+ */
+static bool
+numberword(lua_State *L, int narg, BN_ULONG *w, bool *isneg)
+{
+
+	if (lua_type(L, narg) != LUA_TNUMBER)
+		return false;
+
+	*w = absnumber(L, narg, isneg);
+	return *w != 0 || lua_tonumber(L, narg) == 0;
+}
+
+/*
+ * Power with a special treatment of word exponents: powers of two
+ * are shifts, powers of 10 come from the cache and word bases
+ * are multiplied with BN_mul_word. Lua numbers aren't converted
+ * to BIGNUM. Like BN_exp, it uses an absolute value of the exponent.
+ */
+static int
+h_pow(lua_State *L, const char *errmsg)
+{
+	BIGNUM *r, *a, *p;
+	BN_ULONG w, e;
+	BN_CTX *ctx;
+	bool isneg, eisneg;
+	int k, status;
+
+	p = NULL;
+	if (!numberword(L, 2, &e, &eisneg)) {
+		p = tobignum(L, 2);
+		if (BN_num_bits(p) <= BN_BITS2) {
+			e = BN_get_word(p);
+			p = NULL;
+		}
+	}
+
+	a = NULL;
+	if (!numberword(L, 1, &w, &isneg)) {
+		a = tobignum(L, 1);
+		isneg = BN_is_negative(a);
+	}
+
+	r = newbignum(L);
+	ctx = get_ctx_val(L);
+
+	/* log2 of the absolute value of the base if it's a power of two */
+	if (a != NULL)
+		k = abslog2(a);
+	else
+		k = (w != 0 && (w & (w - 1)) == 0) ? BN_num_bits_word(w) - 1 : -1;
+
+	if (p != NULL) {
+		if (a == NULL)
+			a = tobignum(L, 1);
+		status = bigexp(r, a, p, get_mulparams(L), ctx);
+	} else if (k >= 0) {
+		if (k != 0 && e > (BN_ULONG)(INT_MAX / k))
+			return luaL_error(L, "%s: result is too large", errmsg);
+		BN_zero(r);
+		status = BN_set_bit(r, k * (int)e);
+	} else if (a == NULL && w == 0) {
+		status = BN_set_word(r, e == 0);
+	} else if (a == NULL && w == 10) {
+		status = tenexp(r, e, get_ctxval(L), ctx);
+	} else {
+		status = bigexp_word(r, a, w, e, get_mulparams(L), ctx);
+	}
+
+	if (status == 0)
+		return bnerror(L, errmsg);
+
+	/* bigexp() sets the sign, e isn't set in that case. */
+	if (p == NULL && isneg && (e & 1))
+		BN_set_negative(r, 1);
+
+	return 1;
+}
+
+static int
+mt_pow(lua_State *L)
+{
+
+	if (LAZYOPERANDS(L))
+		return lazyarith(L, LAZY_POW);
+	if (RATOPERAND(L))
+		return ratarith(L, LAZY_POW);
+
+	return h_pow(L, BN_METATABLE ".pow");
+}
+
+static int
+f_pow(lua_State *L)
+{
+
+	return h_pow(L, "bn.pow");
+}
+
+static int
+f_sqr(lua_State *L)
+{
+	BIGNUM *r, *bn;
+	BN_CTX *ctx;
+
+	if ((bn = testbignum(L, 1)) != NULL) {
+		r = newbignum(L);
+	} else {
+		bn = r = tobignum(L, 1);
+		lua_pushvalue(L, 1);
+	}
+
+	ctx = get_ctx_val(L);
+
+	if (!bigmul(r, bn, bn, get_mulparams(L), ctx))
+		return bnerror(L, "bn.sqr");
+
+	return 1;
+}
+
+/*
+ * Stores floor(|a|^(1/k)) in r. Newton's iteration starts from
+ * 2^ceil(bits/k) which is above the root and decreases monotonically.
+ */
+static int
+iroot(BIGNUM *r, const BIGNUM *a, int k, const struct mulparams *mp,
+    BN_CTX *ctx)
+{
+	BIGNUM *n, *x, *y, *t, *tmp;
+	int bits, status;
+
+	bits = BN_num_bits(a);
+
+	if (bits == 0) {
+		BN_zero(r);
+		return 1;
+	} else if (k >= bits) {
+		return BN_one(r);
+	}
+
+	BN_CTX_start(ctx);
+
+	n = BN_CTX_get(ctx);
+	x = BN_CTX_get(ctx);
+	y = BN_CTX_get(ctx);
+	t = BN_CTX_get(ctx);
+
+	status = (t != NULL) && BN_copy(n, a);
+	if (status) {
+		BN_set_negative(n, 0);
+		BN_zero(x);
+		status = BN_set_bit(x, (bits + k - 1) / k);
+	}
+
+	/* y = ((k - 1) * x + n / x^(k-1)) / k */
+	while (status) {
+		status = bigexp_word(t, x, 0, k - 1, mp, ctx) &&
+		    BN_div(y, NULL, n, t, ctx) &&
+		    BN_copy(t, x) &&
+		    BN_mul_word(t, k - 1) &&
+		    BN_add(y, y, t) &&
+		    BN_div_word(y, k) != (BN_ULONG)-1;
+
+		if (!status || BN_cmp(y, x) >= 0)
+			break;
+
+		tmp = x;
+		x = y;
+		y = tmp;
+	}
+
+	status = status && BN_copy(r, x);
+
+	BN_CTX_end(ctx);
+
+	return status;
+}
+
+static int
+f_sqrt(lua_State *L)
+{
+	BIGNUM *a, *r;
+
+	a = tobignum(L, 1);
+	luaL_argcheck(L, !BN_is_negative(a), 1, "negative number");
+
+	r = newbignum(L);
+
+	if (!iroot(r, a, 2, get_mulparams(L), get_ctx_val(L)))
+		return bnerror(L, "bn.sqrt");
+
+	return 1;
+}
+
+static int
+f_sqrtrem(lua_State *L)
+{
+	BIGNUM *a, *s, *rem;
+	BN_CTX *ctx;
+	int status;
+
+	a = tobignum(L, 1);
+	luaL_argcheck(L, !BN_is_negative(a), 1, "negative number");
+
+	s = newbignum(L);
+	rem = newbignum(L);
+
+	ctx = get_ctx_val(L);
+
+	status = iroot(s, a, 2, get_mulparams(L), ctx) &&
+	    bigmul(rem, s, s, get_mulparams(L), ctx) &&
+	    BN_sub(rem, a, rem);
+	if (status == 0)
+		return bnerror(L, "bn.sqrtrem");
+
+	return 2;
+}
+
+static int
+f_root(lua_State *L)
+{
+	BIGNUM *a, *r;
+	int k;
+
+	a = tobignum(L, 1);
+	k = checkint(L, 2);
+	luaL_argcheck(L, k >= 1, 2, "positive integer expected");
+	luaL_argcheck(L, !BN_is_negative(a) || (k & 1), 1,
+	    "negative number with even root");
+
+	r = newbignum(L);
+
+	if (!iroot(r, a, k, get_mulparams(L), get_ctx_val(L)))
+		return bnerror(L, "bn.root");
+
+	BN_set_negative(r, BN_is_negative(a));
+
+	return 1;
+}
+
+/* Squares modulo 64 have bit (a mod 64) set. */
+#define SQUARES_MOD64 UINT64_C(0x0202021202030213)
+
+/*
+ * Returns true, b and k if a == b^k for prime k. k is the smallest
+ * such prime. Returns false otherwise.
+ */
+static int
+f_isperfectpower(lua_State *L)
+{
+	BIGNUM *a, *r, *t;
+	const struct mulparams *mp;
+	BN_CTX *ctx;
+	int bits, d, k, status;
+	bool found, isneg, isprime;
+
+	a = tobignum(L, 1);
+	isneg = BN_is_negative(a);
+	bits = BN_num_bits(a);
+
+	r = newbignum(L);
+
+	if (bits <= 1) {
+		lua_pushboolean(L, true);
+		lua_pushvalue(L, 1);
+		lua_pushinteger(L, isneg ? 3 : 2);
+		return 3;
+	}
+
+	mp = get_mulparams(L);
+	ctx = get_ctx_val(L);
+
+	BN_CTX_start(ctx);
+
+	status = (t = BN_CTX_get(ctx)) != NULL;
+	found = false;
+
+	for (k = isneg ? 3 : 2; status && !found && k < bits; k++) {
+		for (d = 2, isprime = true; isprime && d * d <= k; d++)
+			isprime = (k % d != 0);
+		if (!isprime)
+			continue;
+
+		if (k == 2 && !(SQUARES_MOD64 >> (a->d[0] & 63) & 1))
+			continue;
+
+		status = iroot(r, a, k, mp, ctx) &&
+		    bigexp_word(t, r, 0, k, mp, ctx);
+		found = status && BN_ucmp(t, a) == 0;
+	}
+
+	BN_CTX_end(ctx);
+
+	if (status == 0)
+		return bnerror(L, "bn.isperfectpower");
+
+	lua_pushboolean(L, found);
+	if (!found)
+		return 1;
+
+	BN_set_negative(r, isneg);
+	lua_pushvalue(L, -2);
+	lua_pushinteger(L, k - 1);
+
+	return 3;
+}
+
+/* Small primes below 2^SMALLPRIME_BITS for trial division and sieving. */
+#define SMALLPRIME_BITS 14
+#define NSMALLPRIMES_MAX 2048
+
+/* Number of candidates in one sieve window. */
+#define SIEVE_LEN 4096
+
+/* Maximal number of threads of bn.genprime. */
+#define GENPRIME_MAXTHREADS 64
+
+static uint16_t smallprimes[NSMALLPRIMES_MAX];
+static int nsmallprimes;
+static pthread_once_t smallprimes_once = PTHREAD_ONCE_INIT;
+
+static void
+initsmallprimes(void)
+{
+	static bool composite[1 << SMALLPRIME_BITS];
+	int i, j;
+
+	for (i = 2; i < (1 << SMALLPRIME_BITS); i++) {
+		if (composite[i])
+			continue;
+		smallprimes[nsmallprimes++] = i;
+		for (j = i * i; j < (1 << SMALLPRIME_BITS); j += i)
+			composite[j] = true;
+	}
+}
+
+/*
+ * Computes remainders of nonnegative a modulo the first n small primes.
+ * Primes are grouped so that their product fits in a word and one
+ * BN_mod_word call serves the whole group.
+ */
+static int
+smallrems(const BIGNUM *a, int n, uint16_t *rems)
+{
+	BN_ULONG m, r;
+	int i, j;
+
+	for (i = 0; i < n; ) {
+		m = smallprimes[i];
+		for (j = i + 1; j < n && m <= BN_MASK2 / smallprimes[j]; j++)
+			m *= smallprimes[j];
+
+		if ((r = BN_mod_word(a, m)) == (BN_ULONG)-1)
+			return 0;
+
+		for (; i < j; i++)
+			rems[i] = r % smallprimes[i];
+	}
+
+	return 1;
+}
+
+/*
+ * Strong Miller-Rabin test of odd n > 3 to base b, n - 1 = d * 2^s.
+ * Returns 1 for a probable prime, 0 for a composite and -1 on error.
+ */
+static int
+millerrabin(const BIGNUM *n, const BIGNUM *nm1, const BIGNUM *d, int s,
+    const BIGNUM *b, BN_MONT_CTX *mont, BN_CTX *ctx)
+{
+	BIGNUM *x;
+	int i, res;
+
+	BN_CTX_start(ctx);
+
+	x = BN_CTX_get(ctx);
+
+	if (x == NULL || !BN_mod_exp_mont(x, b, d, n, ctx, mont)) {
+		res = -1;
+	} else if (BN_is_one(x) || BN_cmp(x, nm1) == 0) {
+		res = 1;
+	} else {
+		for (i = 1, res = 0; res == 0 && i < s; i++) {
+			if (!BN_mod_sqr(x, x, n, ctx))
+				res = -1;
+			else if (BN_cmp(x, nm1) == 0)
+				res = 1;
+			else if (BN_is_one(x))
+				break;
+		}
+	}
+
+	BN_CTX_end(ctx);
+
+	return res;
+}
+
+/* x = x / 2 (mod n) for odd n. */
+static int
+modhalf(BIGNUM *x, const BIGNUM *n)
+{
+
+	return (!BN_is_odd(x) || BN_add(x, x, n)) && BN_rshift1(x, x);
+}
+
+/*
+ * Strong Lucas test of odd n with Selfridge's parameters: the first D
+ * in 5, -7, 9, -11, ... with Jacobi symbol (D/n) = -1, P = 1 and
+ * Q = (1 - D) / 4. Returns 1 for a probable prime, 0 for a composite
+ * and -1 on error.
+ */
+static int
+lucas(const BIGNUM *n, const struct mulparams *mp, BN_CTX *ctx)
+{
+	BIGNUM *D, *Q, *U, *V, *Qk, *k, *t;
+	long d;
+	int i, j, res, s, status;
+
+	BN_CTX_start(ctx);
+
+	D = BN_CTX_get(ctx);
+	Q = BN_CTX_get(ctx);
+	U = BN_CTX_get(ctx);
+	V = BN_CTX_get(ctx);
+	Qk = BN_CTX_get(ctx);
+	k = BN_CTX_get(ctx);
+	t = BN_CTX_get(ctx);
+
+	status = (t != NULL);
+	res = -1;
+	j = 0;
+
+	for (d = 5, i = 0; status; d = d > 0 ? -d - 2 : -d + 2, i++) {
+		status = BN_set_word(D, labs(d));
+		BN_set_negative(D, d < 0);
+		if (status && (j = BN_kronecker(D, n, ctx)) == -1)
+			break;
+		status = status && j != -2;
+		if (status && j == 0 && !BN_abs_is_word(n, labs(d))) {
+			res = 0;
+			goto done;
+		}
+
+		/* D is never found for squares. */
+		if (status && i == 4) {
+			status = iroot(t, n, 2, mp, ctx) &&
+			    BN_sqr(t, t, ctx);
+			if (status && BN_cmp(t, n) == 0) {
+				res = 0;
+				goto done;
+			}
+		}
+	}
+
+	status = status &&
+	    BN_nnmod(D, D, n, ctx) &&
+	    BN_set_word(Q, labs((1 - d) / 4));
+	BN_set_negative(Q, (1 - d) < 0);
+	status = status &&
+	    BN_nnmod(Q, Q, n, ctx) &&
+	    BN_copy(Qk, Q) &&
+	    BN_one(U) &&
+	    BN_one(V) &&
+	    BN_add(k, n, BN_value_one());
+
+	/* n + 1 = k * 2^s */
+	for (s = 0; status && !BN_is_bit_set(k, s); s++)
+		continue;
+	status = status && BN_rshift(k, k, s);
+
+	/* U = U_k, V = V_k and Qk = Q^k computed from the top bit of k. */
+	for (i = BN_num_bits(k) - 2; status && i >= 0; i--) {
+		status = BN_mod_mul(U, U, V, n, ctx) &&
+		    BN_mod_sqr(V, V, n, ctx) &&
+		    BN_mod_lshift1_quick(t, Qk, n) &&
+		    BN_mod_sub_quick(V, V, t, n) &&
+		    BN_mod_sqr(Qk, Qk, n, ctx);
+
+		if (status && BN_is_bit_set(k, i)) {
+			status = BN_mod_add_quick(t, U, V, n) &&
+			    modhalf(t, n) &&
+			    BN_mod_mul(U, D, U, n, ctx) &&
+			    BN_mod_add_quick(V, V, U, n) &&
+			    modhalf(V, n) &&
+			    BN_copy(U, t) &&
+			    BN_mod_mul(Qk, Qk, Q, n, ctx);
+		}
+	}
+
+	if (status)
+		res = BN_is_zero(U) || BN_is_zero(V);
+
+	for (i = 1; status && res == 0 && i < s; i++) {
+		status = BN_mod_sqr(V, V, n, ctx) &&
+		    BN_mod_lshift1_quick(t, Qk, n) &&
+		    BN_mod_sub_quick(V, V, t, n) &&
+		    BN_mod_sqr(Qk, Qk, n, ctx);
+		res = BN_is_zero(V);
+	}
+
+	if (!status)
+		res = -1;
+done:
+	BN_CTX_end(ctx);
+
+	return res;
+}
+
+/*
+ * Trial division by small primes followed by Baillie-PSW test and
+ * Miller-Rabin tests to rounds random bases. Returns 1 if n is a
+ * (probable) prime, 0 if it's composite and -1 on error.
+ */
+static int
+isprime(const BIGNUM *n, int rounds, const struct mulparams *mp,
+    BN_CTX *ctx)
+{
+	uint16_t rems[NSMALLPRIMES_MAX];
+	BN_MONT_CTX *mont;
+	BIGNUM *nm1, *d, *b;
+	BN_ULONG p;
+	int bits, i, ntrial, res, s;
+
+	if (BN_is_negative(n) || BN_cmp(n, BN_value_one()) <= 0)
+		return 0;
+
+	bits = BN_num_bits(n);
+	ntrial = bits < nsmallprimes ? bits : nsmallprimes;
+
+	if (!smallrems(n, ntrial, rems))
+		return -1;
+
+	for (i = 0; i < ntrial; i++) {
+		if (rems[i] == 0)
+			return BN_is_word(n, smallprimes[i]);
+	}
+
+	p = smallprimes[ntrial - 1];
+	if (bits <= 2 * SMALLPRIME_BITS && BN_get_word(n) < p * p)
+		return 1;
+
+	if ((mont = BN_MONT_CTX_new()) == NULL)
+		return -1;
+
+	BN_CTX_start(ctx);
+
+	nm1 = BN_CTX_get(ctx);
+	d = BN_CTX_get(ctx);
+	b = BN_CTX_get(ctx);
+
+	res = -1;
+	if (b != NULL && BN_MONT_CTX_set(mont, n, ctx) &&
+	    BN_sub(nm1, n, BN_value_one()) && BN_set_word(b, 2)) {
+		for (s = 1; !BN_is_bit_set(nm1, s); s++)
+			continue;
+		if (BN_rshift(d, nm1, s))
+			res = millerrabin(n, nm1, d, s, b, mont, ctx);
+	}
+
+	if (res == 1)
+		res = lucas(n, mp, ctx);
+
+	for (i = 0; res == 1 && i < rounds; i++) {
+		/* 2 <= b <= n - 2 */
+		if (!BN_sub_word(nm1, 2) ||
+		    !BN_pseudo_rand_range(b, nm1) ||
+		    !BN_add_word(nm1, 2) ||
+		    !BN_add_word(b, 2)) {
+			res = -1;
+		} else {
+			res = millerrabin(n, nm1, d, s, b, mont, ctx);
+		}
+	}
+
+	BN_CTX_end(ctx);
+	BN_MONT_CTX_free(mont);
+
+	return res;
+}
+
+/* Shared state of threads of bn.genprime. */
+struct primesearch
+{
+	pthread_mutex_t lock;
+	bool done;
+};
+
+static bool
+searchdone(struct primesearch *ps)
+{
+	bool done;
+
+	if (ps == NULL)
+		return false;
+
+	pthread_mutex_lock(&ps->lock);
+	done = ps->done;
+	pthread_mutex_unlock(&ps->lock);
+
+	return done;
+}
+
+/*
+ * Finds the first prime r >= start, start is odd. If safe is set,
+ * start must be 3 (mod 4) and (r - 1) / 2 must be prime too. The search
+ * stops if r exceeds bits bits (unless bits is 0) or if another thread
+ * finished. Candidates are sieved by small primes in windows of
+ * SIEVE_LEN with remainders updated incrementally. Returns 1 if r is
+ * found, 0 if the search stopped and -1 on error.
+ */
+static int
+primesieve(BIGNUM *r, const BIGNUM *start, int bits, bool safe,
+    struct primesearch *ps, const struct mulparams *mp, BN_CTX *ctx)
+{
+	uint16_t rems[NSMALLPRIMES_MAX];
+	char sieve[SIEVE_LEN];
+	BIGNUM *c, *x, *q;
+	unsigned long inv, p;
+	int i, j, minbits, nsieve, res, step;
+
+	step = safe ? 4 : 2;
+	/* Small primes divide themselves. */
+	minbits = SMALLPRIME_BITS + (safe ? 1 : 0);
+
+	BN_CTX_start(ctx);
+
+	c = BN_CTX_get(ctx);
+	x = BN_CTX_get(ctx);
+	q = BN_CTX_get(ctx);
+
+	res = (q != NULL && BN_copy(c, start)) ? 0 : -1;
+	nsieve = 0;
+
+	while (res == 0) {
+		if (nsieve == 0 && BN_num_bits(c) > minbits) {
+			nsieve = nsmallprimes;
+			if (!smallrems(c, nsieve, rems)) {
+				res = -1;
+				break;
+			}
+		}
+
+		memset(sieve, 0, sizeof(sieve));
+		for (i = 1; i < nsieve; i++) {
+			p = smallprimes[i];
+			/* 1 / step (mod p) */
+			inv = (p + 1) / 2;
+			if (safe)
+				inv = inv * inv % p;
+
+			/* c + step * j == 0 (mod p) */
+			for (j = (p - rems[i]) * inv % p; j < SIEVE_LEN; j += p)
+				sieve[j] = 1;
+
+			/* (c + step * j - 1) / 2 == 0 (mod p) */
+			if (safe) {
+				j = (p + 1 - rems[i]) * inv % p;
+				for (; j < SIEVE_LEN; j += p)
+					sieve[j] = 1;
+			}
+
+			rems[i] = (rems[i] + (unsigned long)step * SIEVE_LEN) % p;
+		}
+
+		for (j = 0; res == 0 && j < SIEVE_LEN; j++) {
+			if (sieve[j])
+				continue;
+
+			if (searchdone(ps))
+				break;
+
+			if (!BN_copy(x, c) || !BN_add_word(x, step * j)) {
+				res = -1;
+				break;
+			}
+
+			if (bits > 0 && BN_num_bits(x) > bits)
+				break;
+
+			if (safe) {
+				res = BN_rshift1(q, x) ? isprime(q, 0, mp, ctx) : -1;
+				if (res == 1)
+					res = isprime(x, 0, mp, ctx);
+			} else {
+				res = isprime(x, 0, mp, ctx);
+			}
+		}
+
+		if (j < SIEVE_LEN)
+			break;
+
+		if (!BN_add_word(c, step * SIEVE_LEN))
+			res = -1;
+	}
+
+	if (res == 1 && !BN_copy(r, x))
+		res = -1;
+
+	BN_CTX_end(ctx);
+
+	return res;
+}
+
+struct primeworker
+{
+	struct primesearch *ps;
+	struct mulparams mp;
+	BIGNUM *start;
+	BIGNUM *result;
+	int bits;
+	bool safe;
+	int res;
+};
+
+static void *
+primeworker(void *arg)
+{
+	struct primeworker *w = arg;
+	BN_CTX *ctx;
+
+	if ((ctx = BN_CTX_new()) == NULL) {
+		w->res = -1;
+	} else {
+		w->res = primesieve(w->result, w->start, w->bits, w->safe,
+		    w->ps, &w->mp, ctx);
+		BN_CTX_free(ctx);
+	}
+
+	if (w->res != 0) {
+		pthread_mutex_lock(&w->ps->lock);
+		w->ps->done = true;
+		pthread_mutex_unlock(&w->ps->lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Runs primesieve() in nthreads threads from random starting points.
+ * Worker threads use their own BN_CTX and don't call RAND functions.
+ */
+static int
+genprime(BIGNUM *r, int bits, bool safe, int nthreads,
+    const struct mulparams *mp)
+{
+	struct primeworker w[GENPRIME_MAXTHREADS];
+	pthread_t tid[GENPRIME_MAXTHREADS];
+	struct primesearch ps;
+	bool started[GENPRIME_MAXTHREADS];
+	int found, i, n, res;
+
+	pthread_mutex_init(&ps.lock, NULL);
+	ps.done = false;
+
+	for (n = 0, res = 1; res == 1 && n < nthreads; n++) {
+		w[n].ps = &ps;
+		w[n].mp = *mp;
+		w[n].bits = bits;
+		w[n].safe = safe;
+		w[n].res = 0;
+		w[n].start = BN_new();
+		w[n].result = BN_new();
+		started[n] = false;
+
+		if (w[n].start == NULL || w[n].result == NULL ||
+		    !BN_rand(w[n].start, bits, 0, 1) ||
+		    (safe && !BN_set_bit(w[n].start, 1))) {
+			res = -1;
+		}
+	}
+
+	/*
+	 * No thread is started if an allocation fails. Numbers of
+	 * the first n workers, including the failed one, are freed below.
+	 */
+	for (i = 1; res == 1 && i < n; i++)
+		started[i] = pthread_create(&tid[i], NULL, primeworker, &w[i]) == 0;
+
+	if (res == 1)
+		primeworker(&w[0]);
+
+	for (i = 1; i < n; i++) {
+		if (started[i])
+			pthread_join(tid[i], NULL);
+	}
+
+	for (i = 0, found = -1; res == 1 && i < n; i++) {
+		if (w[i].res == -1)
+			res = -1;
+		else if (w[i].res == 1 && found == -1)
+			found = i;
+	}
+
+	/* All searches ran out of bits. */
+	if (res == 1 && found == -1)
+		res = 0;
+	else if (res == 1 && !BN_copy(r, w[found].result))
+		res = -1;
+
+	for (i = 0; i < n; i++) {
+		BN_free(w[i].start);
+		BN_free(w[i].result);
+	}
+
+	pthread_mutex_destroy(&ps.lock);
+
+	return res;
+}
+
+static int
+f_isprime(lua_State *L)
+{
+	BIGNUM *a;
+	int res, rounds;
+
+	a = tobignum(L, 1);
+	rounds = luaL_optinteger(L, 2, 0);
+	luaL_argcheck(L, rounds >= 0, 2, "nonnegative integer expected");
+
+	res = isprime(a, rounds, get_mulparams(L), get_ctx_val(L));
+	if (res == -1)
+		return bnerror(L, "bn.isprime");
+
+	lua_pushboolean(L, res);
+	return 1;
+}
+
+static int
+f_nextprime(lua_State *L)
+{
+	BIGNUM *a, *r;
+	BN_CTX *ctx;
+	int res;
+
+	a = tobignum(L, 1);
+	r = newbignum(L);
+
+	ctx = get_ctx_val(L);
+
+	if (BN_is_negative(a) || BN_cmp(a, BN_value_one()) <= 0) {
+		res = BN_set_word(r, 2);
+	} else {
+		res = BN_add_word(r, BN_is_odd(a) ? 2 : 1) &&
+		    BN_add(r, r, a) &&
+		    primesieve(r, r, 0, false, NULL, get_mulparams(L), ctx);
+	}
+
+	if (res != 1)
+		return bnerror(L, "bn.nextprime");
+
+	return 1;
+}
+
+static int
+f_genprime(lua_State *L)
+{
+	BIGNUM *r;
+	int bits, nthreads, res;
+	bool safe;
+
+	bits = checkint(L, 1);
+	safe = lua_toboolean(L, 2);
+	nthreads = luaL_optinteger(L, 3, 1);
+
+	luaL_argcheck(L, bits >= (safe ? 3 : 2), 1, "too few bits");
+	luaL_argcheck(L, nthreads >= 1 && nthreads <= GENPRIME_MAXTHREADS,
+	    3, "invalid number of threads");
+
+	/* Small ranges are searched quickly and may need restarts. */
+	if (bits < 64)
+		nthreads = 1;
+
+	r = newbignum(L);
+
+	do {
+		res = genprime(r, bits, safe, nthreads, get_mulparams(L));
+	} while (res == 0);
+
+	if (res == -1)
+		return bnerror(L, "bn.genprime");
+
+	return 1;
+}
+
+/*
+ * Returns a scratch buffer of len bytes. If sbuf is not big enough,
+ * a buffer is allocated as userdata. Always pushes one value to stack.
+ */
+static unsigned char *
+tmpbuf(lua_State *L, unsigned char *sbuf, size_t sbuflen, size_t len)
+{
+
+	if (len <= sbuflen) {
+		lua_pushnil(L);
+		return sbuf;
+	}
+
+	return (unsigned char *)lua_newuserdata(L, len);
+}
+
+/* Size of a block of random bytes drawn at once by bn.rand_vector. */
+#define RANDBUF_SIZE 65536
+
+/* Checks bits, top and bottom arguments of BN_rand() at narg. */
+static void
+checkrandargs(lua_State *L, int narg, int *bits, int *top, bool *bottom)
+{
+
+	*bits = checkint(L, narg);
+	*top = luaL_optinteger(L, narg + 1, -1);
+	*bottom = lua_toboolean(L, narg + 2);
+
+	luaL_argcheck(L, *bits >= 0, narg, "nonnegative integer expected");
+	luaL_argcheck(L, *top >= -1 && *top <= 1, narg + 1,
+	    "-1, 0 or 1 expected");
+	luaL_argcheck(L, *bits > *top && (*bits > 0 || !*bottom), narg,
+	    "too few bits");
+}
+
+/* Sets bit b of big-endian number in buf of len bytes. */
+static void
+setbufbit(unsigned char *buf, int len, int b)
+{
+
+	buf[len - 1 - b / CHAR_BIT] |= 1u << (b % CHAR_BIT);
+}
+
+static int
+f_rand(lua_State *L)
+{
+	BIGNUM *r;
+	int bits, top;
+	bool bottom;
+
+	checkrandargs(L, 1, &bits, &top, &bottom);
+
+	r = newbignum(L);
+
+	if (!BN_rand(r, bits, top, bottom))
+		return bnerror(L, "bn.rand");
+
+	return 1;
+}
+
+static int
+f_rand_range(lua_State *L)
+{
+	BIGNUM *n, *r;
+
+	n = tobignum(L, 1);
+	luaL_argcheck(L, !BN_is_negative(n) && !BN_is_zero(n), 1,
+	    "positive number expected");
+
+	r = newbignum(L);
+
+	/* BN_rand_range() rejects samples outside of the range. */
+	if (!BN_rand_range(r, n))
+		return bnerror(L, "bn.rand_range");
+
+	return 1;
+}
+
+/*
+ * Random bytes for all numbers are drawn in blocks of RANDBUF_SIZE
+ * with one RAND_bytes() call per block.
+ */
+static int
+f_rand_vector(lua_State *L)
+{
+	unsigned char sbuf[256];
+	unsigned char *buf, *p;
+	BIGNUM *r;
+	int bits, count, i, len, n, nblock, top;
+	bool bottom;
+
+	count = checkint(L, 1);
+	luaL_argcheck(L, count >= 0, 1, "nonnegative integer expected");
+	checkrandargs(L, 2, &bits, &top, &bottom);
+	lua_settop(L, 4);
+
+	len = (bits + CHAR_BIT - 1) / CHAR_BIT;
+	nblock = len > 0 && len < RANDBUF_SIZE ? RANDBUF_SIZE / len : 1;
+	if (nblock > count)
+		nblock = count;
+
+	buf = tmpbuf(L, sbuf, sizeof(sbuf), (size_t)nblock * len);
+	lua_createtable(L, count, 0);
+
+	for (i = 0, n = 0, p = buf; i < count; i++, n--, p += len) {
+		if (n == 0) {
+			n = count - i < nblock ? count - i : nblock;
+			p = buf;
+			if (len > 0 && RAND_bytes(buf, n * len) != 1)
+				return bnerror(L, "bn.rand_vector");
+		}
+
+		if (len > 0)
+			p[0] &= UCHAR_MAX >> (len * CHAR_BIT - bits);
+		if (top >= 0)
+			setbufbit(p, len, bits - 1);
+		if (top == 1)
+			setbufbit(p, len, bits - 2);
+		if (bottom)
+			setbufbit(p, len, 0);
+
+		r = newbignum(L);
+		if (BN_bin2bn(p, len, r) == NULL)
+			return bnerror(L, "bn.rand_vector");
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	return 1;
+}
+
+/* Negates big-endian two's complement number in buf. */
+static void
+negatebytes(unsigned char *buf, int len)
+{
+	unsigned int carry;
+	int i;
+
+	for (i = len - 1, carry = 1; i >= 0; i--) {
+		carry += (unsigned char)~buf[i];
+		buf[i] = carry & UCHAR_MAX;
+		carry >>= CHAR_BIT;
+	}
+}
+
+/*
+ * Writes len bytes of big-endian two's complement representation
+ * of bn to buf. len should be greater than BN_num_bytes(bn).
+ */
+static void
+tocomplement(const BIGNUM *bn, unsigned char *buf, int len)
+{
+	int n;
+
+	n = BN_num_bytes(bn);
+	memset(buf, 0, len - n);
+	BN_bn2bin(bn, buf + len - n);
+
+	if (BN_is_negative(bn))
+		negatebytes(buf, len);
+}
+
+/* Reverse of tocomplement(). Modifies buf. */
+static BIGNUM *
+fromcomplement(BIGNUM *r, unsigned char *buf, int len)
+{
+	bool isneg;
+
+	isneg = (buf[0] >> (CHAR_BIT - 1)) != 0;
+	if (isneg)
+		negatebytes(buf, len);
+
+	if (BN_bin2bn(buf, len, r) == NULL)
+		return NULL;
+
+	BN_set_negative(r, isneg);
+	return r;
+}
+
+enum bitop { BITOP_AND, BITOP_OR, BITOP_XOR };
+
+/*
+ * Implementation of f_band, f_bor and f_bxor. Negative numbers are
+ * treated as two's complement numbers with an infinite sign extension.
+ */
+static int
+h_bitop(lua_State *L, enum bitop op, const char *errmsg)
+{
+	unsigned char sbuf[128];
+	unsigned char *a, *b;
+	BIGNUM *bn[3]; /* bn[0] = bn[1] op bn[2] */
+	int i, len;
+
+	bn[1] = tobignum(L, 1);
+	bn[2] = tobignum(L, 2);
+	bn[0] = newbignum(L);
+
+	/* One extra byte for a sign bit. */
+	len = BN_num_bytes(bn[1]);
+	if (len < BN_num_bytes(bn[2]))
+		len = BN_num_bytes(bn[2]);
+	len += 1;
+
+	a = tmpbuf(L, sbuf, sizeof(sbuf), 2 * len);
+	b = a + len;
+
+	tocomplement(bn[1], a, len);
+	tocomplement(bn[2], b, len);
+
+	for (i = 0; i < len; i++) {
+		switch (op) {
+		case BITOP_AND: a[i] &= b[i]; break;
+		case BITOP_OR:  a[i] |= b[i]; break;
+		case BITOP_XOR: a[i] ^= b[i]; break;
+		}
+	}
+
+	if (fromcomplement(bn[0], a, len) == NULL)
+		return bnerror(L, errmsg);
+
+	lua_pop(L, 1);
+
+	return 1;
+}
+
+static int
+f_band(lua_State *L)
+{
+
+	return h_bitop(L, BITOP_AND, "bn.band");
+}
+
+static int
+f_bor(lua_State *L)
+{
+
+	return h_bitop(L, BITOP_OR, "bn.bor");
+}
+
+static int
+f_bxor(lua_State *L)
+{
+
+	return h_bitop(L, BITOP_XOR, "bn.bxor");
+}
+
+static int
+f_bnot(lua_State *L)
+{
+	BIGNUM *r, *bn;
+
+	/* ~bn == -bn - 1 */
+	bn = tobignum(L, 1);
+	r = newbignum(L);
+
+	if (!BN_copy(r, bn))
+		return bnerror(L, "bn.bnot");
+
+	negatebignum(r);
+
+	if (!BN_sub_word(r, 1))
+		return bnerror(L, "bn.bnot");
+
+	return 1;
+}
+
+/*
+ * Implementation of f_lshift and f_rshift. Right shift of a negative
+ * number rounds towards minus infinity like an arithmetic shift of
+ * a two's complement number.
+ */
+static int
+h_shift(lua_State *L, int shift, const char *errmsg)
+{
+	BIGNUM *r, *bn;
+	int status;
+
+	bn = tobignum(L, 1);
+	r = newbignum(L);
+
+	if (shift >= 0) {
+		status = BN_lshift(r, bn, shift);
+	} else if (!BN_is_negative(bn)) {
+		status = BN_rshift(r, bn, -shift);
+	} else {
+		/* -((abs(bn) - 1) >> shift) - 1 */
+		status = BN_copy(r, bn) != NULL;
+		if (status) {
+			BN_set_negative(r, 0);
+			status = BN_sub_word(r, 1) &&
+			    BN_rshift(r, r, -shift) &&
+			    BN_add_word(r, 1);
+			BN_set_negative(r, 1);
+		}
+	}
+
+	if (status == 0)
+		return bnerror(L, errmsg);
+
+	return 1;
+}
+
+static int
+f_lshift(lua_State *L)
+{
+
+	return h_shift(L, checkint(L, 2), "bn.lshift");
+}
+
+static int
+f_rshift(lua_State *L)
+{
+
+	return h_shift(L, -checkint(L, 2), "bn.rshift");
+}
+
+/*
+ * Bits of a negative number are bits of its two's complement
+ * representation. Bits of abs(bn) - 1 are inverted bits of bn.
+ */
+static int
+f_testbit(lua_State *L)
+{
+	BIGNUM *bn, *t;
+	BN_CTX *ctx;
+	int n, status;
+	bool res;
+
+	bn = tobignum(L, 1);
+	n = checkint(L, 2);
+	luaL_argcheck(L, n >= 0, 2, "negative bit number");
+
+	if (!BN_is_negative(bn)) {
+		lua_pushboolean(L, BN_is_bit_set(bn, n));
+		return 1;
+	}
+
+	ctx = get_ctx_val(L);
+
+	BN_CTX_start(ctx);
+	t = BN_CTX_get(ctx);
+	status = (t != NULL && BN_copy(t, bn) != NULL);
+	if (status) {
+		BN_set_negative(t, 0);
+		status = BN_sub_word(t, 1);
+	}
+	res = status && !BN_is_bit_set(t, n);
+	BN_CTX_end(ctx);
+
+	if (status == 0)
+		return bnerror(L, "bn.testbit");
+
+	lua_pushboolean(L, res);
+
+	return 1;
+}
+
+/* Implementation of f_setbit and f_clearbit. */
+static int
+h_setbit(lua_State *L, bool set, const char *errmsg)
+{
+	BIGNUM *r, *bn;
+	int n, status;
+	bool isneg;
+
+	bn = tobignum(L, 1);
+	n = checkint(L, 2);
+	luaL_argcheck(L, n >= 0, 2, "negative bit number");
+
+	r = newbignum(L);
+
+	if (!BN_copy(r, bn))
+		return bnerror(L, errmsg);
+
+	/* Operate on abs(bn) - 1 with inverted bits if bn is negative. */
+	isneg = BN_is_negative(r);
+	if (isneg) {
+		BN_set_negative(r, 0);
+		if (!BN_sub_word(r, 1))
+			return bnerror(L, errmsg);
+		set = !set;
+	}
+
+	if (set)
+		status = BN_set_bit(r, n);
+	else
+		status = !BN_is_bit_set(r, n) || BN_clear_bit(r, n);
+
+	if (status && isneg) {
+		status = BN_add_word(r, 1);
+		BN_set_negative(r, 1);
+	}
+
+	if (status == 0)
+		return bnerror(L, errmsg);
+
+	return 1;
+}
+
+static int
+f_setbit(lua_State *L)
+{
+
+	return h_setbit(L, true, "bn.setbit");
+}
+
+static int
+f_clearbit(lua_State *L)
+{
+
+	return h_setbit(L, false, "bn.clearbit");
+}
+
+static int
+f_numbits(lua_State *L)
+{
+	BIGNUM *bn;
+
+	bn = tobignum(L, 1);
+	lua_pushinteger(L, BN_num_bits(bn));
+
+	return 1;
+}
+
+/* Number of bits set in abs(bn). */
+static int
+f_popcount(lua_State *L)
+{
+	unsigned char sbuf[128];
+	unsigned char *buf, c;
+	BIGNUM *bn;
+	lua_Integer res;
+	int i, len;
+
+	bn = tobignum(L, 1);
+	len = BN_num_bytes(bn);
+
+	buf = tmpbuf(L, sbuf, sizeof(sbuf), len);
+	len = BN_bn2bin(bn, buf);
+
+	for (i = 0, res = 0; i < len; i++) {
+		for (c = buf[i]; c != 0; c &= c - 1)
+			res++;
+	}
+
+	lua_pushinteger(L, res);
+
+	return 1;
+}
+
+/*
+ * Division rounding towards minus infinity. Note that f_div
+ * and mt_div round towards zero.
+ */
+static int
+f_idiv(lua_State *L)
+{
+	BIGNUM *bn[3]; /* bn[0] = floor(bn[1] / bn[2]) */
+	BIGNUM *rem;
+	BN_CTX *ctx;
+	int status;
+
+	bn[1] = tobignum(L, 1);
+	bn[2] = tobignum(L, 2);
+	bn[0] = newbignum(L);
+
+	ctx = get_ctx_val(L);
+
+	BN_CTX_start(ctx);
+	rem = BN_CTX_get(ctx);
+	status = (rem != NULL && BN_div(bn[0], rem, bn[1], bn[2], ctx));
+	if (status && !BN_is_zero(rem) &&
+	    BN_is_negative(rem) != BN_is_negative(bn[2])) {
+		status = BN_sub_word(bn[0], 1);
+	}
+	BN_CTX_end(ctx);
+
+	if (status == 0)
+		return bnerror(L, "bn.idiv");
+
+	return 1;
+}
+
+/*
+ * Converts elements of a table at index narg to BIGNUM objects.
+ * Pushes a buffer with n pointers to them followed by n + 1 free
+ * slots and a table which keeps converted elements alive.
+ */
+static BIGNUM **
+tobignums(lua_State *L, int narg, size_t *np)
+{
+	BIGNUM **rv;
+	size_t i, n;
+	int idx, anchor;
+
+	luaL_checktype(L, narg, LUA_TTABLE);
+	narg = absindex(L, narg);
+
+	n = lua_rawlen(L, narg);
+	rv = (BIGNUM **)lua_newuserdata(L, (2 * n + 1) * sizeof(BIGNUM *));
+	lua_newtable(L);
+	anchor = lua_gettop(L);
+
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, narg, (int)(i + 1));
+		idx = lua_gettop(L);
+
+		switch (lua_type(L, idx)) {
+			case LUA_TNUMBER:
+			case LUA_TSTRING:
+				rv[i] = tobignum(L, idx);
+				lua_rawseti(L, anchor, (int)(i + 1));
+				break;
+			case LUA_TUSERDATA:
+				if ((rv[i] = testbignum(L, idx)) != NULL) {
+					lua_pop(L, 1);
+					break;
+				}
+				rv[i] = tobignum(L, idx);
+				lua_rawseti(L, anchor, (int)(i + 1));
+				break;
+			default:
+				luaL_error(L, "element %d: number, string or "
+				    BN_METATABLE " expected, got %s",
+				    (int)(i + 1), luaL_typename(L, idx));
+				break;
+		}
+	}
+
+	*np = n;
+	return rv;
+}
+
+/*
+ * Multiplies n > 0 numbers with a balanced product tree and stores
+ * the product in r. It needs (n + 1) / 2 free slots at bn + n.
+ * Nodes are allocated with BN_new like in treebuild, so that
+ * BN_CTX doesn't keep a frame of n / 2 numbers. Returns 0 on error.
+ */
+static int
+prodtree(BIGNUM *r, BIGNUM **bn, size_t n, const struct mulparams *mp,
+    BN_CTX *ctx)
+{
+	BIGNUM **t, *tmp;
+	size_t i, m, nodes;
+	int status;
+
+	t = bn + n;
+	m = nodes = (n + 1) / 2;
+
+	for (i = 0; i < m; i++)
+		t[i] = NULL;
+
+	for (i = 0, status = 1; status && i < m; i++) {
+		if ((t[i] = BN_new()) == NULL)
+			status = 0;
+		else if (2 * i + 1 == n)
+			status = BN_copy(t[i], bn[2*i]) != NULL;
+		else
+			status = bigmul(t[i], bn[2*i], bn[2*i+1], mp, ctx);
+	}
+
+	/*
+	 * Upper levels are computed in place: t[i] has already been
+	 * consumed by the time it's overwritten.
+	 */
+	for (n = m; status && n > 1; n = m) {
+		m = (n + 1) / 2;
+		for (i = 0; status && i < m; i++) {
+			if (2 * i + 1 == n) {
+				tmp = t[i];
+				t[i] = t[2*i];
+				t[2*i] = tmp;
+			} else {
+				status = bigmul(t[i], t[2*i], t[2*i+1], mp, ctx);
+			}
+		}
+	}
+
+	if (status)
+		BN_swap(r, t[0]);
+
+	for (i = 0; i < nodes; i++)
+		BN_free(t[i]);
+
+	return status;
+}
+
+static int
+f_prod(lua_State *L)
+{
+	BIGNUM **bn, *r;
+	size_t n;
+
+	bn = tobignums(L, 1, &n);
+	r = newbignum(L);
+
+	if (n == 0)
+		return BN_one(r) ? 1 : bnerror(L, "bn.prod");
+
+	if (!prodtree(r, bn, n, get_mulparams(L), get_ctx_val(L)))
+		return bnerror(L, "bn.prod");
+
+	return 1;
+}
+
+static int
+f_sum(lua_State *L)
+{
+	BIGNUM **bn, *r;
+	size_t i, n;
+
+	bn = tobignums(L, 1, &n);
+	r = newbignum(L);
+
+	BN_zero(r);
+	for (i = 0; i < n; i++) {
+		if (!BN_add(r, r, bn[i]))
+			return bnerror(L, "bn.sum");
+	}
+
+	return 1;
+}
+
+static int
+f_dot(lua_State *L)
+{
+	BIGNUM **a, **b, *r, *mod, *t;
+	const struct mulparams *mp;
+	BN_CTX *ctx;
+	size_t i, n, nb;
+	int status;
+
+	mod = lua_isnoneornil(L, 3) ? NULL : tobignum(L, 3);
+	lua_settop(L, 3);
+	a = tobignums(L, 1, &n);
+	b = tobignums(L, 2, &nb);
+
+	luaL_argcheck(L, n == nb, 2, "tables of equal length expected");
+
+	r = newbignum(L);
+	ctx = get_ctx_val(L);
+	mp = get_mulparams(L);
+
+	BN_CTX_start(ctx);
+
+	status = ((t = BN_CTX_get(ctx)) != NULL);
+
+	BN_zero(r);
+	for (i = 0; status && i < n; i++)
+		status = bigmul(t, a[i], b[i], mp, ctx) && BN_add(r, r, t);
+
+	/* BN_nnmod() results shouldn't alias operands. */
+	if (status && mod != NULL) {
+		status = BN_nnmod(t, r, mod, ctx);
+		if (status)
+			BN_swap(r, t);
+	}
+
+	BN_CTX_end(ctx);
+
+	if (status == 0)
+		return bnerror(L, "bn.dot");
+
+	return 1;
+}
+
+/*
+ * Returns a 1-based index of the smallest (sign < 0) or the largest
+ * (sign > 0) element of a table at index 1 or 0 if it's empty.
+ */
+static size_t
+h_argext(lua_State *L, int sign)
+{
+	BIGNUM **bn;
+	size_t i, k, n;
+
+	bn = tobignums(L, 1, &n);
+
+	for (i = 1, k = 0; i < n; i++) {
+		if (BN_cmp(bn[i], bn[k]) * sign > 0)
+			k = i;
+	}
+
+	lua_pop(L, 2);
+
+	return (n > 0) ? k + 1 : 0;
+}
+
+/* Pushes element k of a table at index 1 as BN_METATABLE. */
+static void
+pushelem(lua_State *L, size_t k)
+{
+
+	lua_rawgeti(L, 1, (int)k);
+	tobignum(L, lua_gettop(L));
+}
+
+static int
+f_min(lua_State *L)
+{
+	size_t k;
+
+	if ((k = h_argext(L, -1)) == 0)
+		return 0;
+
+	pushelem(L, k);
+	return 1;
+}
+
+static int
+f_max(lua_State *L)
+{
+	size_t k;
+
+	if ((k = h_argext(L, 1)) == 0)
+		return 0;
+
+	pushelem(L, k);
+	return 1;
+}
+
+static int
+f_argmax(lua_State *L)
+{
+	size_t k;
+
+	if ((k = h_argext(L, 1)) == 0)
+		return 0;
+
+	lua_pushinteger(L, k);
+	pushelem(L, k);
+	return 2;
+}
+
+/* Element of a table sorted by bn.sort and bn.unique. */
+struct sortkey
+{
+	const BIGNUM *bn;
+	size_t idx;
+};
+
+static int
+sortkeycmp(const void *a, const void *b)
+{
+	const struct sortkey *ka = a, *kb = b;
+	int c;
+
+	if ((c = BN_cmp(ka->bn, kb->bn)) != 0)
+		return c;
+
+	/* Keep equal elements in the original order. */
+	return (ka->idx > kb->idx) - (ka->idx < kb->idx);
+}
+
+/* Same as sortkeycmp but in descending order of values. */
+static int
+sortkeycmp_desc(const void *a, const void *b)
+{
+	const struct sortkey *ka = a, *kb = b;
+	int c;
+
+	if ((c = BN_cmp(kb->bn, ka->bn)) != 0)
+		return c;
+
+	return (ka->idx > kb->idx) - (ka->idx < kb->idx);
+}
+
+/*
+ * Converts a table at index 1 and sorts it in ascending (or descending
+ * if desc is true) order with qsort. Pushes 3 values, see tobignums.
+ */
+static struct sortkey *
+sortkeys(lua_State *L, size_t *np, bool desc)
+{
+	struct sortkey *keys;
+	BIGNUM **bn;
+	size_t i, n;
+
+	bn = tobignums(L, 1, &n);
+
+	keys = (struct sortkey *)lua_newuserdata(L, n * sizeof(*keys));
+	for (i = 0; i < n; i++) {
+		keys[i].bn = bn[i];
+		keys[i].idx = i;
+	}
+
+	qsort(keys, n, sizeof(*keys), desc ? sortkeycmp_desc : sortkeycmp);
+
+	*np = n;
+	return keys;
+}
+
+static int
+f_sort(lua_State *L)
+{
+	struct sortkey *keys;
+	size_t i, n;
+	bool desc;
+
+	desc = lua_toboolean(L, 2);
+	lua_settop(L, 1);
+
+	keys = sortkeys(L, &n, desc);
+
+	/* Copy elements before they're overwritten. */
+	lua_createtable(L, n, 0);
+	for (i = 1; i <= n; i++) {
+		lua_rawgeti(L, 1, (int)i);
+		lua_rawseti(L, -2, (int)i);
+	}
+
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, -1, (int)(keys[i].idx + 1));
+		lua_rawseti(L, 1, (int)(i + 1));
+	}
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int
+f_unique(lua_State *L)
+{
+	struct sortkey *keys;
+	size_t i, m, n;
+
+	lua_settop(L, 1);
+
+	keys = sortkeys(L, &n, false);
+
+	lua_newtable(L);
+	for (i = 0, m = 0; i < n; i++) {
+		if (i > 0 && BN_cmp(keys[i].bn, keys[i - 1].bn) == 0)
+			continue;
+		lua_rawgeti(L, 1, (int)(keys[i].idx + 1));
+		lua_rawseti(L, -2, (int)++m);
+	}
+
+	return 1;
+}
+
+/*
+ * Only O(log n) elements of a sorted table are converted. Returns
+ * an index of an element equal to x or nil and an index where x
+ * should be inserted.
+ */
+static int
+f_bsearch(lua_State *L)
+{
+	BIGNUM *x, *bn;
+	size_t lo, hi, mid;
+	int c, sign;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	x = tobignum(L, 2);
+	sign = lua_toboolean(L, 3) ? -1 : 1;
+	lua_settop(L, 2);
+
+	/* The answer is in [lo, hi]. */
+	lo = 1;
+	hi = lua_rawlen(L, 1) + 1;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		lua_rawgeti(L, 1, (int)mid);
+		bn = tobignum(L, 3);
+		c = BN_cmp(bn, x) * sign;
+		lua_pop(L, 1);
+
+		if (c == 0) {
+			lua_pushinteger(L, mid);
+			return 1;
+		} else if (c < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	lua_pushnil(L);
+	lua_pushinteger(L, lo);
+	return 2;
+}
+
+/* Numbers of factors multiplied with BN_mul_word by prodrange. */
+#define PRODRANGE_LEAF 32
+
+/*
+ * Stores a product of lo..hi in r using a balanced tree.
+ * Returns 0 on error.
+ */
+static int
+prodrange(BIGNUM *r, BN_ULONG lo, BN_ULONG hi,
+    const struct mulparams *mp, BN_CTX *ctx)
+{
+	BIGNUM *t;
+	BN_ULONG mid;
+	int status;
+
+	if (lo > hi)
+		return BN_one(r);
+
+	if (hi - lo < PRODRANGE_LEAF) {
+		if (!BN_set_word(r, lo))
+			return 0;
+		while (lo < hi) {
+			if (!BN_mul_word(r, ++lo))
+				return 0;
+		}
+		return 1;
+	}
+
+	mid = lo + (hi - lo) / 2;
+
+	BN_CTX_start(ctx);
+
+	status = (t = BN_CTX_get(ctx)) != NULL &&
+	    prodrange(r, lo, mid, mp, ctx) &&
+	    prodrange(t, mid + 1, hi, mp, ctx) &&
+	    bigmul(r, r, t, mp, ctx);
+
+	BN_CTX_end(ctx);
+
+	return status;
+}
+
+static BN_ULONG
+checkword(lua_State *L, int narg)
+{
+	lua_Integer n;
+
+	n = luaL_checkinteger(L, narg);
+	luaL_argcheck(L, n >= 0 && (lua_Integer)(BN_ULONG)n == n, narg,
+	    "out of range");
+
+	return (BN_ULONG)n;
+}
+
+static int
+f_factorial(lua_State *L)
+{
+	BIGNUM *r;
+	BN_CTX *ctx;
+	BN_ULONG n;
+
+	n = checkword(L, 1);
+	r = newbignum(L);
+
+	ctx = get_ctx_val(L);
+
+	if (!prodrange(r, 1, n, get_mulparams(L), ctx))
+		return bnerror(L, "bn.factorial");
+
+	return 1;
+}
+
+static int
+f_binomial(lua_State *L)
+{
+	BIGNUM *r, *p, *t;
+	BN_CTX *ctx;
+	BN_ULONG n, k;
+	int status;
+
+	n = checkword(L, 1);
+	k = checkword(L, 2);
+	r = newbignum(L);
+
+	if (k > n) {
+		BN_zero(r);
+		return 1;
+	}
+
+	if (k > n - k)
+		k = n - k;
+
+	ctx = get_ctx_val(L);
+
+	BN_CTX_start(ctx);
+
+	p = BN_CTX_get(ctx);
+	t = BN_CTX_get(ctx);
+
+	/* See h_div() why the quotient isn't stored in p. */
+	status = (t != NULL) &&
+	    prodrange(p, n - k + 1, n, get_mulparams(L), ctx) &&
+	    prodrange(t, 1, k, get_mulparams(L), ctx) &&
+	    BN_div(r, NULL, p, t, ctx);
+
+	BN_CTX_end(ctx);
+
+	if (status == 0)
+		return bnerror(L, "bn.binomial");
+
+	return 1;
+}
+
+/* Maximal height of a product tree. */
+#define TREE_MAXHEIGHT 64
+
+/*
+ * Product tree stored level by level, leaves first. Level l has cnt[l]
+ * nodes starting at node[off[l]], the root is at level height. A tree
+ * with n leaves needs TREESIZE(n) slots.
+ */
+struct bntree
+{
+	BIGNUM **node;
+	size_t cnt[TREE_MAXHEIGHT];
+	size_t off[TREE_MAXHEIGHT];
+	int height;
+};
+
+#define TREESIZE(n) (2 * (n) + TREE_MAXHEIGHT)
+#define TREEROOT(t) ((t)->node[(t)->off[(t)->height]])
+
+/*
+ * Builds upper levels of a tree with n leaves in t->node. Inner nodes
+ * are allocated with BN_new and must be freed with treefree even if
+ * the function fails.
+ */
+static int
+treebuild(struct bntree *t, size_t n, const struct mulparams *mp,
+    BN_CTX *ctx)
+{
+	BIGNUM **c, **p;
+	size_t i;
+	int h, status;
+
+	t->cnt[0] = n;
+	t->off[0] = 0;
+
+	for (h = 0, status = 1; status && t->cnt[h] > 1; h++) {
+		t->off[h + 1] = t->off[h] + t->cnt[h];
+		t->cnt[h + 1] = (t->cnt[h] + 1) / 2;
+
+		for (i = 0; status && i < t->cnt[h + 1]; i++) {
+			c = t->node + t->off[h] + 2 * i;
+			p = t->node + t->off[h + 1] + i;
+
+			if ((*p = BN_new()) == NULL)
+				status = 0;
+			else if (2 * i + 1 == t->cnt[h])
+				status = BN_copy(*p, c[0]) != NULL;
+			else
+				status = bigmul(*p, c[0], c[1], mp, ctx);
+		}
+	}
+
+	t->height = h;
+
+	return status;
+}
+
+/* Frees inner nodes of a tree with n leaves. */
+static void
+treefree(struct bntree *t, size_t n)
+{
+	size_t i;
+
+	for (i = n; i < TREESIZE(n); i++) {
+		BN_free(t->node[i]);
+		t->node[i] = NULL;
+	}
+}
+
+/*
+ * Remainder tree: reduces nonnegative x modulo every node (or a square
+ * of every node if sq is set) from the root down to the leaves. rem
+ * must have 2 * n NULL slots, leaf remainders are returned in *res.
+ * All slots of rem must be freed by the caller even on failure.
+ */
+static int
+treerem(const struct bntree *t, const BIGNUM *x, bool sq, BIGNUM **rem,
+    BIGNUM ***res, const struct mulparams *mp, BN_CTX *ctx)
+{
+	BIGNUM **cur, **next, **tmp, *c, *m;
+	const BIGNUM *a;
+	size_t i, n;
+	int bits, h, status;
+
+	n = t->cnt[0];
+	cur = rem;
+	next = rem + n;
+
+	BN_CTX_start(ctx);
+
+	m = BN_CTX_get(ctx);
+	status = (m != NULL);
+
+	for (h = t->height + 1; status && h > 0; h--) {
+		for (i = 0; status && i < t->cnt[h - 1]; i++) {
+			c = t->node[t->off[h - 1] + i];
+			a = (h > t->height) ? x : cur[i / 2];
+			bits = BN_num_bits(c);
+
+			if ((next[i] = BN_new()) == NULL)
+				status = 0;
+			else if (BN_num_bits(a) < (sq ? 2 * bits - 1 : bits))
+				status = BN_copy(next[i], a) != NULL;
+			else
+				status = (!sq || bigmul(m, c, c, mp, ctx)) &&
+				    bigmod(next[i], a, sq ? m : c, mp, ctx);
+		}
+
+		for (i = 0; h <= t->height && i < t->cnt[h]; i++) {
+			BN_free(cur[i]);
+			cur[i] = NULL;
+		}
+
+		tmp = cur;
+		cur = next;
+		next = tmp;
+	}
+
+	BN_CTX_end(ctx);
+
+	*res = cur;
+
+	return status;
+}
+
+/*
+ * Bernstein's batch gcd: g[i] = gcd(bn[i], prod(bn) / bn[i]) computed
+ * with a product tree and a remainder tree of prod(bn) modulo squares
+ * of the nodes. All numbers must be positive.
+ */
+static int
+batchgcd(BIGNUM **g, BIGNUM **bn, size_t n, struct bntree *t, BIGNUM **rem,
+    const struct mulparams *mp, BN_CTX *ctx)
+{
+	BIGNUM **r, *q;
+	size_t i;
+	int status;
+
+	memcpy(t->node, bn, n * sizeof(BIGNUM *));
+
+	status = treebuild(t, n, mp, ctx) &&
+	    treerem(t, TREEROOT(t), true, rem, &r, mp, ctx);
+
+	BN_CTX_start(ctx);
+
+	q = BN_CTX_get(ctx);
+	status = status && (q != NULL);
+
+	for (i = 0; status && i < n; i++) {
+		status = BN_div(q, NULL, r[i], bn[i], ctx) &&
+		    BN_gcd(g[i], q, bn[i], ctx);
+	}
+
+	BN_CTX_end(ctx);
+
+	return status;
+}
+
+static int
+f_batchgcd(lua_State *L)
+{
+	struct bntree t;
+	BIGNUM **bn, **g, **rem;
+	size_t i, n, size;
+	int status;
+
+	bn = tobignums(L, 1, &n);
+
+	for (i = 0; i < n; i++) {
+		if (BN_is_negative(bn[i]) || BN_is_zero(bn[i]))
+			return luaL_error(L, "element %d: positive number "
+			    "expected", (int)(i + 1));
+	}
+
+	size = (3 * n + TREESIZE(n)) * sizeof(BIGNUM *);
+	g = (BIGNUM **)lua_newuserdata(L, size);
+	memset(g, 0, size);
+	t.node = g + n;
+	rem = t.node + TREESIZE(n);
+
+	lua_createtable(L, n, 0);
+	for (i = 0; i < n; i++) {
+		g[i] = newbignum(L);
+		lua_rawseti(L, -2, (int)(i + 1));
+	}
+
+	if (n == 0)
+		return 1;
+
+	status = batchgcd(g, bn, n, &t, rem,
+	    get_mulparams(L), get_ctx_val(L));
+
+	treefree(&t, n);
+	for (i = 0; i < 2 * n; i++)
+		BN_free(rem[i]);
+
+	if (status == 0)
+		return bnerror(L, "bn.batchgcd");
+
+	return 1;
+}
+
+/*
+ * Context of Chinese remainder reconstruction. Leaves of the product
+ * tree are copies of the moduli m[i], inv[i] = (M / m[i])^-1 mod m[i]
+ * where M is the product of all moduli.
+ */
+struct crtctx
+{
+	struct bntree tree;
+	BIGNUM **inv;
+	size_t n;
+};
+
+static struct crtctx *
+checkcrtctx(lua_State *L, int narg)
+{
+
+	return (struct crtctx *)luaL_checkudata(L, narg, CRT_METATABLE);
+}
+
+static int
+gccrtctx(lua_State *L)
+{
+	struct crtctx *c;
+	size_t i;
+
+	c = checkcrtctx(L, 1);
+
+	for (i = 0; i < TREESIZE(c->n); i++) {
+		BN_free(c->tree.node[i]);
+		c->tree.node[i] = NULL;
+	}
+
+	for (i = 0; i < c->n; i++) {
+		BN_free(c->inv[i]);
+		c->inv[i] = NULL;
+	}
+
+	return 0;
+}
+
+/* Computes c->inv with a remainder tree of M modulo squares of nodes. */
+static int
+crtinit(struct crtctx *c, BIGNUM **rem, bool *coprime,
+    const struct mulparams *mp, BN_CTX *ctx)
+{
+	BIGNUM **m, **r, *q;
+	size_t i;
+	int status;
+
+	m = c->tree.node;
+	*coprime = true;
+
+	status = treebuild(&c->tree, c->n, mp, ctx) &&
+	    treerem(&c->tree, TREEROOT(&c->tree), true, rem, &r, mp, ctx);
+
+	BN_CTX_start(ctx);
+
+	q = BN_CTX_get(ctx);
+	status = status && (q != NULL);
+
+	/* q = (M / m[i]) mod m[i] */
+	for (i = 0; status && *coprime && i < c->n; i++) {
+		status = (c->inv[i] = BN_new()) != NULL &&
+		    BN_div(q, NULL, r[i], m[i], ctx);
+		if (status && BN_is_one(m[i]))
+			BN_zero(c->inv[i]);
+		else if (status && !BN_mod_inverse(c->inv[i], q, m[i], ctx))
+			*coprime = false;
+	}
+
+	BN_CTX_end(ctx);
+
+	return status;
+}
+
+static int
+f_crtctx(lua_State *L)
+{
+	struct crtctx *c;
+	BIGNUM **bn, **rem;
+	size_t i, n, size;
+	int status;
+	bool coprime;
+
+	bn = tobignums(L, 1, &n);
+	luaL_argcheck(L, n > 0, 1, "empty table");
+
+	for (i = 0; i < n; i++) {
+		if (BN_is_negative(bn[i]) || BN_is_zero(bn[i]))
+			return luaL_error(L, "element %d: positive number "
+			    "expected", (int)(i + 1));
+	}
+
+	size = sizeof(struct crtctx) + (TREESIZE(n) + n) * sizeof(BIGNUM *);
+	c = (struct crtctx *)lua_newuserdata(L, size);
+	memset(c, 0, size);
+	c->tree.node = (BIGNUM **)(c + 1);
+	c->inv = c->tree.node + TREESIZE(n);
+	c->n = n;
+
+	luaL_getmetatable(L, CRT_METATABLE);
+	lua_setmetatable(L, -2);
+
+	size = 2 * n * sizeof(BIGNUM *);
+	rem = (BIGNUM **)lua_newuserdata(L, size);
+	memset(rem, 0, size);
+
+	for (i = 0, status = 1; status && i < n; i++)
+		status = (c->tree.node[i] = BN_dup(bn[i])) != NULL;
+
+	coprime = true;
+	status = status && crtinit(c, rem, &coprime,
+	    get_mulparams(L), get_ctx_val(L));
+
+	for (i = 0; i < 2 * n; i++)
+		BN_free(rem[i]);
+
+	if (status && !coprime) {
+		ERR_clear_error();
+		return luaL_error(L, "moduli are not pairwise coprime");
+	} else if (status == 0) {
+		return bnerror(L, "bn.crtctx");
+	}
+
+	lua_pop(L, 1);
+	return 1;
+}
+
+/*
+ * Combines residues bottom-up: a node gets l * M_r + r * M_l where l
+ * and r are values of its children and M_l and M_r are their moduli.
+ * Leaf values are r[i] * inv[i] mod m[i].
+ */
+static int
+crtcombine(BIGNUM *x, const struct crtctx *c, BIGNUM **res, BIGNUM **v,
+    const struct mulparams *mp, BN_CTX *ctx)
+{
+	const struct bntree *t;
+	BIGNUM **cur, **next, **tmp, **node, *p;
+	size_t i;
+	int h, status;
+
+	t = &c->tree;
+	cur = v;
+	next = v + c->n;
+
+	BN_CTX_start(ctx);
+
+	p = BN_CTX_get(ctx);
+	status = (p != NULL);
+
+	for (i = 0; status && i < c->n; i++) {
+		status = (cur[i] = BN_new()) != NULL &&
+		    BN_nnmod(cur[i], res[i], t->node[i], ctx) &&
+		    BN_mod_mul(cur[i], cur[i], c->inv[i], t->node[i], ctx);
+	}
+
+	for (h = 0; status && h < t->height; h++) {
+		node = t->node + t->off[h];
+
+		for (i = 0; status && i < t->cnt[h + 1]; i++) {
+			if (2 * i + 1 == t->cnt[h]) {
+				next[i] = cur[2 * i];
+				cur[2 * i] = NULL;
+				continue;
+			}
+
+			status = (next[i] = BN_new()) != NULL &&
+			    bigmul(next[i], cur[2 * i], node[2 * i + 1],
+			    mp, ctx) &&
+			    bigmul(p, cur[2 * i + 1], node[2 * i], mp, ctx) &&
+			    BN_add(next[i], next[i], p);
+		}
+
+		for (i = 0; i < t->cnt[h]; i++) {
+			BN_free(cur[i]);
+			cur[i] = NULL;
+		}
+
+		tmp = cur;
+		cur = next;
+		next = tmp;
+	}
+
+	BN_CTX_end(ctx);
+
+	return status && bigmod(x, cur[0], TREEROOT(t), mp, ctx);
+}
+
+static int
+m_crt_combine(lua_State *L)
+{
+	struct crtctx *c;
+	BIGNUM **bn, **v, *x;
+	size_t i, n, size;
+	int status;
+
+	c = checkcrtctx(L, 1);
+	bn = tobignums(L, 2, &n);
+	luaL_argcheck(L, n == c->n, 2, "wrong number of residues");
+
+	size = 2 * n * sizeof(BIGNUM *);
+	v = (BIGNUM **)lua_newuserdata(L, size);
+	memset(v, 0, size);
+
+	x = newbignum(L);
+
+	status = crtcombine(x, c, bn, v, get_mulparams(L), get_ctx_val(L));
+
+	for (i = 0; i < 2 * n; i++)
+		BN_free(v[i]);
+
+	if (status == 0)
+		return bnerror(L, "bn.crtctx:combine");
+
+	return 1;
+}
+
+static int
+m_crt_split(lua_State *L)
+{
+	struct crtctx *c;
+	BIGNUM **r, **rem, **res, *a, *x;
+	size_t i, size;
+	int status;
+	bool isneg;
+
+	c = checkcrtctx(L, 1);
+	x = tobignum(L, 2);
+
+	isneg = BN_is_negative(x);
+	if (isneg) {
+		a = newbignum(L);
+		if (!BN_copy(a, x))
+			return bnerror(L, "bn.crtctx:split");
+		BN_set_negative(a, 0);
+		x = a;
+	}
+
+	size = 3 * c->n * sizeof(BIGNUM *);
+	res = (BIGNUM **)lua_newuserdata(L, size);
+	memset(res, 0, size);
+	rem = res + c->n;
+
+	lua_createtable(L, c->n, 0);
+	for (i = 0; i < c->n; i++) {
+		res[i] = newbignum(L);
+		lua_rawseti(L, -2, (int)(i + 1));
+	}
+
+	status = treerem(&c->tree, x, false, rem, &r,
+	    get_mulparams(L), get_ctx_val(L));
+
+	for (i = 0; status && i < c->n; i++) {
+		BN_swap(res[i], r[i]);
+		if (isneg && !BN_is_zero(res[i]))
+			status = BN_sub(res[i], c->tree.node[i], res[i]);
+	}
+
+	for (i = 0; i < 2 * c->n; i++)
+		BN_free(rem[i]);
+
+	if (status == 0)
+		return bnerror(L, "bn.crtctx:split");
+
+	return 1;
+}
+
+static int
+m_crt_modulus(lua_State *L)
+{
+	struct crtctx *c;
+	BIGNUM *r;
+
+	c = checkcrtctx(L, 1);
+	r = newbignum(L);
+
+	if (!BN_copy(r, TREEROOT(&c->tree)))
+		return bnerror(L, "bn.crtctx:modulus");
+
+	return 1;
+}
+
+static int
+f_jacobi_many(lua_State *L)
+{
+	BIGNUM **bn, *n;
+	BN_CTX *ctx;
+	size_t i, len;
+	int j;
+
+	n = checkjacobin(L, 2);
+	bn = tobignums(L, 1, &len);
+
+	ctx = get_ctx_val(L);
+
+	lua_createtable(L, len, 0);
+	for (i = 0; i < len; i++) {
+		if ((j = jacobi(bn[i], n, ctx)) == -2)
+			return bnerror(L, "bn.jacobi_many");
+		lua_pushinteger(L, j);
+		lua_rawseti(L, -2, (int)(i + 1));
+	}
+
+	return 1;
+}
+
+/*
+ * Lazy expressions. bn.lazy(a) wraps a in a table { LAZY_LEAF, a }
+ * with LAZY_METATABLE. Arithmetic with such tables builds a graph of
+ * tables { op, x, y } where x and y are lazy expressions or operands
+ * as they were passed, and e:eval() computes its value. Intermediate
+ * results are new bn.number objects which aren't visible to Lua, so
+ * the next operation writes its result to one of them instead of
+ * creating another object. x * y % m and x ^ y % m are computed with
+ * BN_mod_mul() and BN_mod_exp() without a full-size product or power.
+ */
+#define LAZY_MAXDEPTH 4096
+
+static bool
+testlazy(lua_State *L, int narg)
+{
+	bool rv;
+
+	if (lua_type(L, narg) != LUA_TTABLE || !lua_getmetatable(L, narg))
+		return false;
+
+	rv = lua_rawequal(L, -1, LAZY_MT_UPVALUE);
+	lua_pop(L, 1);
+
+	return rv;
+}
+
+static enum lazyop
+lazyopof(lua_State *L, int narg)
+{
+	enum lazyop op;
+
+	lua_rawgeti(L, narg, 1);
+	op = (enum lazyop)lua_tointeger(L, -1);
+	lua_pop(L, 1);
+
+	return op;
+}
+
+static void
+checklazyoperand(lua_State *L, int narg)
+{
+
+	switch (lua_type(L, narg)) {
+		case LUA_TNUMBER:
+		case LUA_TSTRING:
+			return;
+		case LUA_TUSERDATA:
+			if (testbignum(L, narg) != NULL ||
+			    fixedtypeof(L, narg) != NULL)
+				return;
+			break;
+		case LUA_TTABLE:
+			if (testlazy(L, narg))
+				return;
+			break;
+	}
+
+	typerror(L, narg, "number, string, " BN_METATABLE " or "
+	    LAZY_METATABLE);
+}
+
+/* Pushes a new node op(x, y), y is 0 for unary nodes. */
+static void
+newlazy(lua_State *L, enum lazyop op, int x, int y)
+{
+
+	lua_createtable(L, 3, 0);
+	lua_pushinteger(L, op);
+	lua_rawseti(L, -2, 1);
+	lua_pushvalue(L, x);
+	lua_rawseti(L, -2, 2);
+	if (y != 0) {
+		lua_pushvalue(L, y);
+		lua_rawseti(L, -2, 3);
+	}
+
+	lua_pushvalue(L, LAZY_MT_UPVALUE);
+	lua_setmetatable(L, -2);
+}
+
+/* Arithmetic metamethod with operands at index 1 and 2. */
+static int
+lazyarith(lua_State *L, enum lazyop op)
+{
+
+	checklazyoperand(L, 1);
+	if (op != LAZY_UNM)
+		checklazyoperand(L, 2);
+
+	newlazy(L, op, 1, (op != LAZY_UNM) ? 2 : 0);
+
+	return 1;
+}
+
+static void lazyeval(lua_State *, int, enum lazyop, int);
+
+/*
+ * Pushes a value of operand i of a node at index narg. Expressions
+ * are evaluated to a new bn.number and *owned is set, other values
+ * are pushed as they are.
+ */
+static void
+lazyval(lua_State *L, int narg, int i, bool *owned, int depth)
+{
+	enum lazyop op;
+
+	lua_rawgeti(L, narg, i);
+	*owned = false;
+
+	if (!testlazy(L, -1))
+		return;
+
+	op = lazyopof(L, -1);
+	if (op == LAZY_LEAF) {
+		lua_rawgeti(L, -1, 2);
+	} else {
+		lazyeval(L, lua_gettop(L), op, depth + 1);
+		*owned = true;
+	}
+
+	lua_remove(L, -2);
+}
+
+/* Same as lazyval() but it converts the value to bn.number. */
+static BIGNUM *
+lazybn(lua_State *L, int narg, int i, bool *owned, int depth)
+{
+
+	lazyval(L, narg, i, owned, depth);
+
+	/* tobignum() replaces numbers and strings with new objects. */
+	if (!*owned && testbignum(L, -1) == NULL)
+		*owned = true;
+
+	return tobignum(L, lua_gettop(L));
+}
+
+/* Read-only alias of abs(a) sharing its limbs. */
+static inline void
+absview(BIGNUM *r, const BIGNUM *a)
+{
+
+	*r = *a;
+	r->neg = 0;
+	r->flags |= BN_FLG_STATIC_DATA;
+}
+
+/*
+ * Fused kernels of x % m where x is x1 * x2 or x1 ^ x2 at index narg.
+ * Like other bn.number operations, the result has a sign of x.
+ * Returns false and doesn't push anything if x is something else.
+ */
+static bool
+lazymodfused(lua_State *L, int narg, int depth)
+{
+	BIGNUM *bn[4]; /* bn[0] = bn[1] * bn[2] or bn[1] ^ bn[2] % bn[3] */
+	BIGNUM a, e, m;
+	BN_CTX *ctx;
+	enum lazyop op;
+	bool owned, isneg;
+	int top, status;
+
+	top = lua_gettop(L);
+
+	lua_rawgeti(L, narg, 2);
+	op = testlazy(L, -1) ? lazyopof(L, -1) : LAZY_LEAF;
+	if (op != LAZY_MUL && op != LAZY_POW) {
+		lua_pop(L, 1);
+		return false;
+	}
+
+	bn[1] = lazybn(L, top + 1, 2, &owned, depth + 1);
+	bn[2] = lazybn(L, top + 1, 3, &owned, depth + 1);
+	bn[3] = lazybn(L, narg, 3, &owned, depth);
+	bn[0] = newbignum(L);
+
+	if (BN_is_zero(bn[3]))
+		return luaL_error(L, "bn.lazy: division by zero");
+
+	if (op == LAZY_MUL)
+		isneg = BN_is_negative(bn[1]) != BN_is_negative(bn[2]);
+	else
+		isneg = BN_is_negative(bn[1]) && BN_is_odd(bn[2]);
+
+	absview(&a, bn[1]);
+	absview(&e, bn[2]);
+	absview(&m, bn[3]);
+
+	ctx = get_ctx_val(L);
+	if (op == LAZY_MUL)
+		status = BN_mod_mul(bn[0], &a, &e, &m, ctx);
+	else
+		status = BN_mod_exp(bn[0], &a, &e, &m, ctx);
+
+	if (status == 0)
+		bnerror(L, "bn.lazy");
+
+	if (isneg && !BN_is_zero(bn[0]))
+		BN_set_negative(bn[0], 1);
+
+	lua_replace(L, top + 1);
+	lua_settop(L, top + 1);
+
+	return true;
+}
+
+/* Evaluates a node op(x, y) at index narg and pushes its value. */
+static void
+lazyeval(lua_State *L, int narg, enum lazyop op, int depth)
+{
+	BIGNUM *bn[3], *t; /* bn[0] = bn[1] op bn[2] */
+	BN_CTX *ctx;
+	bool owned[3];
+	int top, status;
+
+	if (depth > LAZY_MAXDEPTH)
+		luaL_error(L, "bn.lazy: expression is too deep");
+	luaL_checkstack(L, LUA_MINSTACK, "bn.lazy: expression is too deep");
+
+	/* __pow of bn.number has fast paths for Lua numbers. */
+	if (op == LAZY_POW) {
+		lua_getfield(L, BN_MT_UPVALUE, "__pow");
+		lazyval(L, narg, 2, &owned[1], depth);
+		lazyval(L, narg, 3, &owned[2], depth);
+		lua_call(L, 2, 1);
+		return;
+	}
+
+	if (op == LAZY_MOD && lazymodfused(L, narg, depth))
+		return;
+
+	top = lua_gettop(L);
+
+	bn[1] = lazybn(L, narg, 2, &owned[1], depth);
+	bn[2] = NULL;
+	owned[2] = false;
+	if (op != LAZY_UNM)
+		bn[2] = lazybn(L, narg, 3, &owned[2], depth);
+
+	/* Write the result to a temporary operand if there is one. */
+	if (owned[1]) {
+		bn[0] = bn[1];
+		lua_pushvalue(L, top + 1);
+	} else if (owned[2]) {
+		bn[0] = bn[2];
+		lua_pushvalue(L, top + 2);
+	} else {
+		bn[0] = newbignum(L);
+	}
+
+	ctx = get_ctx_val(L);
+
+	switch (op) {
+		case LAZY_ADD:
+			status = BN_add(bn[0], bn[1], bn[2]);
+			break;
+		case LAZY_SUB:
+			status = BN_sub(bn[0], bn[1], bn[2]);
+			break;
+		case LAZY_MUL:
+			status = bigmul(bn[0], bn[1], bn[2],
+			    get_mulparams(L), ctx);
+			break;
+		case LAZY_DIV:
+		case LAZY_MOD:
+			/* BN_div() may not write to an operand, see mt_mod(). */
+			BN_CTX_start(ctx);
+			status = (t = BN_CTX_get(ctx)) != NULL && (op == LAZY_DIV ?
+			    BN_div(t, NULL, bn[1], bn[2], ctx) :
+			    BN_div(NULL, t, bn[1], bn[2], ctx));
+			if (status != 0)
+				BN_swap(bn[0], t);
+			BN_CTX_end(ctx);
+			break;
+		case LAZY_UNM:
+			status = (BN_copy(bn[0], bn[1]) != NULL);
+			if (status != 0)
+				negatebignum(bn[0]);
+			break;
+		default:
+			status = 0;
+			break;
+	}
+
+	if (status == 0)
+		bnerror(L, "bn.lazy");
+
+	lua_replace(L, top + 1);
+	lua_settop(L, top + 1);
+}
+
+static int
+f_lazy(lua_State *L)
+{
+
+	if (testlazy(L, 1)) {
+		lua_settop(L, 1);
+		return 1;
+	}
+
+	checklazyoperand(L, 1);
+	newlazy(L, LAZY_LEAF, 1, 0);
+
+	return 1;
+}
+
+static int
+m_lazy_eval(lua_State *L)
+{
+	enum lazyop op;
+
+	if (!testlazy(L, 1))
+		return typerror(L, 1, LAZY_METATABLE);
+
+	op = lazyopof(L, 1);
+	if (op == LAZY_LEAF) {
+		lua_rawgeti(L, 1, 2);
+		tobignum(L, lua_gettop(L));
+	} else {
+		lazyeval(L, 1, op, 0);
+	}
+
+	return 1;
+}
+
+static int
+mt_lazy_tostring(lua_State *L)
+{
+
+	lua_getfield(L, BN_MT_UPVALUE, "__tostring");
+	m_lazy_eval(L);
+	lua_call(L, 1, 1);
+
+	return 1;
+}
+
+static int
+mt_lazy_add(lua_State *L)
+{
+
+	return lazyarith(L, LAZY_ADD);
+}
+
+static int
+mt_lazy_sub(lua_State *L)
+{
+
+	return lazyarith(L, LAZY_SUB);
+}
+
+static int
+mt_lazy_mul(lua_State *L)
+{
+
+	return lazyarith(L, LAZY_MUL);
+}
+
+static int
+mt_lazy_div(lua_State *L)
+{
+
+	return lazyarith(L, LAZY_DIV);
+}
+
+static int
+mt_lazy_mod(lua_State *L)
+{
+
+	return lazyarith(L, LAZY_MOD);
+}
+
+static int
+mt_lazy_pow(lua_State *L)
+{
+
+	return lazyarith(L, LAZY_POW);
+}
+
+static int
+mt_lazy_unm(lua_State *L)
+{
+
+	return lazyarith(L, LAZY_UNM);
+}
+
+/*
+ * Rational numbers. A bn.rational object stores a numerator and
+ * a positive denominator. Results of arithmetic aren't reduced to
+ * lowest terms until they grow more than twice since the last
+ * reduction or until r:num(), r:den() or tostring(r) is called, so
+ * most operations don't pay for gcd. Products cancel common factors
+ * of a numerator of one operand and a denominator of the other one,
+ * results of reduced operands are reduced.
+ */
+#define RAT_SLACK 64
+
+struct rational
+{
+	BIGNUM num;
+	BIGNUM den;
+
+	/* Same as in struct BN. */
+	char *str;
+
+	/* Size of num and den after the last reduction, see ratreduce(). */
+	int rbits;
+
+	/* True if gcd(num, den) is 1. */
+	bool reduced;
+};
+
+/* Read-only view of an operand of rational arithmetic. */
+struct ratio
+{
+	const BIGNUM *num;
+	const BIGNUM *den;
+	int rbits;
+	bool reduced;
+};
+
+static bool
+testrational(lua_State *L, int narg)
+{
+	bool rv;
+
+	if (lua_type(L, narg) != LUA_TUSERDATA || !lua_getmetatable(L, narg))
+		return false;
+
+	rv = lua_rawequal(L, -1, RAT_MT_UPVALUE);
+	lua_pop(L, 1);
+
+	return rv;
+}
+
+static struct rational *
+checkrational(lua_State *L, int narg)
+{
+
+	if (!testrational(L, narg))
+		typerror(L, narg, RAT_METATABLE);
+
+	return (struct rational *)lua_touserdata(L, narg);
+}
+
+static struct rational *
+newrational(lua_State *L)
+{
+	struct rational *r;
+
+	r = (struct rational *)lua_newuserdata(L, sizeof(struct rational));
+	BN_init(&r->num);
+	BN_init(&r->den);
+	r->str = NULL;
+	r->rbits = 0;
+	r->reduced = false;
+
+	lua_pushvalue(L, RAT_MT_UPVALUE);
+	lua_setmetatable(L, -2);
+
+	return r;
+}
+
+/*
+ * Replaces a non-integral Lua number at narg with an equal bn.rational,
+ * an odd numerator over a power of two. Returns false if the number
+ * is integral. Infinities and NaN raise an error.
+ */
+static bool
+floattorational(lua_State *L, int narg)
+{
+	struct rational *r;
+	lua_Number d;
+	bool isneg;
+	int k;
+
+#if LUA_VERSION_NUM >= 503
+	if (lua_isinteger(L, narg))
+		return false;
+#endif
+
+	d = lua_tonumber(L, narg);
+	if (d - d != 0)
+		luaL_argerror(L, narg, "finite number expected");
+
+	isneg = (d < 0);
+	if (isneg)
+		d = -d;
+
+	/* Numbers with 53 or more integral bits are integral. */
+	if (d >= 9007199254740992.0 || d == (lua_Number)(uint64_t)d)
+		return false;
+
+	/* Doubling is exact, it stops before d has more than 53 bits. */
+	for (k = 0; d != (lua_Number)(uint64_t)d; k++)
+		d *= 2;
+
+	r = newrational(L);
+	if (!setumax(&r->num, (uint64_t)d) || !BN_set_bit(&r->den, k))
+		bnerror(L, "bn.rational");
+	BN_set_negative(&r->num, isneg);
+	r->reduced = true;
+	r->rbits = BN_num_bits(&r->num) + k + 1;
+
+	lua_replace(L, narg);
+	return true;
+}
+
+/*
+ * Sets a view of an operand at index narg. Non-integral Lua numbers
+ * are converted exactly with floattorational(). Other values except
+ * bn.rational are converted with tobignum() and their denominator is 1.
+ */
+static void
+toratio(lua_State *L, int narg, struct ratio *x)
+{
+	struct rational *r;
+
+	if (testrational(L, narg) || (lua_type(L, narg) == LUA_TNUMBER &&
+	    floattorational(L, narg))) {
+		r = (struct rational *)lua_touserdata(L, narg);
+		x->num = &r->num;
+		x->den = &r->den;
+		x->rbits = r->rbits;
+		x->reduced = r->reduced;
+	} else {
+		x->num = tobignum(L, narg);
+		x->den = BN_value_one();
+		x->rbits = BN_num_bits(x->num) + 1;
+		x->reduced = true;
+	}
+}
+
+/*
+ * Divides r by gcd of its numerator and denominator if force is set
+ * or if r has grown more than twice since the last reduction.
+ */
+static int
+ratreduce(struct rational *r, bool force, BN_CTX *ctx)
+{
+	BIGNUM *g, *t;
+	int bits, status;
+
+	bits = BN_num_bits(&r->num) + BN_num_bits(&r->den);
+
+	if (!r->reduced && BN_is_one(&r->den))
+		r->reduced = true;
+
+	if (r->reduced || (!force && bits <= 2 * r->rbits + RAT_SLACK)) {
+		if (r->reduced)
+			r->rbits = bits;
+		return 1;
+	}
+
+	BN_CTX_start(ctx);
+
+	status = (g = BN_CTX_get(ctx)) != NULL &&
+	    (t = BN_CTX_get(ctx)) != NULL &&
+	    lehmergcd(g, &r->num, &r->den, ctx);
+
+	/* BN_div() may not write to an operand, see mt_mod(). */
+	if (status && !BN_is_one(g)) {
+		status = BN_div(t, NULL, &r->num, g, ctx);
+		if (status) {
+			BN_swap(&r->num, t);
+			status = BN_div(t, NULL, &r->den, g, ctx);
+		}
+		if (status)
+			BN_swap(&r->den, t);
+	}
+
+	BN_CTX_end(ctx);
+
+	if (status) {
+		r->reduced = true;
+		r->rbits = BN_num_bits(&r->num) + BN_num_bits(&r->den);
+	}
+
+	return status;
+}
+
+/*
+ * Replaces *pa and *pd with a / g and d / g where g = gcd(a, d).
+ * Quotients are BN_CTX temporaries of the caller's frame.
+ */
+static int
+ratcancel(const BIGNUM **pa, const BIGNUM **pd, BN_CTX *ctx)
+{
+	BIGNUM *g, *a, *d;
+
+	if (BN_is_one(*pd) || BN_is_one(*pa))
+		return 1;
+
+	if ((g = BN_CTX_get(ctx)) == NULL || !lehmergcd(g, *pa, *pd, ctx))
+		return 0;
+
+	if (BN_is_one(g))
+		return 1;
+
+	if ((a = BN_CTX_get(ctx)) == NULL || (d = BN_CTX_get(ctx)) == NULL ||
+	    !BN_div(a, NULL, *pa, g, ctx) || !BN_div(d, NULL, *pd, g, ctx))
+		return 0;
+
+	*pa = a;
+	*pd = d;
+
+	return 1;
+}
+
+/* r = x * y with cross-cancellation. */
+static int
+ratmul(struct rational *r, const struct ratio *x, const struct ratio *y,
+    const struct mulparams *mp, BN_CTX *ctx)
+{
+	const BIGNUM *a, *b, *c, *d; /* (a / b) * (c / d) */
+	int status;
+
+	if (BN_is_zero(x->num) || BN_is_zero(y->num)) {
+		BN_zero(&r->num);
+		r->reduced = true;
+		return BN_one(&r->den);
+	}
+
+	a = x->num;
+	b = x->den;
+	c = y->num;
+	d = y->den;
+
+	BN_CTX_start(ctx);
+
+	status = ratcancel(&a, &d, ctx) && ratcancel(&c, &b, ctx) &&
+	    bigmul(&r->num, a, c, mp, ctx) && bigmul(&r->den, b, d, mp, ctx);
+
+	BN_CTX_end(ctx);
+
+	r->reduced = x->reduced && y->reduced;
+
+	return status;
+}
+
+/* r = x + y or r = x - y. */
+static int
+rataddsub(struct rational *r, const struct ratio *x, const struct ratio *y,
+    bool sub, const struct mulparams *mp, BN_CTX *ctx)
+{
+	BIGNUM *t;
+	int status;
+
+	if (BN_cmp(x->den, y->den) == 0) {
+		status = sub ? BN_sub(&r->num, x->num, y->num) :
+		    BN_add(&r->num, x->num, y->num);
+		return status && BN_copy(&r->den, x->den) != NULL;
+	}
+
+	/* n + p / q = (n * q + p) / q is reduced if p / q is reduced. */
+	if (BN_is_one(y->den)) {
+		status = bigmul(&r->num, y->num, x->den, mp, ctx) &&
+		    (sub ? BN_sub(&r->num, x->num, &r->num) :
+		    BN_add(&r->num, x->num, &r->num)) &&
+		    BN_copy(&r->den, x->den) != NULL;
+		r->reduced = x->reduced;
+		return status;
+	}
+
+	if (BN_is_one(x->den)) {
+		status = bigmul(&r->num, x->num, y->den, mp, ctx) &&
+		    (sub ? BN_sub(&r->num, &r->num, y->num) :
+		    BN_add(&r->num, &r->num, y->num)) &&
+		    BN_copy(&r->den, y->den) != NULL;
+		r->reduced = y->reduced;
+		return status;
+	}
+
+	BN_CTX_start(ctx);
+
+	status = (t = BN_CTX_get(ctx)) != NULL &&
+	    bigmul(&r->num, x->num, y->den, mp, ctx) &&
+	    bigmul(t, y->num, x->den, mp, ctx) &&
+	    (sub ? BN_sub(&r->num, &r->num, t) : BN_add(&r->num, &r->num, t)) &&
+	    bigmul(&r->den, x->den, y->den, mp, ctx);
+
+	BN_CTX_end(ctx);
+
+	return status;
+}
+
+/*
+ * r = x - y * floor(x / y). Unlike % of bn.number, the result
+ * has a sign of y like % of Lua numbers.
+ */
+static int
+ratmod(struct rational *r, const struct ratio *x, const struct ratio *y,
+    const struct mulparams *mp, BN_CTX *ctx)
+{
+	BIGNUM *a, *b; /* x / y = a / b */
+	int status;
+
+	BN_CTX_start(ctx);
+
+	status = (a = BN_CTX_get(ctx)) != NULL &&
+	    (b = BN_CTX_get(ctx)) != NULL &&
+	    bigmul(a, x->num, y->den, mp, ctx) &&
+	    bigmul(b, y->num, x->den, mp, ctx) &&
+	    BN_nnmod(&r->num, a, b, ctx) &&
+	    bigmul(&r->den, x->den, y->den, mp, ctx);
+
+	if (status && BN_is_negative(b) && !BN_is_zero(&r->num))
+		status = BN_add(&r->num, &r->num, b);
+
+	BN_CTX_end(ctx);
+
+	return status;
+}
+
+/* Compares x and y without reducing them. */
+static int
+ratcmp(const struct ratio *x, const struct ratio *y,
+    const struct mulparams *mp, BN_CTX *ctx)
+{
+	BIGNUM *a, *b;
+	int sx, sy, bx, by, res;
+
+	sx = BN_is_zero(x->num) ? 0 : BN_is_negative(x->num) ? -1 : 1;
+	sy = BN_is_zero(y->num) ? 0 : BN_is_negative(y->num) ? -1 : 1;
+
+	if (sx != sy)
+		return (sx < sy) ? -1 : 1;
+	if (sx == 0)
+		return 0;
+
+	if (BN_cmp(x->den, y->den) == 0)
+		return BN_cmp(x->num, y->num);
+
+	/* Products of k and m bits have k + m - 1 or k + m bits. */
+	bx = BN_num_bits(x->num) + BN_num_bits(y->den);
+	by = BN_num_bits(y->num) + BN_num_bits(x->den);
+	if (bx > by + 1)
+		return sx;
+	if (by > bx + 1)
+		return -sx;
+
+	BN_CTX_start(ctx);
+
+	res = -2;
+	if ((a = BN_CTX_get(ctx)) != NULL && (b = BN_CTX_get(ctx)) != NULL &&
+	    bigmul(a, x->num, y->den, mp, ctx) &&
+	    bigmul(b, y->num, x->den, mp, ctx))
+		res = BN_cmp(a, b);
+
+	BN_CTX_end(ctx);
+
+	return res;
+}
+
+/* Compares operands at index 1 and 2. */
+static int
+ratcompare(lua_State *L)
+{
+	struct ratio x, y;
+	int res;
+
+	toratio(L, 1, &x);
+	toratio(L, 2, &y);
+
+	/* Reduced fractions are equal only if their parts are equal. */
+	if (x.reduced && y.reduced && BN_cmp(x.num, y.num) == 0 &&
+	    BN_cmp(x.den, y.den) == 0)
+		return 0;
+
+	res = ratcmp(&x, &y, get_mulparams(L), get_ctx_val(L));
+	if (res == -2)
+		return bnerror(L, RAT_METATABLE);
+
+	return res;
+}
+
+/*
+ * x ^ e where e is an integer. Powers of reduced fractions
+ * are reduced.
+ */
+static int
+ratpow(lua_State *L)
+{
+	struct rational *r, *e;
+	struct ratio x;
+	const BIGNUM *p;
+	BN_CTX *ctx;
+	const struct mulparams *mp;
+	int status;
+
+	ctx = get_ctx_val(L);
+	mp = get_mulparams(L);
+
+	if (testrational(L, 2)) {
+		e = (struct rational *)lua_touserdata(L, 2);
+		if (!ratreduce(e, true, ctx))
+			return bnerror(L, RAT_METATABLE ".__pow");
+		if (!BN_is_one(&e->den))
+			return luaL_argerror(L, 2, "integer exponent expected");
+		p = &e->num;
+	} else {
+		p = tobignum(L, 2);
+	}
+
+	toratio(L, 1, &x);
+
+	if (BN_is_negative(p) && BN_is_zero(x.num))
+		return luaL_error(L, RAT_METATABLE ": division by zero");
+
+	r = newrational(L);
+
+	status = bigexp(&r->num, x.num, p, mp, ctx) &&
+	    bigexp(&r->den, x.den, p, mp, ctx);
+
+	if (status && BN_is_negative(p)) {
+		BN_swap(&r->num, &r->den);
+		if (BN_is_negative(&r->den)) {
+			negatebignum(&r->num);
+			negatebignum(&r->den);
+		}
+	}
+
+	r->reduced = x.reduced;
+	r->rbits = x.rbits;
+
+	if (!status || !ratreduce(r, false, ctx))
+		return bnerror(L, RAT_METATABLE ".__pow");
+
+	return 1;
+}
+
+/* Arithmetic metamethod with operands at index 1 and 2. */
+static int
+ratarith(lua_State *L, enum lazyop op)
+{
+	struct rational *r;
+	struct ratio x, y;
+	BIGNUM ynum;
+	BN_CTX *ctx;
+	const struct mulparams *mp;
+	int status;
+	bool isneg;
+
+	if (op == LAZY_POW)
+		return ratpow(L);
+
+	toratio(L, 1, &x);
+	y = x;
+	if (op != LAZY_UNM)
+		toratio(L, 2, &y);
+
+	if ((op == LAZY_DIV || op == LAZY_MOD) && BN_is_zero(y.num))
+		return luaL_error(L, RAT_METATABLE ": division by zero");
+
+	r = newrational(L);
+	r->rbits = (x.rbits > y.rbits) ? x.rbits : y.rbits;
+
+	ctx = get_ctx_val(L);
+	mp = get_mulparams(L);
+
+	switch (op) {
+		case LAZY_ADD:
+		case LAZY_SUB:
+			status = rataddsub(r, &x, &y, op == LAZY_SUB, mp, ctx);
+			break;
+		case LAZY_MUL:
+			status = ratmul(r, &x, &y, mp, ctx);
+			break;
+		case LAZY_DIV:
+			/* Multiply by |den / num| and fix the sign. */
+			isneg = BN_is_negative(y.num);
+			absview(&ynum, y.num);
+			y.num = y.den;
+			y.den = &ynum;
+			status = ratmul(r, &x, &y, mp, ctx);
+			if (status && isneg)
+				negatebignum(&r->num);
+			break;
+		case LAZY_MOD:
+			status = ratmod(r, &x, &y, mp, ctx);
+			break;
+		case LAZY_UNM:
+			status = BN_copy(&r->num, x.num) != NULL &&
+			    BN_copy(&r->den, x.den) != NULL;
+			if (status)
+				negatebignum(&r->num);
+			r->reduced = x.reduced;
+			break;
+		default:
+			status = 0;
+			break;
+	}
+
+	if (!status || !ratreduce(r, false, ctx))
+		return bnerror(L, RAT_METATABLE);
+
+	return 1;
+}
+
+static int
+f_rational(lua_State *L)
+{
+	const char *s, *slash;
+	size_t len;
+
+	if (lua_isnoneornil(L, 2)) {
+		if (testrational(L, 1)) {
+			lua_settop(L, 1);
+			return 1;
+		}
+
+		/* "p/q" */
+		s = slash = NULL;
+		if (lua_type(L, 1) == LUA_TSTRING) {
+			s = lua_tolstring(L, 1, &len);
+			slash = memchr(s, '/', len);
+		}
+
+		lua_settop(L, 1);
+		if (s != NULL && slash != NULL) {
+			lua_pushlstring(L, s, slash - s);
+			lua_pushlstring(L, slash + 1, len - (slash - s) - 1);
+			lua_replace(L, 1);
+			lua_insert(L, 1);
+		} else {
+			lua_pushinteger(L, 1);
+		}
+	}
+
+	lua_settop(L, 2);
+
+	return ratarith(L, LAZY_DIV);
+}
+
+/* Pushes a numerator or a denominator of a reduced r. */
+static int
+h_ratpart(lua_State *L, bool den)
+{
+	struct rational *r;
+	BIGNUM *bn;
+
+	r = checkrational(L, 1);
+	bn = newbignum(L);
+
+	if (!ratreduce(r, true, get_ctx_val(L)) ||
+	    BN_copy(bn, den ? &r->den : &r->num) == NULL)
+		return bnerror(L, den ? RAT_METATABLE ":den" :
+		    RAT_METATABLE ":num");
+
+	return 1;
+}
+
+static int
+m_rat_num(lua_State *L)
+{
+
+	return h_ratpart(L, false);
+}
+
+static int
+m_rat_den(lua_State *L)
+{
+
+	return h_ratpart(L, true);
+}
+
+/* r:floor() - the largest integer not greater than r. */
+static int
+m_rat_floor(lua_State *L)
+{
+	struct rational *r;
+	BIGNUM *bn, *t;
+	BN_CTX *ctx;
+	int status;
+
+	r = checkrational(L, 1);
+	bn = newbignum(L);
+	ctx = get_ctx_val(L);
+
+	BN_CTX_start(ctx);
+
+	status = (t = BN_CTX_get(ctx)) != NULL &&
+	    BN_div(bn, t, &r->num, &r->den, ctx);
+	if (status && BN_is_negative(&r->num) && !BN_is_zero(t))
+		status = BN_sub_word(bn, 1);
+
+	BN_CTX_end(ctx);
+
+	if (!status)
+		return bnerror(L, RAT_METATABLE ":floor");
+
+	return 1;
+}
+
+static int
+mt_rat_tostring(lua_State *L)
+{
+	struct rational *r;
+
+	r = checkrational(L, 1);
+
+	if (!ratreduce(r, true, get_ctx_val(L)))
+		return bnerror(L, RAT_METATABLE ".__tostring");
+
+	if (r->str != NULL)
+		OPENSSL_free(r->str);
+	r->str = BN_bn2dec(&r->num);
+	if (r->str == NULL)
+		return bnerror(L, "BN_bn2dec in tostring");
+	lua_pushstring(L, r->str);
+	OPENSSL_free(r->str);
+	r->str = NULL;
+
+	if (BN_is_one(&r->den))
+		return 1;
+
+	lua_pushliteral(L, "/");
+	r->str = BN_bn2dec(&r->den);
+	if (r->str == NULL)
+		return bnerror(L, "BN_bn2dec in tostring");
+	lua_pushstring(L, r->str);
+	OPENSSL_free(r->str);
+	r->str = NULL;
+	lua_concat(L, 3);
+
+	return 1;
+}
+
+static int
+mt_rat_gc(lua_State *L)
+{
+	struct rational *r;
+
+	r = checkrational(L, 1);
+
+	BN_free(&r->num);
+	BN_free(&r->den);
+	if (r->str != NULL)
+		OPENSSL_free(r->str);
+	r->str = NULL;
+
+	lua_pushnil(L);
+	lua_setmetatable(L, 1);
+
+	return 0;
+}
+
+/*
+ * Lua 5.1 calls __eq only when both operands are bn.rational, so
+ * an equal bn.number or Lua number isn't equal there.
+ */
+static int
+mt_rat_eq(lua_State *L)
+{
+	int i;
+
+	for (i = 1; i <= 2; i++) {
+		if (!testrational(L, i) && testbignum(L, i) == NULL &&
+		    fixedtypeof(L, i) == NULL) {
+			lua_pushboolean(L, false);
+			return 1;
+		}
+	}
+
+	lua_pushboolean(L, ratcompare(L) == 0);
+
+	return 1;
+}
+
+static int
+mt_rat_lt(lua_State *L)
+{
+
+	lua_pushboolean(L, ratcompare(L) < 0);
+
+	return 1;
+}
+
+static int
+mt_rat_le(lua_State *L)
+{
+
+	lua_pushboolean(L, ratcompare(L) <= 0);
+
+	return 1;
+}
+
+static int
+mt_rat_add(lua_State *L)
+{
+
+	return ratarith(L, LAZY_ADD);
+}
+
+static int
+mt_rat_sub(lua_State *L)
+{
+
+	return ratarith(L, LAZY_SUB);
+}
+
+static int
+mt_rat_mul(lua_State *L)
+{
+
+	return ratarith(L, LAZY_MUL);
+}
+
+static int
+mt_rat_div(lua_State *L)
+{
+
+	return ratarith(L, LAZY_DIV);
+}
+
+static int
+mt_rat_mod(lua_State *L)
+{
+
+	return ratarith(L, LAZY_MOD);
+}
+
+static int
+mt_rat_pow(lua_State *L)
+{
+
+	return ratarith(L, LAZY_POW);
+}
+
+static int
+mt_rat_unm(lua_State *L)
+{
+
+	return ratarith(L, LAZY_UNM);
+}
+
+/*
+ * Elliptic curves y^2 = x^3 + a * x + b over prime fields. Arithmetic
+ * is done by OpenSSL: points are kept in Jacobian coordinates, a single
+ * scalar is multiplied with a constant-time ladder unless variable time
+ * is requested, windowed NAF interleaves several scalars in one pass,
+ * a generator may have a table of precomputed multiples and
+ * EC_POINTs_make_affine() normalises many points with one inversion.
+ *
+ * Curves are reference counted because points outlive bn.curve objects.
+ * A curve created by c:precompute(P) has its own group with generator P
+ * but its points belong to the parent curve.
+ */
+struct curve
+{
+	EC_GROUP *group;
+	struct curve *root; /* Curve of points, this one or a parent. */
+	unsigned int refs;
+};
+
+struct point
+{
+	EC_POINT *point;
+	struct curve *curve; /* Root curve. */
+
+	/* Same as in struct BN. */
+	char *str;
+};
+
+static void
+curve_release(struct curve *c)
+{
+	struct curve *root;
+
+	if (c == NULL || --c->refs > 0)
+		return;
+
+	root = c->root;
+	EC_GROUP_free(c->group);
+	free(c);
+
+	if (root != c)
+		curve_release(root);
+}
+
+static struct curve *
+checkcurve(lua_State *L, int narg)
+{
+
+	return *(struct curve **)luaL_checkudata(L, narg, CURVE_METATABLE);
+}
+
+static struct point *
+testpoint(lua_State *L, int narg)
+{
+	struct point *p;
+
+	if (lua_type(L, narg) != LUA_TUSERDATA || !lua_getmetatable(L, narg))
+		return NULL;
+
+	luaL_getmetatable(L, POINT_METATABLE);
+	p = lua_rawequal(L, -1, -2) ?
+	    (struct point *)lua_touserdata(L, narg) : NULL;
+	lua_pop(L, 2);
+
+	return p;
+}
+
+static struct point *
+checkpoint(lua_State *L, int narg)
+{
+
+	return (struct point *)luaL_checkudata(L, narg, POINT_METATABLE);
+}
+
+/* Same as checkpoint() but the point must be on a curve c. */
+static struct point *
+checkcurvepoint(lua_State *L, int narg, const struct curve *c)
+{
+	struct point *p;
+
+	p = checkpoint(L, narg);
+	if (p->curve != c)
+		luaL_argerror(L, narg, "point on another curve");
+
+	return p;
+}
+
+/*
+ * Pushes a new bn.curve object. Its group is NULL and its points
+ * belong to root unless root is NULL.
+ */
+static struct curve *
+newcurve(lua_State *L, struct curve *root)
+{
+	struct curve **udata, *c;
+
+	udata = (struct curve **)lua_newuserdata(L, sizeof(struct curve *));
+	*udata = NULL;
+
+	luaL_getmetatable(L, CURVE_METATABLE);
+	lua_setmetatable(L, -2);
+
+	c = (struct curve *)malloc(sizeof(struct curve));
+	if (c == NULL)
+		bnerror(L, "bn.curve: no memory");
+
+	c->group = NULL;
+	c->root = c;
+	c->refs = 1;
+	if (root != NULL) {
+		c->root = root;
+		root->refs++;
+	}
+
+	*udata = c;
+
+	return c;
+}
+
+/* Pushes a new point at infinity of a curve c. */
+static EC_POINT *
+newpoint(lua_State *L, struct curve *c)
+{
+	struct point *p;
+
+	p = (struct point *)lua_newuserdata(L, sizeof(struct point));
+	p->point = NULL;
+	p->curve = NULL;
+	p->str = NULL;
+
+	luaL_getmetatable(L, POINT_METATABLE);
+	lua_setmetatable(L, -2);
+
+	p->point = EC_POINT_new(c->group);
+	if (p->point == NULL)
+		bnerror(L, "bn.curve: EC_POINT_new");
+
+	p->curve = c->root;
+	p->curve->refs++;
+
+	return p->point;
+}
+
+/* Sets r to (x, y) if it's on a curve c. */
+static void
+setpoint(lua_State *L, const struct curve *c, EC_POINT *r,
+    const BIGNUM *x, const BIGNUM *y, BN_CTX *ctx)
+{
+	int rv;
+
+	if (!EC_POINT_set_affine_coordinates_GFp(c->group, r, x, y, ctx))
+		bnerror(L, "bn.curve");
+
+	rv = EC_POINT_is_on_curve(c->group, r, ctx);
+	if (rv == 0)
+		luaL_error(L, "bn.curve: point is not on the curve");
+	if (rv < 0)
+		bnerror(L, "bn.curve");
+}
+
+/*
+ * bn.curve{p, a, b [, gx, gy, n [, h]]} - curve with optional
+ * generator (gx, gy) of order n and cofactor h.
+ */
+static int
+f_curve(lua_State *L)
+{
+	BIGNUM *bn[7];
+	struct curve *c;
+	EC_POINT *g;
+	BN_CTX *ctx;
+	int i, n, status;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	lua_settop(L, 1);
+
+	n = (int)lua_rawlen(L, 1);
+	luaL_argcheck(L, n == 3 || n == 6 || n == 7, 1,
+	    "{p, a, b [, gx, gy, n [, h]]} expected");
+
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, 1, i + 1);
+		bn[i] = tobignum(L, lua_gettop(L));
+	}
+
+	ctx = get_ctx_val(L);
+
+	status = isprime(bn[0], 0, get_mulparams(L), ctx);
+	if (status == -1)
+		return bnerror(L, "bn.curve");
+	luaL_argcheck(L, status == 1, 1, "p is not prime");
+
+	c = newcurve(L, NULL);
+
+	c->group = EC_GROUP_new_curve_GFp(bn[0], bn[1], bn[2], ctx);
+	if (c->group == NULL)
+		return bnerror(L, "bn.curve");
+
+	if (!EC_GROUP_check_discriminant(c->group, ctx))
+		return luaL_error(L, "bn.curve: singular curve");
+
+	if (n == 3)
+		return 1;
+
+	g = newpoint(L, c);
+	setpoint(L, c, g, bn[3], bn[4], ctx);
+
+	status = EC_GROUP_set_generator(c->group, g, bn[5],
+	    (n == 7) ? bn[6] : NULL);
+	if (status == 0)
+		return bnerror(L, "bn.curve");
+
+	lua_pop(L, 1);
+
+	return 1;
+}
+
+/* c:point([x, y]) - point (x, y) or a point at infinity. */
+static int
+m_curve_point(lua_State *L)
+{
+	struct curve *c;
+	EC_POINT *r;
+	BIGNUM *x, *y;
+
+	c = checkcurve(L, 1);
+
+	if (lua_isnoneornil(L, 2)) {
+		r = newpoint(L, c);
+		if (!EC_POINT_set_to_infinity(c->group, r))
+			return bnerror(L, "bn.curve:point");
+		return 1;
+	}
+
+	luaL_checkany(L, 3);
+	x = tobignum(L, 2);
+	y = tobignum(L, 3);
+	lua_settop(L, 3);
+
+	r = newpoint(L, c);
+	setpoint(L, c, r, x, y, get_ctx_val(L));
+
+	return 1;
+}
+
+static int
+m_curve_generator(lua_State *L)
+{
+	struct curve *c;
+	const EC_POINT *g;
+	EC_POINT *r;
+
+	c = checkcurve(L, 1);
+
+	if ((g = EC_GROUP_get0_generator(c->group)) == NULL) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	r = newpoint(L, c);
+	if (!EC_POINT_copy(r, g))
+		return bnerror(L, "bn.curve:generator");
+
+	return 1;
+}
+
+/* c:params() - p, a, b and, if a curve has a generator, n and h. */
+static int
+m_curve_params(lua_State *L)
+{
+	struct curve *c;
+	BIGNUM *bn[5];
+	BN_CTX *ctx;
+	int i, n;
+
+	c = checkcurve(L, 1);
+	ctx = get_ctx_val(L);
+
+	n = (EC_GROUP_get0_generator(c->group) != NULL) ? 5 : 3;
+	for (i = 0; i < n; i++)
+		bn[i] = newbignum(L);
+
+	if (!EC_GROUP_get_curve_GFp(c->group, bn[0], bn[1], bn[2], ctx) ||
+	    (n == 5 && (!EC_GROUP_get_order(c->group, bn[3], ctx) ||
+	    !EC_GROUP_get_cofactor(c->group, bn[4], ctx))))
+		return bnerror(L, "bn.curve:params");
+
+	return n;
+}
+
+/*
+ * r = n * G + sum of k[i] * p[i]. OpenSSL 1.0.2q and later compute
+ * n * G and k[0] * p[0] alone with a constant-time ladder if the order
+ * is known. The ladder is several times slower and it ignores
+ * precomputed multiples. If vartime is true, a zero term is added to
+ * these two cases to keep them on the variable-time wNAF path, it must
+ * not be used with secret scalars.
+ */
+static int
+curvemul(const EC_GROUP *group, EC_POINT *r, const BIGNUM *n, size_t num,
+    const EC_POINT **p, const BIGNUM **k, bool vartime, BN_CTX *ctx)
+{
+	const EC_POINT *g;
+	BIGNUM *zero;
+	int status;
+	bool ladder;
+
+	g = EC_GROUP_get0_generator(group);
+	ladder = (n != NULL && num == 0) || (n == NULL && num == 1);
+	if (!vartime || g == NULL || !ladder)
+		return EC_POINTs_mul(group, r, n, num, p, k, ctx);
+
+	BN_CTX_start(ctx);
+
+	status = (zero = BN_CTX_get(ctx)) != NULL;
+	if (status) {
+		BN_zero(zero);
+		if (num == 0) {
+			status = EC_POINTs_mul(group, r, n, 1, &g,
+			    (const BIGNUM **)&zero, ctx);
+		} else {
+			status = EC_POINTs_mul(group, r, zero, num, p, k, ctx);
+		}
+	}
+
+	BN_CTX_end(ctx);
+
+	return status;
+}
+
+static void
+checkgenerator(lua_State *L, const struct curve *c)
+{
+
+	if (EC_GROUP_get0_generator(c->group) == NULL)
+		luaL_error(L, "bn.curve: curve has no generator");
+}
+
+/*
+ * c:mul(k [, P [, vartime]]) - k * P or k * G where G is a generator,
+ * computed in variable time if vartime is true.
+ */
+static int
+m_curve_mul(lua_State *L)
+{
+	struct curve *c;
+	struct point *p;
+	BIGNUM *k;
+	EC_POINT *r;
+	int status;
+	bool vartime;
+
+	c = checkcurve(L, 1);
+	k = tobignum(L, 2);
+	vartime = lua_toboolean(L, 4);
+
+	p = NULL;
+	if (!lua_isnoneornil(L, 3))
+		p = checkcurvepoint(L, 3, c->root);
+	else
+		checkgenerator(L, c);
+
+	r = newpoint(L, c);
+
+	if (p != NULL)
+		status = curvemul(c->group, r, NULL, 1,
+		    (const EC_POINT **)&p->point, (const BIGNUM **)&k,
+		    vartime, get_ctx_val(L));
+	else
+		status = curvemul(c->group, r, k, 0, NULL, NULL, vartime,
+		    get_ctx_val(L));
+
+	if (status == 0)
+		return bnerror(L, "bn.curve:mul");
+
+	return 1;
+}
+
+/*
+ * c:mulsum(n, points, scalars) - n * G + sum of scalars[i] * points[i]
+ * computed in one pass, n may be nil.
+ */
+static int
+m_curve_mulsum(lua_State *L)
+{
+	struct curve *c;
+	const EC_POINT **points;
+	BIGNUM *n, **scalars;
+	EC_POINT *r;
+	size_t i, num, nscalars;
+
+	c = checkcurve(L, 1);
+	luaL_checktype(L, 3, LUA_TTABLE);
+	lua_settop(L, 4);
+
+	n = NULL;
+	if (!lua_isnil(L, 2)) {
+		checkgenerator(L, c);
+		n = tobignum(L, 2);
+	}
+
+	scalars = tobignums(L, 4, &nscalars);
+
+	num = lua_rawlen(L, 3);
+	if (num != nscalars)
+		return luaL_error(L, "bn.curve:mulsum: %d points and %d "
+		    "scalars", (int)num, (int)nscalars);
+
+	points = (const EC_POINT **)lua_newuserdata(L,
+	    (num + 1) * sizeof(EC_POINT *));
+
+	for (i = 0; i < num; i++) {
+		lua_rawgeti(L, 3, (int)(i + 1));
+		points[i] = checkcurvepoint(L, lua_gettop(L), c->root)->point;
+		lua_pop(L, 1);
+	}
+
+	r = newpoint(L, c);
+	if (!curvemul(c->group, r, n, num, points,
+	    (const BIGNUM **)scalars, false, get_ctx_val(L)))
+		return bnerror(L, "bn.curve:mulsum");
+
+	return 1;
+}
+
+/*
+ * c:precompute() - precompute multiples of a generator of c.
+ * c:precompute(P) - new curve with generator P and precomputed
+ * multiples, its points are points of c.
+ */
+static int
+m_curve_precompute(lua_State *L)
+{
+	struct curve *c, *d;
+	struct point *p;
+	BIGNUM *order, *cofactor;
+	BN_CTX *ctx;
+
+	c = checkcurve(L, 1);
+	checkgenerator(L, c);
+	ctx = get_ctx_val(L);
+
+	if (lua_isnoneornil(L, 2)) {
+		if (!EC_GROUP_precompute_mult(c->group, ctx))
+			return bnerror(L, "bn.curve:precompute");
+		lua_settop(L, 1);
+		return 1;
+	}
+
+	p = checkcurvepoint(L, 2, c->root);
+
+	order = newbignum(L);
+	cofactor = newbignum(L);
+	if (!EC_GROUP_get_order(c->group, order, ctx) ||
+	    !EC_GROUP_get_cofactor(c->group, cofactor, ctx))
+		return bnerror(L, "bn.curve:precompute");
+
+	d = newcurve(L, c->root);
+	d->group = EC_GROUP_dup(c->group);
+	if (d->group == NULL ||
+	    !EC_GROUP_set_generator(d->group, p->point, order, cofactor) ||
+	    !EC_GROUP_precompute_mult(d->group, ctx))
+		return bnerror(L, "bn.curve:precompute");
+
+	return 1;
+}
+
+/*
+ * c:affine(points) - convert points in a table to affine coordinates
+ * in place with one field inversion.
+ */
+static int
+m_curve_affine(lua_State *L)
+{
+	struct curve *c;
+	EC_POINT **points;
+	size_t i, num;
+
+	c = checkcurve(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	lua_settop(L, 2);
+
+	num = lua_rawlen(L, 2);
+	points = (EC_POINT **)lua_newuserdata(L,
+	    (num + 1) * sizeof(EC_POINT *));
+
+	for (i = 0; i < num; i++) {
+		lua_rawgeti(L, 2, (int)(i + 1));
+		points[i] = checkcurvepoint(L, lua_gettop(L), c->root)->point;
+		lua_pop(L, 1);
+	}
+
+	if (num > 0 &&
+	    !EC_POINTs_make_affine(c->group, num, points, get_ctx_val(L)))
+		return bnerror(L, "bn.curve:affine");
+
+	lua_settop(L, 2);
+
+	return 1;
+}
+
+static int
+gccurve(lua_State *L)
+{
+	struct curve **udata;
+
+	udata = (struct curve **)luaL_checkudata(L, 1, CURVE_METATABLE);
+	curve_release(*udata);
+	*udata = NULL;
+
+	return 0;
+}
+
+/* P:xy() - affine coordinates, nothing for a point at infinity. */
+static int
+m_point_xy(lua_State *L)
+{
+	struct point *p;
+	BIGNUM *x, *y;
+
+	p = checkpoint(L, 1);
+
+	if (EC_POINT_is_at_infinity(p->curve->group, p->point))
+		return 0;
+
+	x = newbignum(L);
+	y = newbignum(L);
+	if (!EC_POINT_get_affine_coordinates_GFp(p->curve->group, p->point,
+	    x, y, get_ctx_val(L)))
+		return bnerror(L, POINT_METATABLE ":xy");
+
+	return 2;
+}
+
+static int
+m_point_isinfinity(lua_State *L)
+{
+	struct point *p;
+
+	p = checkpoint(L, 1);
+	lua_pushboolean(L,
+	    EC_POINT_is_at_infinity(p->curve->group, p->point));
+
+	return 1;
+}
+
+static int
+m_point_double(lua_State *L)
+{
+	struct point *p;
+	EC_POINT *r;
+
+	p = checkpoint(L, 1);
+	r = newpoint(L, p->curve);
+
+	if (!EC_POINT_dbl(p->curve->group, r, p->point, get_ctx_val(L)))
+		return bnerror(L, POINT_METATABLE ":double");
+
+	return 1;
+}
+
+/* Point addition or subtraction of operands at index 1 and 2. */
 static int
-mt_eq(lua_State *L)
+h_pointaddsub(lua_State *L, bool sub)
 {
-	BIGNUM *a, *b;
+	struct point *p, *q;
+	EC_POINT *r, *t;
+	int status;
 
-	assert(testbignum(L, 1) != NULL);
-	assert(testbignum(L, 2) != NULL);
+	p = checkpoint(L, 1);
+	q = checkcurvepoint(L, 2, p->curve);
+	r = newpoint(L, p->curve);
 
-	a = &getbn(L, 1)->bignum;
-	b = &getbn(L, 2)->bignum;
+	if (!sub) {
+		status = EC_POINT_add(p->curve->group, r, p->point, q->point,
+		    get_ctx_val(L));
+	} else {
+		/* Operands of EC_POINT_add() shouldn't alias its result. */
+		status = (t = EC_POINT_dup(q->point, p->curve->group)) != NULL &&
+		    EC_POINT_invert(p->curve->group, t, get_ctx_val(L)) &&
+		    EC_POINT_add(p->curve->group, r, p->point, t,
+		    get_ctx_val(L));
+		EC_POINT_free(t);
+	}
 
-	lua_pushboolean(L, BN_cmp(a, b) == 0);
+	if (status == 0)
+		return bnerror(L, sub ? POINT_METATABLE ".__sub" :
+		    POINT_METATABLE ".__add");
 
 	return 1;
 }
 
 static int
-mt_lt(lua_State *L)
+mt_point_add(lua_State *L)
 {
-	BIGNUM *a, *b;
 
-	assert(testbignum(L, 1) != NULL);
-	assert(testbignum(L, 2) != NULL);
+	return h_pointaddsub(L, false);
+}
+
+static int
+mt_point_sub(lua_State *L)
+{
+
+	return h_pointaddsub(L, true);
+}
 
-	a = &getbn(L, 1)->bignum;
-	b = &getbn(L, 2)->bignum;
+static int
+mt_point_unm(lua_State *L)
+{
+	struct point *p;
+	EC_POINT *r;
 
-	lua_pushboolean(L, BN_cmp(a, b) < 0);
+	p = checkpoint(L, 1);
+	r = newpoint(L, p->curve);
+
+	if (!EC_POINT_copy(r, p->point) ||
+	    !EC_POINT_invert(p->curve->group, r, get_ctx_val(L)))
+		return bnerror(L, POINT_METATABLE ".__unm");
 
 	return 1;
 }
 
+/* k * P or P * k, it's also called by __mul of bn.number. */
 static int
-mt_unm(lua_State *L)
+pointmul(lua_State *L)
 {
-	BIGNUM *o, *r;
+	struct point *p;
+	BIGNUM *k;
+	EC_POINT *r;
 
-	assert(testbignum(L, 1) != NULL);
-	o = &getbn(L, 1)->bignum;
-	r = newbignum(L);
+	if ((p = testpoint(L, 1)) != NULL) {
+		k = tobignum(L, 2);
+	} else {
+		p = checkpoint(L, 2);
+		k = tobignum(L, 1);
+	}
 
-	if (!BN_copy(r, o))
-		return bnerror(L, BN_METATABLE ".__unm");
+	r = newpoint(L, p->curve);
 
-	negatebignum(r);
+	if (!curvemul(p->curve->group, r, NULL, 1,
+	    (const EC_POINT **)&p->point, (const BIGNUM **)&k, false,
+	    get_ctx_val(L)))
+		return bnerror(L, POINT_METATABLE ".__mul");
 
 	return 1;
 }
 
-/*
- * Converts arguments 1 and 2 to BIGNUM objects and
- * pushes one BIGNUM object.
- * Use this function for a binary operation OP:
- * bn[0] = bn[1] OP bn[2]
- * when bn[0] can be the same object as bn[1] or bn[2].
- */
 static int
-bn3(lua_State *L, BIGNUM *bn[/* 3 */])
+mt_point_eq(lua_State *L)
 {
-	int narg;
+	struct point *p, *q;
+	int rv;
 
-	if ((bn[2] = testbignum(L, 2)) == NULL) {
-		narg = 2;
-		bn[1] = luaBn_tobignum(L, 1);
-	} else if ((bn[1] = testbignum(L, 1)) == NULL) {
-		narg = 1;
-	} else {
-		narg = 0;
+	p = testpoint(L, 1);
+	q = testpoint(L, 2);
+
+	if (p == NULL || q == NULL || p->curve != q->curve) {
+		lua_pushboolean(L, false);
+		return 1;
 	}
 
-	if (narg == 0) {
-		bn[0] = newbignum(L);
-	} else {
-		bn[0] = bn[narg] = luaBn_tobignum(L, narg);
-		lua_pushvalue(L, narg);
+	rv = EC_POINT_cmp(p->curve->group, p->point, q->point,
+	    get_ctx_val(L));
+	if (rv < 0)
+		return bnerror(L, POINT_METATABLE ".__eq");
+
+	lua_pushboolean(L, rv == 0);
+
+	return 1;
+}
+
+/* "(x, y)" or "inf". */
+static int
+mt_point_tostring(lua_State *L)
+{
+	struct point *p;
+	BIGNUM *x, *y;
+	int i;
+
+	p = checkpoint(L, 1);
+
+	if (EC_POINT_is_at_infinity(p->curve->group, p->point)) {
+		lua_pushliteral(L, "inf");
+		return 1;
 	}
 
-	return narg;
+	lua_settop(L, 1);
+	m_point_xy(L);
+	x = &getbn(L, 2)->bignum;
+	y = &getbn(L, 3)->bignum;
+
+	lua_pushliteral(L, "(");
+	for (i = 0; i < 2; i++) {
+		if (p->str != NULL)
+			OPENSSL_free(p->str);
+		p->str = BN_bn2dec((i == 0) ? x : y);
+		if (p->str == NULL)
+			return bnerror(L, "BN_bn2dec in tostring");
+		lua_pushstring(L, p->str);
+		OPENSSL_free(p->str);
+		p->str = NULL;
+		if (i == 0)
+			lua_pushliteral(L, ", ");
+	}
+	lua_pushliteral(L, ")");
+	lua_concat(L, 5);
+
+	return 1;
 }
 
-/* Implementation of mt_add and mt_sub. */
-static inline int
-h_addsub(lua_State *L, int sign, const char *errmsg, bool ismt)
+static int
+gcpoint(lua_State *L)
 {
-	BIGNUM *bn[3]; /* bn[0] = bn[1] +/- bn[2] */
-	BN_ULONG n;
-	lua_Number d;
-	int narg, status;
+	struct point *p;
 
-	if ((bn[2] = testbignum(L, 2)) == NULL) {
-		narg = 2;
-		if (ismt) {
-			assert(testbignum(L, 1) != NULL);
-			bn[1] = &getbn(L, 1)->bignum;
-		} else {
-			bn[1] = luaBn_tobignum(L, 1);
-		}
-	} else if ((bn[1] = testbignum(L, 1)) == NULL) {
-		narg = 1;
+	p = checkpoint(L, 1);
+
+	EC_POINT_free(p->point);
+	p->point = NULL;
+	curve_release(p->curve);
+	p->curve = NULL;
+	if (p->str != NULL)
+		OPENSSL_free(p->str);
+	p->str = NULL;
+
+	lua_pushnil(L);
+	lua_setmetatable(L, 1);
+
+	return 0;
+}
+
+static inline fixedlimb *
+newfixed(lua_State *L, const struct fixedtype *t)
+{
+	fixedlimb *rv;
+
+	rv = (fixedlimb *)lua_newuserdata(L, t->nlimbs * sizeof(fixedlimb));
+
+	lua_pushvalue(L, t->mt);
+	lua_setmetatable(L, -2);
+
+	return rv;
+}
+
+/*
+ * Converts a value at index narg to fixed-width type t modulo 2^N.
+ * Returns a pointer to the object or tmp if the value is converted.
+ */
+static inline const fixedlimb *
+tofixed(lua_State *L, int narg, const struct fixedtype *t, fixedlimb *tmp)
+{
+	const struct fixedtype *from;
+	const fixedlimb *w;
+	BN_ULONG n;
+	bool isneg;
+
+	if ((w = testfixed(L, narg, t)) != NULL)
+		return w;
+
+	memset(tmp, 0, t->nlimbs * sizeof(tmp[0]));
+
+	if (lua_type(L, narg) == LUA_TNUMBER &&
+	    ((n = absnumber(L, narg, &isneg)) != 0 ||
+	    lua_tonumber(L, narg) == 0)) {
+		tmp[0] = (fixedlimb)n;
+		if (sizeof(fixedlimb) < sizeof(n))
+			tmp[1] = (fixedlimb)((uint64_t)n >> 32);
+		if (isneg)
+			t->k->neg(tmp, tmp);
+	} else if ((from = fixedtypeof(L, narg)) != NULL) {
+		w = getfixed(L, narg);
+		memcpy(tmp, w, ((from->nlimbs < t->nlimbs) ?
+		    from->nlimbs : t->nlimbs) * sizeof(tmp[0]));
 	} else {
-		narg = 0;
+		fixed_frombn(tmp, t, tobignum(L, narg));
 	}
 
-	status = 0;
+	return tmp;
+}
 
-	if (narg == 0) {
-		bn[0] = newbignum(L);
-		status = sign > 0 ? BN_add(bn[0], bn[1], bn[2])
-		                  : BN_sub(bn[0], bn[1], bn[2]);
-	} else {
-		d = lua_tonumber(L, narg);
-		n = absnumber(d);
+static inline int
+h_fixed_new(lua_State *L, const struct fixedtype *t)
+{
+	fixedlimb tmp[FIXED_MAXLIMBS];
+	const fixedlimb *a;
+	fixedlimb *r;
 
-		if (n == 0) {
-			bn[0] = bn[narg] = luaBn_tobignum(L, narg);
-			lua_pushvalue(L, narg);
-			status = sign > 0 ? BN_add(bn[0], bn[1], bn[2])
-			                  : BN_sub(bn[0], bn[1], bn[2]);
-		} else {
-			bn[0] = newbignum(L);
-			if (BN_copy(bn[0], bn[3-narg])) {
-				if (sign * d > 0)
-					status = BN_add_word(bn[0], n);
-				else
-					status = BN_sub_word(bn[0], n);
-				if (sign * narg == -1)
-					negatebignum(bn[0]);
-			}
-		}
+	if (lua_isnoneornil(L, 1))
+		memset(tmp, 0, sizeof(tmp));
+	else if ((a = tofixed(L, 1, t, tmp)) != tmp)
+		memcpy(tmp, a, t->nlimbs * sizeof(tmp[0]));
+
+	r = newfixed(L, t);
+	memcpy(r, tmp, t->nlimbs * sizeof(tmp[0]));
+
+	return 1;
+}
+
+enum fixedop
+{
+	FIXED_ADD,
+	FIXED_SUB,
+	FIXED_MUL,
+	FIXED_MODADD,
+	FIXED_MODSUB,
+	FIXED_MONTMUL
+};
+
+/*
+ * Converts operands of arithmetic modulo 2^N or modulo the third
+ * argument to x and pushes a result. Returns the result.
+ */
+static fixedlimb *
+h_fixed_operands(lua_State *L, const struct fixedtype *t, enum fixedop op,
+    fixedlimb tmp[][FIXED_MAXLIMBS], const fixedlimb *x[3])
+{
+
+	x[0] = tofixed(L, 1, t, tmp[0]);
+	x[1] = tofixed(L, 2, t, tmp[1]);
+	x[2] = (op >= FIXED_MODADD) ? tofixed(L, 3, t, tmp[2]) : NULL;
+
+	if (op == FIXED_MONTMUL && (x[2][0] & 1) == 0)
+		luaL_argerror(L, 3, "odd modulus expected");
+
+	return newfixed(L, t);
+}
+
+static inline int
+h_fixed_unm(lua_State *L, const struct fixedtype *t)
+{
+	fixedlimb tmp[FIXED_MAXLIMBS];
+	const fixedlimb *a;
+	fixedlimb *r;
+
+	a = tofixed(L, 1, t, tmp);
+	r = newfixed(L, t);
+	t->k->neg(r, a);
+
+	return 1;
+}
+
+/*
+ * Unsigned comparison. Returns -1, 0 or 1 if op is 0, or a result
+ * of a comparison with op being "__eq", "__lt" or "__le".
+ */
+static inline int
+h_fixed_cmp(lua_State *L, const struct fixedtype *t, int op)
+{
+	fixedlimb tmp[2][FIXED_MAXLIMBS];
+	const fixedlimb *a, *b;
+	int res;
+
+	if (op == '=' && (testfixed(L, 1, t) == NULL ||
+	    testfixed(L, 2, t) == NULL)) {
+		lua_pushboolean(L, false);
+		return 1;
 	}
 
-	if (status == 0)
-		return bnerror(L, errmsg);
+	a = tofixed(L, 1, t, tmp[0]);
+	b = tofixed(L, 2, t, tmp[1]);
+	res = t->k->cmp(a, b);
+
+	switch (op) {
+		case '=':
+			lua_pushboolean(L, res == 0);
+			break;
+		case '<':
+			lua_pushboolean(L, res < 0);
+			break;
+		case 'l':
+			lua_pushboolean(L, res <= 0);
+			break;
+		default:
+			lua_pushinteger(L, res);
+			break;
+	}
 
 	return 1;
 }
 
-static int
-mt_add(lua_State *L)
+static inline int
+h_fixed_tonumber(lua_State *L, const struct fixedtype *t)
 {
+	fixedlimb tmp[FIXED_MAXLIMBS];
+	const fixedlimb *a;
+	BIGNUM *r;
 
-	return h_addsub(L, 1, BN_METATABLE ".__add", true);
+	a = tofixed(L, 1, t, tmp);
+	r = newbignum(L);
+
+	if (!fixed_tobn(r, a, t->nlimbs))
+		return bnerror(L, "BN_bin2bn in tonumber");
+
+	return 1;
+}
+
+static inline int
+h_fixed_tostring(lua_State *L, const struct fixedtype *t)
+{
+	struct BN *bn;
+
+	h_fixed_tonumber(L, t);
+
+	bn = getbn(L, -1);
+	bn->str = BN_bn2dec(&bn->bignum);
+	if (bn->str == NULL)
+		return bnerror(L, "BN_bn2dec in tostring");
+
+	lua_pushstring(L, bn->str);
+
+	OPENSSL_free(bn->str);
+	bn->str = NULL;
+
+	return 1;
+}
+
+/*
+ * Returns 2^(2*N) modulo the first argument. This value converts
+ * numbers to Montgomery form with montmul.
+ */
+static inline int
+h_fixed_montr2(lua_State *L, const struct fixedtype *t)
+{
+	fixedlimb tmp[FIXED_MAXLIMBS];
+	const fixedlimb *m;
+	BIGNUM *r, *r2, *mod;
+	BN_CTX *ctx;
+	int status;
+
+	m = tofixed(L, 1, t, tmp);
+	if ((m[0] & 1) == 0)
+		return luaL_argerror(L, 1, "odd modulus expected");
+
+	mod = newbignum(L);
+	r2 = newbignum(L);
+	r = newbignum(L);
+
+	ctx = get_ctx_val(L);
+
+	/* Like BN_div, BN_mod may not store the result in an operand. */
+	status = fixed_tobn(mod, m, t->nlimbs) &&
+	    BN_set_bit(r2, 2 * FIXED_LIMBBITS * t->nlimbs) &&
+	    BN_mod(r, r2, mod, ctx);
+	if (!status)
+		return bnerror(L, "montr2");
+
+	fixed_frombn(newfixed(L, t), t, r);
+
+	return 1;
+}
+
+#define FIXED_FUNC(name, N, i, h)					\
+static int								\
+f_u##N##_##name(lua_State *L)						\
+{									\
+									\
+	return h(L, &fixedtypes[(i)]);					\
 }
 
+#define FIXED_FUNC_OP(name, N, i, h, op)				\
+static int								\
+f_u##N##_##name(lua_State *L)						\
+{									\
+									\
+	return h(L, &fixedtypes[(i)], (op));				\
+}
+
+/* Arithmetic of uN type calling its kernels directly. */
+#define FIXED_FUNC_ARITH(name, N, i, op)				\
+static int								\
+f_u##N##_##name(lua_State *L)						\
+{									\
+	fixedlimb tmp[3][FIXED_MAXLIMBS];				\
+	const fixedlimb *x[3];						\
+	fixedlimb *r;							\
+									\
+	r = h_fixed_operands(L, &fixedtypes[(i)], (op), tmp, x);	\
+									\
+	switch (op) {							\
+		case FIXED_ADD:						\
+			fixed##N##_add(r, x[0], x[1]);			\
+			break;						\
+		case FIXED_SUB:						\
+			fixed##N##_sub(r, x[0], x[1]);			\
+			break;						\
+		case FIXED_MUL:						\
+			fixed##N##_mul(r, x[0], x[1]);			\
+			break;						\
+		case FIXED_MODADD:					\
+			fixed##N##_modadd(r, x[0], x[1], x[2]);		\
+			break;						\
+		case FIXED_MODSUB:					\
+			fixed##N##_modsub(r, x[0], x[1], x[2]);		\
+			break;						\
+		case FIXED_MONTMUL:					\
+			fixed##N##_montmul(r, x[0], x[1], x[2],		\
+			    fixed_minv(x[2][0]));			\
+			break;						\
+	}								\
+									\
+	return 1;							\
+}
+
+/*
+ * Generates functions and tables of uN type
+ * described by fixedtypes[i].
+ */
+#define FIXED_TYPE(N, i)						\
+FIXED_FUNC(new, N, i, h_fixed_new)					\
+FIXED_FUNC_ARITH(add, N, i, FIXED_ADD)					\
+FIXED_FUNC_ARITH(sub, N, i, FIXED_SUB)					\
+FIXED_FUNC_ARITH(mul, N, i, FIXED_MUL)					\
+FIXED_FUNC_ARITH(modadd, N, i, FIXED_MODADD)				\
+FIXED_FUNC_ARITH(modsub, N, i, FIXED_MODSUB)				\
+FIXED_FUNC_ARITH(montmul, N, i, FIXED_MONTMUL)				\
+FIXED_FUNC(montr2, N, i, h_fixed_montr2)				\
+FIXED_FUNC(unm, N, i, h_fixed_unm)					\
+FIXED_FUNC_OP(cmp, N, i, h_fixed_cmp, 0)				\
+FIXED_FUNC_OP(eq, N, i, h_fixed_cmp, '=')				\
+FIXED_FUNC_OP(lt, N, i, h_fixed_cmp, '<')				\
+FIXED_FUNC_OP(le, N, i, h_fixed_cmp, 'l')				\
+FIXED_FUNC(tonumber, N, i, h_fixed_tonumber)				\
+FIXED_FUNC(tostring, N, i, h_fixed_tostring)				\
+									\
+static luaL_Reg u##N##_metafunctions[] = {				\
+	{ "__add",      f_u##N##_add      },				\
+	{ "__sub",      f_u##N##_sub      },				\
+	{ "__mul",      f_u##N##_mul      },				\
+	{ "__unm",      f_u##N##_unm      },				\
+	{ "__eq",       f_u##N##_eq       },				\
+	{ "__lt",       f_u##N##_lt       },				\
+	{ "__le",       f_u##N##_le       },				\
+	{ "__tostring", f_u##N##_tostring },				\
+	{ NULL, NULL}							\
+};									\
+									\
+static luaL_Reg u##N##_methods[] = {					\
+	{ "add",      f_u##N##_add      },				\
+	{ "sub",      f_u##N##_sub      },				\
+	{ "mul",      f_u##N##_mul      },				\
+	{ "modadd",   f_u##N##_modadd   },				\
+	{ "modsub",   f_u##N##_modsub   },				\
+	{ "montmul",  f_u##N##_montmul  },				\
+	{ "montr2",   f_u##N##_montr2   },				\
+	{ "cmp",      f_u##N##_cmp      },				\
+	{ "tonumber", f_u##N##_tonumber },				\
+	{ "tostring", f_u##N##_tostring },				\
+	{ NULL, NULL}							\
+};
+
+FIXED_TYPE(256, 0)
+FIXED_TYPE(384, 1)
+FIXED_TYPE(512, 2)
+
 static int
-f_add(lua_State *L)
+f_swap(lua_State *L)
 {
+	struct BN *ua, *ub;
+	char *key;
+	size_t keylen;
+	int i;
 
-	return h_addsub(L, 1, "bn.add", false);
+	for (i = 1; i <= 2; i++) {
+		if (testbignum(L, i) == NULL)
+			return typerror(L, i, BN_METATABLE);
+		if (getbn(L, i)->shared != NULL)
+			return luaL_argerror(L, i, "read-only " BN_METATABLE);
+	}
+
+	ua = getbn(L, 1);
+	ub = getbn(L, 2);
+
+	BN_swap(&ua->bignum, &ub->bignum);
+
+	key = ua->key;
+	ua->key = ub->key;
+	ub->key = key;
+
+	keylen = ua->keylen;
+	ua->keylen = ub->keylen;
+	ub->keylen = keylen;
+
+	return 0;
 }
 
+/*
+ * Canonical binary key: a sign byte followed by big-endian magnitude
+ * without leading zeros. The key is cached in struct BN. Lua functions
+ * only modify numbers in place in f_swap, which swaps cached keys too.
+ * Functions of the C interface and bnffi.lua can write to any number
+ * and they don't know about the key. Such writes leave a stale key
+ * and a stale bn.intern entry.
+ */
 static int
-mt_sub(lua_State *L)
+f_key(lua_State *L)
+{
+	struct BN *udata;
+	BIGNUM *bn;
+	size_t len;
+
+	bn = tobignum(L, 1);
+	udata = getbn(L, 1);
+
+	if (udata->key == NULL) {
+		len = BN_num_bytes(bn) + 1;
+		if ((udata->key = OPENSSL_malloc(len)) == NULL)
+			return bnerror(L, "bn.key");
+		udata->key[0] = BN_is_negative(bn) ? 1 : 0;
+		udata->keylen = BN_bn2bin(bn, (unsigned char *)udata->key + 1) + 1;
+	}
+
+	lua_pushlstring(L, udata->key, udata->keylen);
+	return 1;
+}
+
+/* Unique keys to access intern tables in the Lua registry. */
+static char intern_key;
+static char intern_sets_key;
+
+static inline uint64_t
+rotl64(uint64_t x, int b)
+{
+
+	return (x << b) | (x >> (64 - b));
+}
+
+static inline void
+sipround(uint64_t v[4])
+{
+
+	v[0] += v[1];
+	v[1] = rotl64(v[1], 13) ^ v[0];
+	v[0] = rotl64(v[0], 32);
+	v[2] += v[3];
+	v[3] = rotl64(v[3], 16) ^ v[2];
+	v[0] += v[3];
+	v[3] = rotl64(v[3], 21) ^ v[0];
+	v[2] += v[1];
+	v[1] = rotl64(v[1], 17) ^ v[2];
+	v[2] = rotl64(v[2], 32);
+}
+
+/*
+ * SipHash-1-3 of limbs followed by a word with the number of limbs
+ * and the sign. The key is random and it's different in every Lua
+ * state, so collisions can't be precomputed. The result is reduced
+ * to 53 bits so that it's exact as lua_Number.
+ */
+static lua_Number
+limbhash(const BIGNUM *bn, const uint64_t key[2])
+{
+	uint64_t v[4], m;
+	int i;
+
+	v[0] = key[0] ^ UINT64_C(0x736f6d6570736575);
+	v[1] = key[1] ^ UINT64_C(0x646f72616e646f6d);
+	v[2] = key[0] ^ UINT64_C(0x6c7967656e657261);
+	v[3] = key[1] ^ UINT64_C(0x7465646279746573);
+
+	for (i = 0; i <= bn->top; i++) {
+		if (i < bn->top)
+			m = (uint64_t)bn->d[i];
+		else
+			m = (uint64_t)bn->top << 1 | (BN_is_negative(bn) != 0);
+		v[3] ^= m;
+		sipround(v);
+		v[0] ^= m;
+	}
+
+	v[2] ^= 0xff;
+	sipround(v);
+	sipround(v);
+	sipround(v);
+
+	return (lua_Number)((v[0] ^ v[1] ^ v[2] ^ v[3]) >> 11);
+}
+
+/* Pushes a new table with weak mode. */
+static void
+newweaktable(lua_State *L, const char *mode)
 {
 
-	return h_addsub(L, -1, BN_METATABLE ".__sub", true);
+	lua_newtable(L);
+	lua_createtable(L, 0, 1);
+	lua_pushstring(L, mode);
+	lua_setfield(L, -2, "__mode");
+	lua_setmetatable(L, -2);
 }
 
-static int
-f_sub(lua_State *L)
+/*
+ * Pushes a table stored in the registry under key. A new table
+ * with weak mode is created on first use, mode may be NULL.
+ */
+static void
+pushregtable(lua_State *L, void *key, const char *mode)
 {
 
-	return h_addsub(L, -1, "bn.sub", false);
+	lua_pushlightuserdata(L, key);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		if (mode != NULL)
+			newweaktable(L, mode);
+		else
+			lua_newtable(L);
+		lua_pushlightuserdata(L, key);
+		lua_pushvalue(L, -2);
+		lua_rawset(L, LUA_REGISTRYINDEX);
+	}
 }
 
+/*
+ * The intern table maps limbhash() to an interned number. Its values
+ * are weak, so numbers which are referenced only by the table are
+ * collected. Other numbers with the same hash are kept in sets with
+ * weak keys. Sets are values of a separate table with strong values.
+ * A set which became empty is removed by the next lookup of its hash.
+ */
 static int
-h_mul(lua_State *L, const char *errmsg, bool ismt)
+f_intern(lua_State *L)
 {
-	BIGNUM *bn[3]; /* bn[0] = bn[1] * bn[2] */
-	BN_CTX *ctx;
-	BN_ULONG n;
-	lua_Number d;
-	int narg, status;
-
-	if ((bn[1] = testbignum(L, 1)) == NULL) {
-		narg = 1;
-		if (ismt) {
-			assert(testbignum(L, 2) != NULL);
-			bn[2] = &getbn(L, 2)->bignum;
-		} else {
-			bn[2] = luaBn_tobignum(L, 2);
+	BIGNUM *bn, *other;
+	bool empty;
+
+	bn = tobignum(L, 1);
+	lua_settop(L, 1);
+
+	pushregtable(L, &intern_key, "v");
+	pushregtable(L, &intern_sets_key, NULL);
+	lua_pushnumber(L, limbhash(bn, get_ctxval(L)->hashkey));
+
+	/* The number at index 5 and the set at index 6. */
+	lua_pushvalue(L, 4);
+	lua_rawget(L, 2);
+	other = testbignum(L, 5);
+	if (other != NULL && BN_cmp(other, bn) == 0)
+		return 1;
+
+	lua_pushvalue(L, 4);
+	lua_rawget(L, 3);
+	empty = true;
+	if (lua_istable(L, 6)) {
+		lua_pushnil(L);
+		while (lua_next(L, 6) != 0) {
+			lua_pop(L, 1);
+			empty = false;
+			other = testbignum(L, 7);
+			if (other != NULL && BN_cmp(other, bn) == 0)
+				return 1;
 		}
-	} else if ((bn[2] = testbignum(L, 2)) == NULL) {
-		narg = 2;
-	} else {
-		narg = 0;
 	}
 
-	status = 0;
-
-	if (narg == 0) {
-		bn[0] = newbignum(L);
-		ctx = get_ctx_val(L);
-		status = BN_mul(bn[0], bn[1], bn[2], ctx);
+	if (lua_isnil(L, 5)) {
+		lua_pushvalue(L, 4);
+		lua_pushvalue(L, 1);
+		lua_rawset(L, 2);
+		if (lua_istable(L, 6) && empty) {
+			lua_pushvalue(L, 4);
+			lua_pushnil(L);
+			lua_rawset(L, 3);
+		}
 	} else {
-		d = lua_tonumber(L, narg);
-		n = absnumber(d);
-
-		if (n == 0) {
-			bn[0] = bn[narg] = luaBn_tobignum(L, narg);
-			lua_pushvalue(L, narg);
-			ctx = get_ctx_val(L);
-			status = BN_mul(bn[0], bn[1], bn[2], ctx);
-		} else {
-			bn[0] = newbignum(L);
-			if (BN_copy(bn[0], bn[3-narg])) {
-				if (-d > 0)
-					negatebignum(bn[0]);
-				status = BN_mul_word(bn[0], n);
-			}
+		if (!lua_istable(L, 6)) {
+			lua_pop(L, 1);
+			newweaktable(L, "k");
+			lua_pushvalue(L, 4);
+			lua_pushvalue(L, 6);
+			lua_rawset(L, 3);
 		}
+		lua_pushvalue(L, 1);
+		lua_pushboolean(L, 1);
+		lua_rawset(L, 6);
 	}
 
-	if (status == 0)
-		return bnerror(L, errmsg);
-
+	lua_pushvalue(L, 1);
 	return 1;
 }
 
-static int
-mt_mul(lua_State *L)
+/*
+ * Makes a bn.number object at the top of the stack a read-only
+ * handle of sh. The caller should hold a reference to sh.
+ */
+static void
+setshared(lua_State *L, struct shared *sh)
 {
+	struct BN *udata;
+	BIGNUM *bn;
 
-	return h_mul(L, BN_METATABLE ".__mul", true);
-}
+	udata = getbn(L, -1);
+	bn = &udata->bignum;
 
-static int
-f_mul(lua_State *L)
-{
+	assert(udata->shared == NULL && bn->d == NULL);
 
-	return h_mul(L, "bn.mul", false);
+	udata->shared = sh;
+	bn->d = sh->bignum.d;
+	bn->top = bn->dmax = sh->bignum.top;
+	bn->neg = sh->bignum.neg;
+	BN_set_flags(bn, BN_FLG_STATIC_DATA);
 }
 
 static int
-h_div(lua_State *L, const char *errmsg, bool ismt)
+f_share(lua_State *L)
 {
-	BIGNUM *bn[3]; /* bn[0] = bn[1] / bn[2] */
-	BN_CTX *ctx;
-	BN_ULONG n, rem;
-	lua_Number d;
-	int status;
+	struct shared *sh, *old, **p;
+	const char *name;
+	BIGNUM *bn;
+	size_t len;
+	bool conflict;
 
-	/*
-	 * Unlike many other operations (e.g. BN_add or BN_mul),
-	 * documentation for BN_div doesn't specify that the result
-	 * may be the same variable as one of the operands.
-	 * Thus, always allocate a new BIGNUM object for the result.
-	 */
-	bn[0] = newbignum(L);
+	name = luaL_checklstring(L, 1, &len);
+	bn = tobignum(L, 2);
 
-	n = 0;
-	status = 0;
+	if (strlen(name) != len)
+		return luaL_argerror(L, 1, "name contains zeroes");
 
-	if ((bn[2] = testbignum(L, 2)) != NULL) {
-		bn[1] = luaBn_tobignum(L, 1);
-	} else {
-		if (ismt) {
-			assert(testbignum(L, 1) != NULL);
-			bn[1] = &getbn(L, 1)->bignum;
-		} else {
-			bn[1] = luaBn_tobignum(L, 1);
-		}
+	newbignum(L);
 
-		d = lua_tonumber(L, 2);
-		n = absnumber(d);
+	sh = (struct shared *)malloc(sizeof(struct shared) + len + 1);
+	if (sh == NULL)
+		return bnerror(L, "bn.share: no memory");
 
-		if (n == 0) {
-			bn[2] = luaBn_tobignum(L, 2);
-		} else if (BN_copy(bn[0], bn[1])) {
-			if (-d > 0)
-				negatebignum(bn[0]);
-			rem = BN_div_word(bn[0], n);
-			/*
-			 * Code inspection shows that BN_div_word() doesn't
-			 * set error only when n == 0. Therefore, bnerror()
-			 * call is valid if BN_div_word() fails.
-			 */
-			status = (rem != (BN_ULONG)-1);
-		}
+	memcpy(sh->name, name, len + 1);
+	sh->next = NULL;
+	sh->mont = NULL;
+	sh->refcnt = 2; /* The store and the handle. */
+	BN_init(&sh->bignum);
+
+	if (!BN_copy(&sh->bignum, bn)) {
+		shared_free(sh);
+		return bnerror(L, "bn.share");
 	}
 
-	if (n == 0) {
-		ctx = get_ctx_val(L);
-		status = BN_div(bn[0], NULL, bn[1], bn[2], ctx);
+	pthread_mutex_lock(&shared_lock);
+
+	p = shared_lookup(name);
+	old = *p;
+	conflict = (old != NULL && BN_cmp(&old->bignum, &sh->bignum) != 0);
+
+	if (old == NULL)
+		*p = sh;
+	else if (!conflict)
+		old->refcnt++;
+
+	pthread_mutex_unlock(&shared_lock);
+
+	if (old != NULL) {
+		shared_free(sh);
+		if (conflict) {
+			return luaL_error(L, "bn.share: %s is already "
+			    "shared with a different value", name);
+		}
+		sh = old;
 	}
 
-	if (status == 0)
-		return bnerror(L, errmsg);
+	setshared(L, sh);
 
 	return 1;
 }
 
 static int
-mt_div(lua_State *L)
+f_shared(lua_State *L)
 {
+	struct shared *sh;
+	const char *name;
 
-	return h_div(L, BN_METATABLE ".__div", true);
-}
+	name = luaL_checkstring(L, 1);
 
-static int
-f_div(lua_State *L)
-{
+	newbignum(L);
 
-	return h_div(L, "bn.div", false);
+	pthread_mutex_lock(&shared_lock);
+	if ((sh = *shared_lookup(name)) != NULL)
+		sh->refcnt++;
+	pthread_mutex_unlock(&shared_lock);
+
+	if (sh == NULL)
+		lua_pushnil(L);
+	else
+		setshared(L, sh);
+
+	return 1;
 }
 
 static int
-mt_mod(lua_State *L)
+f_unshare(lua_State *L)
 {
-	BIGNUM *bn[3]; /* bn[0] = bn[1] % bn[2] */
-	BN_CTX *ctx;
-	BN_ULONG n, rem;
-	lua_Number d;
-	int status;
+	struct shared *sh, **p;
+	const char *name;
 
-	/*
-	 * Unlike many other operations (e.g. BN_add or BN_mul),
-	 * documentation for BN_div doesn't specify that the result
-	 * may be the same variable as one of the operands.
-	 * Thus, always allocate a new BIGNUM object for the result.
-	 */
-	bn[0] = newbignum(L);
+	name = luaL_checkstring(L, 1);
 
-	n = 0;
-	status = 0;
+	pthread_mutex_lock(&shared_lock);
+	p = shared_lookup(name);
+	if ((sh = *p) != NULL)
+		*p = sh->next;
+	pthread_mutex_unlock(&shared_lock);
 
-	if ((bn[2] = testbignum(L, 2)) != NULL) {
-		bn[1] = luaBn_tobignum(L, 1);
-	} else {
-		assert(testbignum(L, 1) != NULL);
-		bn[1] = &getbn(L, 1)->bignum;
+	if (sh != NULL)
+		shared_release(sh);
 
-		d = lua_tonumber(L, 2);
-		n = absnumber(d);
+	lua_pushboolean(L, sh != NULL);
 
-		if (n == 0) {
-			bn[2] = luaBn_tobignum(L, 2);
-		} else {
-			rem = BN_mod_word(bn[1], n);
-			/*
-			 * Code inspection shows that BN_mod_word() never
-			 * fails for n != 0.
-			 */
-			assert(rem < n);
-			status = BN_set_word(bn[0], rem);
-			if (status != 0)
-				BN_set_negative(bn[0], BN_is_negative(bn[1]));
-		}
-	}
+	return 1;
+}
 
-	if (n == 0) {
-		ctx = get_ctx_val(L);
-		status = BN_div(NULL, bn[0], bn[1], bn[2], ctx);
-	}
+static int
+f_isshared(lua_State *L)
+{
 
-	if (status == 0)
-		return bnerror(L, BN_METATABLE ".__mod");
+	lua_pushboolean(L, checkbn(L, 1)->shared != NULL);
 
 	return 1;
 }
 
-static int
-f_cmp(lua_State *L)
+#ifdef LUABN_STATS
+static inline int
+log2bucket(double x)
 {
-	BIGNUM *a, *b;
-
-	a = luaBn_tobignum(L, 1);
-	b = luaBn_tobignum(L, 2);
+	int i;
 
-	lua_pushinteger(L, BN_cmp(a, b));
+	for (i = 0; i < STATS_BUCKETS - 1 && x >= 2; i++)
+		x /= 2;
 
-	return 1;
+	return i;
 }
 
+/*
+ * Calls a function of funcstats in the last upvalue. The function
+ * sees the same NUPVALUES upvalues. Calls which raise an error are
+ * counted but they don't get to histograms.
+ */
 static int
-f_ucmp(lua_State *L)
+statcall(lua_State *L)
 {
-	BIGNUM *a, *b;
+	struct funcstats *fs;
+	struct stats *st;
+	struct timespec t0, t1;
+	BIGNUM *bn;
+	double ns;
+	int i, nres, bits, top;
 
-	a = luaBn_tobignum(L, 1);
-	b = luaBn_tobignum(L, 2);
+	fs = (struct funcstats *)lua_touserdata(L,
+	    lua_upvalueindex(NUPVALUES + 1));
+	st = &get_ctxval(L)->stats;
 
-	lua_pushinteger(L, BN_ucmp(a, b));
+	if (!st->enabled)
+		return fs->func(L);
 
-	return 1;
+	top = lua_gettop(L);
+	for (i = 1, bits = 0; i <= top; i++) {
+		if ((bn = testbignum(L, i)) != NULL && BN_num_bits(bn) > bits)
+			bits = BN_num_bits(bn);
+	}
+
+	fs->calls++;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	nres = fs->func(L);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+	fs->time += ns * 1e-9;
+	fs->latency[log2bucket(ns)]++;
+	fs->sizes[log2bucket(bits)]++;
+
+	return nres;
 }
 
-static int
-f_gcd(lua_State *L)
+/* Unique key of a table in the Lua registry which anchors funcstats. */
+static char funcstats_key;
+
+/*
+ * Pushes a new funcstats object for function f called prefix..name
+ * and links it to stats of ctxval at index ctx. The object is also
+ * stored in a registry table because the list in ctxval outlives
+ * closures which may be replaced and collected.
+ */
+static void
+newfuncstats(lua_State *L, lua_CFunction f, const char *prefix,
+    const char *name, int ctx)
 {
-	BIGNUM *bn[3]; /* bn[0] = gcd(bn[1], bn[2]) */
-	BN_CTX *ctx;
+	struct funcstats *fs;
+	struct stats *st;
 
-	bn3(L, bn);
+	st = &((struct ctxval *)lua_touserdata(L, ctx))->stats;
 
-	ctx = get_ctx_val(L);
+	fs = (struct funcstats *)lua_newuserdata(L, sizeof(*fs));
+	memset(fs, 0, sizeof(*fs));
+	fs->func = f;
+	snprintf(fs->name, sizeof(fs->name), "%s%s", prefix, name);
 
-	if (!BN_gcd(bn[0], bn[1], bn[2], ctx))
-		return bnerror(L, "bn.gcd");
+	pushregtable(L, &funcstats_key, NULL);
+	lua_pushvalue(L, -2);
+	lua_pushboolean(L, 1);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
 
-	return 1;
+	fs->next = st->funcs;
+	st->funcs = fs;
 }
 
-static int
-f_isneg(lua_State *L)
+/* Pushes a table with non-zero counts of buckets. */
+static void
+pushbuckets(lua_State *L, const unsigned long *buckets)
 {
-	BIGNUM *bn;
-
-	bn = luaBn_tobignum(L, 1);
-	lua_pushboolean(L, BN_is_negative(bn) != 0);
+	int i;
 
-	return 1;
+	lua_newtable(L);
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		if (buckets[i] != 0) {
+			lua_pushinteger(L, (lua_Integer)buckets[i]);
+			lua_rawseti(L, -2, i);
+		}
+	}
 }
 
+#define SETCOUNTER(L, st, field) do {					\
+	lua_pushinteger((L), (lua_Integer)(st)->field);			\
+	lua_setfield((L), -2, #field);					\
+} while (0)
+
 static int
-f_iseven(lua_State *L)
+f_stats(lua_State *L)
 {
-	BIGNUM *bn;
+	struct funcstats *fs;
+	struct stats *st;
 
-	bn = luaBn_tobignum(L, 1);
-	lua_pushboolean(L, BN_is_odd(bn) == 0);
+	st = &get_ctxval(L)->stats;
+
+	lua_newtable(L);
+
+	lua_pushboolean(L, st->enabled);
+	lua_setfield(L, -2, "enabled");
+	SETCOUNTER(L, st, created);
+	SETCOUNTER(L, st, collected);
+	SETCOUNTER(L, st, ctx);
+
+	lua_newtable(L);
+	SETCOUNTER(L, st, numbers);
+	SETCOUNTER(L, st, strings);
+	SETCOUNTER(L, st, fixed);
+	lua_setfield(L, -2, "conversions");
+
+	lua_newtable(L);
+	for (fs = st->funcs; fs != NULL; fs = fs->next) {
+		if (fs->calls == 0)
+			continue;
+		lua_newtable(L);
+		SETCOUNTER(L, fs, calls);
+		lua_pushnumber(L, fs->time);
+		lua_setfield(L, -2, "time");
+		pushbuckets(L, fs->latency);
+		lua_setfield(L, -2, "latency");
+		pushbuckets(L, fs->sizes);
+		lua_setfield(L, -2, "sizes");
+		lua_setfield(L, -2, fs->name);
+	}
+	lua_setfield(L, -2, "functions");
 
 	return 1;
 }
 
 static int
-f_isodd(lua_State *L)
+f_stats_reset(lua_State *L)
 {
-	BIGNUM *bn;
+	struct funcstats *fs;
+	struct stats *st;
 
-	bn = luaBn_tobignum(L, 1);
-	lua_pushboolean(L, BN_is_odd(bn) != 0);
+	st = &get_ctxval(L)->stats;
 
-	return 1;
+	for (fs = st->funcs; fs != NULL; fs = fs->next) {
+		fs->time = 0;
+		fs->calls = 0;
+		memset(fs->latency, 0, sizeof(fs->latency));
+		memset(fs->sizes, 0, sizeof(fs->sizes));
+	}
+
+	st->numbers = st->strings = st->fixed = 0;
+	st->created = st->collected = st->ctx = 0;
+
+	return 0;
 }
 
 static int
-f_isone(lua_State *L)
+f_stats_enable(lua_State *L)
 {
-	BIGNUM *bn;
+	struct stats *st;
 
-	bn = luaBn_tobignum(L, 1);
-	lua_pushboolean(L, BN_is_one(bn));
+	st = &get_ctxval(L)->stats;
+
+	lua_pushboolean(L, st->enabled);
+	if (!lua_isnoneornil(L, 1))
+		st->enabled = lua_toboolean(L, 1);
 
 	return 1;
 }
-
+#else
 static int
-f_iszero(lua_State *L)
+f_stats(lua_State *L)
 {
-	BIGNUM *bn;
-
-	bn = luaBn_tobignum(L, 1);
-	lua_pushboolean(L, BN_is_zero(bn));
 
+	lua_pushnil(L);
 	return 1;
 }
 
 static int
-f_eq(lua_State *L)
+f_stats_reset(lua_State *L)
 {
-	BIGNUM *bn[3]; /* bn[1] == bn[2] */
-	lua_Number d;
-	BN_ULONG n;
-	bool isneg, res;
-	int narg;
-
-	narg = 0;
-
-	if ((bn[2] = testbignum(L, 2)) == NULL)
-		narg = 2;
 
-	if ((bn[1] = testbignum(L, 1)) == NULL) {
-		narg = 1;
-		if (bn[2] == NULL)
-			bn[2] = luaBn_tobignum(L, 2);
-	}
-
-	if (narg != 0) {
-		d = lua_tonumber(L, narg);
-		n = absnumber(d);
-
-		if (n == 0) {
-			bn[narg] = luaBn_tobignum(L, narg);
-			narg = 0;
-		} else {
-			isneg = BN_is_negative(bn[3-narg]);
-			res = (isneg == (d < 0));
-			if (res) {
-				BN_set_negative(bn[3-narg], false);
-				res &= BN_is_word(bn[3-narg], n);
-				BN_set_negative(bn[3-narg], isneg);
-			}
-		}
-	}
-
-	if (narg == 0)
-		res = (BN_cmp(bn[1], bn[2]) == 0);
+	(void)L;
+	return 0;
+}
 
-	lua_pushboolean(L, res);
+static int
+f_stats_enable(lua_State *L)
+{
 
+	lua_pushboolean(L, false);
 	return 1;
 }
+#endif
 
 static int
-f_modadd(lua_State *L)
+gcbn(lua_State *L)
 {
-	BIGNUM *mod;
-	BIGNUM *bn[3]; /* bn[0] = bn[1] + bn[2] modulo mod */
-	BN_CTX *ctx;
+	struct BN *udata;
 
-	bn[0] = newbignum(L);
+	udata = checkbn(L, 1);
 
-	bn[1] = luaBn_tobignum(L, 1);
-	bn[2] = luaBn_tobignum(L, 2);
-	mod   = luaBn_tobignum(L, 3);
+	STATS_INC(L, collected);
 
-	ctx = get_ctx_val(L);
+	BN_free(&udata->bignum);
+	if (udata->str != NULL)
+		OPENSSL_free(udata->str);
+	if (udata->key != NULL)
+		OPENSSL_free(udata->key);
+	udata->key = NULL;
+	if (udata->shared != NULL)
+		shared_release(udata->shared);
+	udata->shared = NULL;
 
-	if (!BN_mod_add(bn[0], bn[1], bn[2], mod, ctx))
-		return bnerror(L, "bn.modadd");
+	lua_pushnil(L);
+	lua_setmetatable(L, 1);
 
-	return 1;
+	return 0;
 }
 
 static int
-f_modsub(lua_State *L)
+gcctx(lua_State *L)
 {
-	BIGNUM *mod;
-	BIGNUM *bn[3]; /* bn[0] = bn[1] - bn[2] modulo mod */
-	BN_CTX *ctx;
+	struct ctxval *udata;
+	int i;
 
-	bn[0] = newbignum(L);
+	udata = (struct ctxval *)luaL_checkudata(L, 1, CTX_METATABLE);
 
-	bn[1] = luaBn_tobignum(L, 1);
-	bn[2] = luaBn_tobignum(L, 2);
-	mod   = luaBn_tobignum(L, 3);
+	if (udata->ctx != NULL)
+		BN_CTX_free(udata->ctx);
+	for (i = 0; i < POW10_CACHE; i++) {
+		if (udata->pow10[i] != NULL)
+			BN_free(udata->pow10[i]);
+	}
 
-	ctx = get_ctx_val(L);
+	lua_pushnil(L);
+	lua_setmetatable(L, 1);
 
-	if (!BN_mod_sub(bn[0], bn[1], bn[2], mod, ctx))
-		return bnerror(L, "bn.modsub");
+	return 0;
+}
 
-	return 1;
+/*
+ * C interface which doesn't depend on Lua stack. It's designed to be
+ * called from LuaJIT FFI but it can be used from C as well.
+ * Functions return 0 on error (including memory errors), like BN functions.
+ */
+
+BIGNUM *
+luaBn_new(void)
+{
+
+	return BN_new();
 }
 
-static int
-f_modmul(lua_State *L)
+void
+luaBn_free(BIGNUM *a)
 {
-	BIGNUM *mod;
-	BIGNUM *bn[3]; /* bn[0] = bn[1] * bn[2] modulo mod */
-	BN_CTX *ctx;
 
-	bn3(L, bn);
+	BN_free(a);
+}
 
-	mod = luaBn_tobignum(L, 3);
+BN_CTX *
+luaBn_ctx_new(void)
+{
 
-	ctx = get_ctx_val(L);
+	return BN_CTX_new();
+}
 
-	if (!BN_mod_mul(bn[0], bn[1], bn[2], mod, ctx))
-		return bnerror(L, "bn.modmul");
+void
+luaBn_ctx_free(BN_CTX *ctx)
+{
 
-	return 1;
+	BN_CTX_free(ctx);
 }
 
-static int
-f_modpow(lua_State *L)
+int
+luaBn_copy(BIGNUM *r, const BIGNUM *a)
 {
-	BIGNUM *mod;
-	BIGNUM *bn[3]; /* bn[0] = bn[1] ^ bn[2] modulo mod */
-	BN_CTX *ctx;
 
-	bn[0] = newbignum(L);
-	bn[1] = luaBn_tobignum(L, 1);
-	bn[2] = luaBn_tobignum(L, 2);
-	mod   = luaBn_tobignum(L, 3);
+	return BN_copy(r, a) != NULL;
+}
 
-	ctx = get_ctx_val(L);
+int
+luaBn_setint(BIGNUM *r, int64_t v)
+{
+	uint64_t u;
 
-	if (!BN_mod_exp(bn[0], bn[1], bn[2], mod, ctx))
-		return bnerror(L, "bn.modpow");
+	u = (v < 0) ? 0u - (uint64_t)v : (uint64_t)v;
+	if (!setumax(r, u))
+		return 0;
 
+	BN_set_negative(r, v < 0);
 	return 1;
 }
 
-static int
-f_modsqr(lua_State *L)
+int
+luaBn_getint(const BIGNUM *a, int64_t *v)
 {
-	BIGNUM *mod;
-	BIGNUM *bn[2]; /* bn[0] = sqr(bn[1]) modulo mod */
-	BN_CTX *ctx;
-
-	bn[0] = newbignum(L);
-	bn[1] = luaBn_tobignum(L, 1);
-	mod   = luaBn_tobignum(L, 2);
+	uintmax_t u;
 
-	ctx = get_ctx_val(L);
+	if (!getumax(a, &u))
+		return 0;
 
-	if (!BN_mod_sqr(bn[0], bn[1], mod, ctx))
-		return bnerror(L, "bn.modsqr");
+	if (BN_is_negative(a) && u - 1 <= (uintmax_t)INT64_MAX)
+		*v = (int64_t)(0u - (uint64_t)u);
+	else if (!BN_is_negative(a) && u <= (uintmax_t)INT64_MAX)
+		*v = (int64_t)u;
+	else
+		return 0;
 
 	return 1;
 }
 
-static int
-f_nnmod(lua_State *L)
+int
+luaBn_cmp(const BIGNUM *a, const BIGNUM *b)
 {
-	BIGNUM *mod;
-	BIGNUM *bn[2]; /* bn[0] = nnmod(bn[1], mod) */
-	BN_CTX *ctx;
 
-	bn[0] = newbignum(L);
-	bn[1] = luaBn_tobignum(L, 1);
-	mod   = luaBn_tobignum(L, 2);
+	return BN_cmp(a, b);
+}
 
-	ctx = get_ctx_val(L);
+int
+luaBn_ucmp(const BIGNUM *a, const BIGNUM *b)
+{
 
-	if (!BN_nnmod(bn[0], bn[1], mod, ctx))
-		return bnerror(L, "bn.nnmod");
+	return BN_ucmp(a, b);
+}
 
-	return 1;
+int
+luaBn_add(BIGNUM *r, const BIGNUM *a, const BIGNUM *b)
+{
+
+	return BN_add(r, a, b);
 }
 
-static int
-mt_pow(lua_State *L)
+int
+luaBn_sub(BIGNUM *r, const BIGNUM *a, const BIGNUM *b)
 {
-	BIGNUM *bn[3]; /* bn[0] = bn[1] ^ bn[2] */
-	BN_CTX *ctx;
 
-	/*
-	 * BN_exp doesn't specify that the result may be the same variable
-	 * as one of the operands and there is no BN_exp_word.
-	 * These two facts don't leave any room for optimization.
-	 */
-	bn[0] = newbignum(L);
-	bn[1] = luaBn_tobignum(L, 1);
-	bn[2] = luaBn_tobignum(L, 2);
+	return BN_sub(r, a, b);
+}
 
-	ctx = get_ctx_val(L);
+int
+luaBn_mul(BIGNUM *r, const BIGNUM *a, const BIGNUM *b, BN_CTX *ctx)
+{
+
+	return bigmul(r, a, b, &default_mulparams, ctx);
+}
 
-	if (!BN_exp(bn[0], bn[1], bn[2], ctx))
-		return bnerror(L, BN_METATABLE ".pow");
+int
+luaBn_sqr(BIGNUM *r, const BIGNUM *a, BN_CTX *ctx)
+{
 
-	return 1;
+	return bigmul(r, a, a, &default_mulparams, ctx);
 }
 
-static int
-f_sqr(lua_State *L)
+/*
+ * Documentation for BN_div doesn't specify that the result may be
+ * the same variable as one of the operands. Use a temporary variable
+ * from ctx in that case.
+ */
+int
+luaBn_div(BIGNUM *r, const BIGNUM *a, const BIGNUM *b, BN_CTX *ctx)
 {
-	BIGNUM *r, *bn;
-	BN_CTX *ctx;
+	BIGNUM *t;
+	int status;
 
-	if ((bn = testbignum(L, 1)) != NULL) {
-		r = newbignum(L);
-	} else {
-		bn = r = luaBn_tobignum(L, 1);
-		lua_pushvalue(L, 1);
-	}
+	BN_CTX_start(ctx);
+	t = (r == a || r == b) ? BN_CTX_get(ctx) : r;
+	status = (t != NULL && BN_div(t, NULL, a, b, ctx) &&
+	    (t == r || BN_copy(r, t) != NULL));
+	BN_CTX_end(ctx);
 
-	ctx = get_ctx_val(L);
+	return status;
+}
 
-	if (!BN_sqr(r, bn, ctx))
-		return bnerror(L, "bn.sqr");
+int
+luaBn_mod(BIGNUM *r, const BIGNUM *a, const BIGNUM *b, BN_CTX *ctx)
+{
+	BIGNUM *t;
+	int status;
 
-	return 1;
+	BN_CTX_start(ctx);
+	t = (r == a || r == b) ? BN_CTX_get(ctx) : r;
+	status = (t != NULL && BN_div(NULL, t, a, b, ctx) &&
+	    (t == r || BN_copy(r, t) != NULL));
+	BN_CTX_end(ctx);
+
+	return status;
 }
 
-static int
-f_swap(lua_State *L)
+int
+luaBn_nnmod(BIGNUM *r, const BIGNUM *a, const BIGNUM *m, BN_CTX *ctx)
 {
-	BIGNUM *a, *b;
-	int i;
+	BIGNUM *t;
+	int status;
 
-	for (i = 1; i <= 2; i++) {
-		if (testbignum(L, i) == NULL)
-			return typerror(L, i, BN_METATABLE);
-	}
+	BN_CTX_start(ctx);
+	t = (r == a || r == m) ? BN_CTX_get(ctx) : r;
+	status = (t != NULL && BN_nnmod(t, a, m, ctx) &&
+	    (t == r || BN_copy(r, t) != NULL));
+	BN_CTX_end(ctx);
+
+	return status;
+}
 
-	a = &getbn(L, 1)->bignum;
-	b = &getbn(L, 2)->bignum;
+/*
+ * BN_mod_add and friends reduce the result in place, so it can't be
+ * the same variable as the modulus.
+ */
+int
+luaBn_modadd(BIGNUM *r, const BIGNUM *a, const BIGNUM *b,
+    const BIGNUM *m, BN_CTX *ctx)
+{
+	BIGNUM *t;
+	int status;
 
-	BN_swap(a, b);
+	BN_CTX_start(ctx);
+	t = (r == m) ? BN_CTX_get(ctx) : r;
+	status = (t != NULL && BN_mod_add(t, a, b, m, ctx) &&
+	    (t == r || BN_copy(r, t) != NULL));
+	BN_CTX_end(ctx);
 
-	return 0;
+	return status;
 }
 
-static int
-gcbn(lua_State *L)
+int
+luaBn_modsub(BIGNUM *r, const BIGNUM *a, const BIGNUM *b,
+    const BIGNUM *m, BN_CTX *ctx)
 {
-	struct BN *udata;
+	BIGNUM *t;
+	int status;
 
-	udata = checkbn(L, 1);
+	BN_CTX_start(ctx);
+	t = (r == m) ? BN_CTX_get(ctx) : r;
+	status = (t != NULL && BN_mod_sub(t, a, b, m, ctx) &&
+	    (t == r || BN_copy(r, t) != NULL));
+	BN_CTX_end(ctx);
 
-	BN_free(&udata->bignum);
-	if (udata->str != NULL)
-		OPENSSL_free(udata->str);
+	return status;
+}
 
-	lua_pushnil(L);
-	lua_setmetatable(L, 1);
+int
+luaBn_modmul(BIGNUM *r, const BIGNUM *a, const BIGNUM *b,
+    const BIGNUM *m, BN_CTX *ctx)
+{
+	BIGNUM *t;
+	int status;
 
-	return 0;
+	BN_CTX_start(ctx);
+	t = (r == m) ? BN_CTX_get(ctx) : r;
+	status = (t != NULL && BN_mod_mul(t, a, b, m, ctx) &&
+	    (t == r || BN_copy(r, t) != NULL));
+	BN_CTX_end(ctx);
+
+	return status;
 }
 
-static int
-gcctx(lua_State *L)
+int
+luaBn_modpow(BIGNUM *r, const BIGNUM *a, const BIGNUM *p,
+    const BIGNUM *m, BN_CTX *ctx)
+{
+	BIGNUM *t;
+	int status;
+
+	BN_CTX_start(ctx);
+	t = (r == a || r == p || r == m) ? BN_CTX_get(ctx) : r;
+	status = (t != NULL && BN_mod_exp(t, a, p, m, ctx) &&
+	    (t == r || BN_copy(r, t) != NULL));
+	BN_CTX_end(ctx);
+
+	return status;
+}
+
+/* INT_MIN can't be negated, such a shift fails. */
+int
+luaBn_lshift(BIGNUM *r, const BIGNUM *a, int n)
 {
-	BN_CTX **udata;
 
-	udata = (BN_CTX **)luaL_checkudata(L, 1, CTX_METATABLE);
+	if (n == INT_MIN)
+		return 0;
 
-	if (*udata != NULL)
-		BN_CTX_free(*udata);
+	return (n >= 0) ? BN_lshift(r, a, n) : BN_rshift(r, a, -n);
+}
 
-	lua_pushnil(L);
-	lua_setmetatable(L, 1);
+int
+luaBn_rshift(BIGNUM *r, const BIGNUM *a, int n)
+{
 
-	return 0;
+	if (n == INT_MIN)
+		return 0;
+
+	return (n >= 0) ? BN_rshift(r, a, n) : BN_lshift(r, a, -n);
 }
 
 static luaL_Reg bn_metafunctions[] = {
@@ -1127,12 +8916,22 @@ static luaL_Reg bn_metafunctions[] = {
 	{ "__div",      mt_div     },
 	{ "__eq",       mt_eq      },
 	{ "__lt",       mt_lt      },
+	{ "__le",       mt_le      },
 	{ "__mod",      mt_mod     },
 	{ "__mul",      mt_mul     },
 	{ "__pow",      mt_pow     },
 	{ "__sub",      mt_sub     },
 	{ "__unm",      mt_unm     },
 	{ "__tostring", m_tostring },
+#if LUA_VERSION_NUM >= 503
+	{ "__band",     f_band     },
+	{ "__bor",      f_bor      },
+	{ "__bxor",     f_bxor     },
+	{ "__bnot",     f_bnot     },
+	{ "__shl",      f_lshift   },
+	{ "__shr",      f_rshift   },
+	{ "__idiv",     f_idiv     },
+#endif
 	{ NULL, NULL}
 };
 
@@ -1141,9 +8940,26 @@ static luaL_Reg bn_methods[] = {
 	{ "div",      f_div      },
 	{ "mul",      f_mul      },
 	{ "sub",      f_sub      },
+	{ "band",     f_band     },
+	{ "bor",      f_bor      },
+	{ "bxor",     f_bxor     },
+	{ "bnot",     f_bnot     },
+	{ "lshift",   f_lshift   },
+	{ "rshift",   f_rshift   },
+	{ "testbit",  f_testbit  },
+	{ "setbit",   f_setbit   },
+	{ "clearbit", f_clearbit },
+	{ "numbits",  f_numbits  },
+	{ "popcount", f_popcount },
+	{ "idiv",     f_idiv     },
 	{ "cmp",      f_cmp      },
 	{ "ucmp",     f_ucmp     },
 	{ "gcd",      f_gcd      },
+	{ "gcdext",   f_gcdext   },
+	{ "lcm",      f_lcm      },
+	{ "modinv",   f_modinv   },
+	{ "modsqrt",  f_modsqrt  },
+	{ "jacobi",   f_jacobi   },
 	{ "isneg",    f_isneg    },
 	{ "iseven",   f_iseven   },
 	{ "isodd",    f_isodd    },
@@ -1157,8 +8973,15 @@ static luaL_Reg bn_methods[] = {
 	{ "modsqr",   f_modsqr   },
 	{ "nnmod",    f_nnmod    },
 	{ "sqr",      f_sqr      },
+	{ "pow",      f_pow      },
+	{ "sqrt",     f_sqrt     },
+	{ "root",     f_root     },
+	{ "isprime",  f_isprime  },
 	{ "swap",     f_swap     },
+	{ "isshared", f_isshared },
+	{ "key",      f_key      },
 	{ "tobin",    f_tobin    },
+	{ "tointeger", f_tointeger },
 	{ "tostring", m_tostring },
 	{ NULL, NULL}
 };
@@ -1168,9 +8991,26 @@ static luaL_Reg bn_functions[] = {
 	{ "div",      f_div      },
 	{ "mul",      f_mul      },
 	{ "sub",      f_sub      },
+	{ "band",     f_band     },
+	{ "bor",      f_bor      },
+	{ "bxor",     f_bxor     },
+	{ "bnot",     f_bnot     },
+	{ "lshift",   f_lshift   },
+	{ "rshift",   f_rshift   },
+	{ "testbit",  f_testbit  },
+	{ "setbit",   f_setbit   },
+	{ "clearbit", f_clearbit },
+	{ "numbits",  f_numbits  },
+	{ "popcount", f_popcount },
+	{ "idiv",     f_idiv     },
 	{ "cmp",      f_cmp      },
 	{ "ucmp",     f_ucmp     },
 	{ "gcd",      f_gcd      },
+	{ "gcdext",   f_gcdext   },
+	{ "lcm",      f_lcm      },
+	{ "modinv",   f_modinv   },
+	{ "modsqrt",  f_modsqrt  },
+	{ "jacobi",   f_jacobi   },
 	{ "isneg",    f_isneg    },
 	{ "iseven",   f_iseven   },
 	{ "isodd",    f_isodd    },
@@ -1184,8 +9024,138 @@ static luaL_Reg bn_functions[] = {
 	{ "modsqr",   f_modsqr   },
 	{ "nnmod",    f_nnmod    },
 	{ "sqr",      f_sqr      },
+	{ "pow",      f_pow      },
+	{ "sqrt",     f_sqrt     },
+	{ "sqrtrem",  f_sqrtrem  },
+	{ "root",     f_root     },
+	{ "isperfectpower", f_isperfectpower },
+	{ "isprime",  f_isprime  },
+	{ "nextprime", f_nextprime },
+	{ "genprime", f_genprime },
+	{ "rand",     f_rand     },
+	{ "rand_range", f_rand_range },
+	{ "rand_vector", f_rand_vector },
 	{ "swap",     f_swap     },
 	{ "number",   f_number   },
+	{ "tointeger", f_tointeger },
+	{ "parse_all", f_parse_all },
+	{ "lines",    f_lines    },
+	{ "multhresholds", f_multhresholds },
+	{ "prod",     f_prod     },
+	{ "sum",      f_sum      },
+	{ "dot",      f_dot      },
+	{ "min",      f_min      },
+	{ "max",      f_max      },
+	{ "argmax",   f_argmax   },
+	{ "sort",     f_sort     },
+	{ "unique",   f_unique   },
+	{ "bsearch",  f_bsearch  },
+	{ "factorial", f_factorial },
+	{ "binomial", f_binomial },
+	{ "batchgcd", f_batchgcd },
+	{ "crtctx",   f_crtctx   },
+	{ "jacobi_many", f_jacobi_many },
+	{ "u256",     f_u256_new },
+	{ "u384",     f_u384_new },
+	{ "u512",     f_u512_new },
+	{ "share",    f_share    },
+	{ "shared",   f_shared   },
+	{ "unshare",  f_unshare  },
+	{ "isshared", f_isshared },
+	{ "key",      f_key      },
+	{ "intern",   f_intern   },
+	{ "lazy",     f_lazy     },
+	{ "rational", f_rational },
+	{ "curve",    f_curve    },
+	{ "stats",    f_stats    },
+	{ "stats_reset",  f_stats_reset  },
+	{ "stats_enable", f_stats_enable },
+	{ NULL, NULL}
+};
+
+static luaL_Reg crt_metafunctions[] = {
+	{ "__gc",     gccrtctx   },
+	{ NULL, NULL}
+};
+
+static luaL_Reg crt_methods[] = {
+	{ "combine",  m_crt_combine },
+	{ "split",    m_crt_split },
+	{ "modulus",  m_crt_modulus },
+	{ NULL, NULL}
+};
+
+static luaL_Reg lazy_metafunctions[] = {
+	{ "__add",      mt_lazy_add      },
+	{ "__sub",      mt_lazy_sub      },
+	{ "__mul",      mt_lazy_mul      },
+	{ "__div",      mt_lazy_div      },
+	{ "__mod",      mt_lazy_mod      },
+	{ "__pow",      mt_lazy_pow      },
+	{ "__unm",      mt_lazy_unm      },
+	{ "__tostring", mt_lazy_tostring },
+	{ NULL, NULL}
+};
+
+static luaL_Reg lazy_methods[] = {
+	{ "eval",     m_lazy_eval },
+	{ NULL, NULL}
+};
+
+static luaL_Reg rat_metafunctions[] = {
+	{ "__gc",       mt_rat_gc       },
+	{ "__add",      mt_rat_add      },
+	{ "__sub",      mt_rat_sub      },
+	{ "__mul",      mt_rat_mul      },
+	{ "__div",      mt_rat_div      },
+	{ "__mod",      mt_rat_mod      },
+	{ "__pow",      mt_rat_pow      },
+	{ "__unm",      mt_rat_unm      },
+	{ "__eq",       mt_rat_eq       },
+	{ "__lt",       mt_rat_lt       },
+	{ "__le",       mt_rat_le       },
+	{ "__tostring", mt_rat_tostring },
+	{ NULL, NULL}
+};
+
+static luaL_Reg rat_methods[] = {
+	{ "num",   m_rat_num   },
+	{ "den",   m_rat_den   },
+	{ "floor", m_rat_floor },
+	{ NULL, NULL}
+};
+
+static luaL_Reg curve_metafunctions[] = {
+	{ "__gc", gccurve },
+	{ NULL, NULL}
+};
+
+static luaL_Reg curve_methods[] = {
+	{ "point",      m_curve_point      },
+	{ "generator",  m_curve_generator  },
+	{ "params",     m_curve_params     },
+	{ "mul",        m_curve_mul        },
+	{ "mulsum",     m_curve_mulsum     },
+	{ "precompute", m_curve_precompute },
+	{ "affine",     m_curve_affine     },
+	{ NULL, NULL}
+};
+
+static luaL_Reg point_metafunctions[] = {
+	{ "__gc",       gcpoint           },
+	{ "__add",      mt_point_add      },
+	{ "__sub",      mt_point_sub      },
+	{ "__mul",      pointmul          },
+	{ "__unm",      mt_point_unm      },
+	{ "__eq",       mt_point_eq       },
+	{ "__tostring", mt_point_tostring },
+	{ NULL, NULL}
+};
+
+static luaL_Reg point_methods[] = {
+	{ "xy",         m_point_xy         },
+	{ "double",     m_point_double     },
+	{ "isinfinity", m_point_isinfinity },
 	{ NULL, NULL}
 };
 
@@ -1194,29 +9164,76 @@ static luaL_Reg ctx_metafunctions[] = {
 	{ NULL, NULL}
 };
 
+#if LUA_VERSION_NUM <= 501
+/* Same as luaL_setfuncs() in Lua 5.2. */
+static void
+setfuncs(lua_State *L, const luaL_Reg *l, int nup)
+{
+	int i;
+
+	for (; l->name != NULL; l++) {
+		for (i = 0; i < nup; i++)
+			lua_pushvalue(L, -nup);
+		lua_pushcclosure(L, l->func, nup);
+		lua_setfield(L, -(nup + 2), l->name);
+	}
+
+	lua_pop(L, nup);
+}
+#else
+#define setfuncs luaL_setfuncs
+#endif
+
+/*
+ * Registers functions in a table at the top of the stack. Unless
+ * upvalues is 0, all functions get NUPVALUES upvalues starting from
+ * index upvalues. With LUABN_STATS, these functions are wrapped and
+ * their statistics are reported under names prefix..name.
+ */
+static void
+register_funcs(lua_State *L, const luaL_Reg *l, int upvalues,
+    const char *prefix)
+{
+	int i, nup;
+
+	nup = (upvalues != 0) ? NUPVALUES : 0;
+
+#ifdef LUABN_STATS
+	for (; nup != 0 && l->name != NULL; l++) {
+		for (i = 0; i < nup; i++)
+			lua_pushvalue(L, upvalues + i);
+		newfuncstats(L, l->func, prefix, l->name, upvalues + 1);
+		lua_pushcclosure(L, statcall, nup + 1);
+		lua_setfield(L, -2, l->name);
+	}
+#else
+	(void)prefix;
+#endif
+
+	for (i = 0; i < nup; i++)
+		lua_pushvalue(L, upvalues + i);
+
+	setfuncs(L, l, nup);
+}
+
 static int
 register_udata(lua_State *L, const char *tname,
-    const luaL_Reg *metafunctions, const luaL_Reg *methods)
+    const luaL_Reg *metafunctions, const luaL_Reg *methods, int upvalues)
 {
+	char prefix[32];
 
 	luaL_newmetatable(L, tname);
 
 	if (metafunctions != NULL) {
-#if LUA_VERSION_NUM <= 501
-		luaL_register(L, NULL, metafunctions);
-#else
-		luaL_setfuncs(L, metafunctions, 0);
-#endif
+		snprintf(prefix, sizeof(prefix), "%s.", tname);
+		register_funcs(L, metafunctions, upvalues, prefix);
 	}
 
 	if (methods != NULL) {
 		lua_pushstring(L, "__index");
 		lua_newtable(L);
-#if LUA_VERSION_NUM <= 501
-		luaL_register(L, NULL, methods);
-#else
-		luaL_setfuncs(L, methods, 0);
-#endif
+		snprintf(prefix, sizeof(prefix), "%s:", tname);
+		register_funcs(L, methods, upvalues, prefix);
 		lua_rawset(L, -3);
 	}
 
@@ -1225,25 +9242,33 @@ register_udata(lua_State *L, const char *tname,
 	return 0;
 }
 
+/* Pushes a new BN_CTX object. */
 static void
 init_ctx_val(lua_State *L)
 {
-	BN_CTX **udata;
-
-	lua_pushlightuserdata(L, &ctx_key);
+	struct ctxval *udata;
+	int i;
 
 	/* Store a pointer to BN_CTX because it's incomplete type. */
-	udata = (BN_CTX **)lua_newuserdata(L, sizeof(BN_CTX *));
-	*udata = NULL;
+	udata = (struct ctxval *)lua_newuserdata(L, sizeof(struct ctxval));
+	udata->ctx = NULL;
+	udata->mul = default_mulparams;
+	for (i = 0; i < POW10_CACHE; i++)
+		udata->pow10[i] = NULL;
+#ifdef LUABN_STATS
+	memset(&udata->stats, 0, sizeof(udata->stats));
+#endif
 
 	luaL_getmetatable(L, CTX_METATABLE);
 	lua_setmetatable(L, -2);
 
-	lua_settable(L, LUA_REGISTRYINDEX);
-
-	*udata = BN_CTX_new();
-	if (*udata == NULL)
+	udata->ctx = BN_CTX_new();
+	if (udata->ctx == NULL)
 		bnerror(L, "BN_CTX_new in init_ctx_val");
+
+	if (RAND_bytes((unsigned char *)udata->hashkey,
+	    sizeof(udata->hashkey)) != 1)
+		bnerror(L, "RAND_bytes in init_ctx_val");
 }
 
 #if LUABN_UINT_MAX > ULONG_MAX
@@ -1259,26 +9284,75 @@ init_modulo_val(lua_State *L)
 
 	lua_pushlightuserdata(L, &modulo_key);
 	lua_pushlstring(L, buf, n);
-	bn = stringtobignum(L, -1);
+	luaL_getmetatable(L, BN_METATABLE);
+	bn = stringtobignum(L, -2, lua_gettop(L));
+	lua_pop(L, 1);
 	if (!BN_add_word(bn, 1))
 		bnerror(L, "BN_add_word in init_modulo_val");
 	lua_settable(L, LUA_REGISTRYINDEX);
 }
 #endif
 
+#if LUA_VERSION_NUM <= 501
+static luaL_Reg no_functions[] = {
+	{ NULL, NULL}
+};
+#endif
+
 int luaBn_open(lua_State *L)
 {
+	size_t i;
+	int upvalues;
+
+	pthread_once(&smallprimes_once, initsmallprimes);
+
+	/* RATOPERAND() tells bn.rational from bn.number by size. */
+	assert(sizeof(struct rational) != sizeof(struct BN));
+
+	register_udata(L, CTX_METATABLE, ctx_metafunctions, NULL, 0);
 
-	register_udata(L, BN_METATABLE, bn_metafunctions, bn_methods);
-	register_udata(L, CTX_METATABLE, ctx_metafunctions, NULL);
+	/*
+	 * Push BN_MT_UPVALUE, CTX_UPVALUE, fixedtypes metatables,
+	 * LAZY_MT_UPVALUE and RAT_MT_UPVALUE.
+	 */
+	luaL_newmetatable(L, BN_METATABLE);
+	upvalues = lua_gettop(L);
+	init_ctx_val(L);
+	for (i = 0; i < NFIXEDTYPES; i++)
+		luaL_newmetatable(L, fixedtypes[i].tname);
+	luaL_newmetatable(L, LAZY_METATABLE);
+	luaL_newmetatable(L, RAT_METATABLE);
+
+	register_udata(L, BN_METATABLE,
+	    bn_metafunctions, bn_methods, upvalues);
+	register_udata(L, fixedtypes[0].tname,
+	    u256_metafunctions, u256_methods, upvalues);
+	register_udata(L, fixedtypes[1].tname,
+	    u384_metafunctions, u384_methods, upvalues);
+	register_udata(L, fixedtypes[2].tname,
+	    u512_metafunctions, u512_methods, upvalues);
+	register_udata(L, CRT_METATABLE,
+	    crt_metafunctions, crt_methods, upvalues);
+	register_udata(L, LAZY_METATABLE,
+	    lazy_metafunctions, lazy_methods, upvalues);
+	register_udata(L, RAT_METATABLE,
+	    rat_metafunctions, rat_methods, upvalues);
+	register_udata(L, CURVE_METATABLE,
+	    curve_metafunctions, curve_methods, upvalues);
+	register_udata(L, POINT_METATABLE,
+	    point_metafunctions, point_methods, upvalues);
 
 #if LUA_VERSION_NUM <= 501
-	luaL_register(L, "bn", bn_functions);
+	luaL_register(L, "bn", no_functions);
 #else
-	luaL_newlib(L, bn_functions);
+	luaL_checkversion(L);
+	luaL_newlibtable(L, bn_functions);
 #endif
+	register_funcs(L, bn_functions, upvalues, "bn.");
 
-	init_ctx_val(L);
+	/* Leave only the module on the stack. */
+	lua_replace(L, upvalues);
+	lua_pop(L, NUPVALUES - 1);
 
 #if LUABN_UINT_MAX > ULONG_MAX
 	init_modulo_val(L);
@@ -1291,5 +9365,6 @@ int luaopen_bn(lua_State *L)
 {
 
 	ERR_load_BN_strings();
+	ERR_load_EC_strings();
 	return luaBn_open(L);
 }
@@ -33,8 +33,43 @@
 #include <lua.h>
 #include <openssl/bn.h>
 
+#include <stdint.h>
+
 int luaBn_open(lua_State *);
 int luaopen_bn(lua_State *);
 BIGNUM *luaBn_tobignum(lua_State *, int);
+BIGNUM *luaBn_testbignum(lua_State *, int);
+BIGNUM *luaBn_checkbignum(lua_State *, int);
+BIGNUM *luaBn_newbignum(lua_State *);
+BIGNUM *luaBn_pushbignum(lua_State *, const BIGNUM *);
+BIGNUM *luaBn_adoptbignum(lua_State *, BIGNUM *);
+
+/* Interface without Lua state, see luaBn-c-api(3). */
+BIGNUM *luaBn_new(void);
+void luaBn_free(BIGNUM *);
+BN_CTX *luaBn_ctx_new(void);
+void luaBn_ctx_free(BN_CTX *);
+int luaBn_copy(BIGNUM *, const BIGNUM *);
+int luaBn_setint(BIGNUM *, int64_t);
+int luaBn_getint(const BIGNUM *, int64_t *);
+int luaBn_cmp(const BIGNUM *, const BIGNUM *);
+int luaBn_ucmp(const BIGNUM *, const BIGNUM *);
+int luaBn_add(BIGNUM *, const BIGNUM *, const BIGNUM *);
+int luaBn_sub(BIGNUM *, const BIGNUM *, const BIGNUM *);
+int luaBn_mul(BIGNUM *, const BIGNUM *, const BIGNUM *, BN_CTX *);
+int luaBn_sqr(BIGNUM *, const BIGNUM *, BN_CTX *);
+int luaBn_div(BIGNUM *, const BIGNUM *, const BIGNUM *, BN_CTX *);
+int luaBn_mod(BIGNUM *, const BIGNUM *, const BIGNUM *, BN_CTX *);
+int luaBn_nnmod(BIGNUM *, const BIGNUM *, const BIGNUM *, BN_CTX *);
+int luaBn_modadd(BIGNUM *, const BIGNUM *, const BIGNUM *,
+    const BIGNUM *, BN_CTX *);
+int luaBn_modsub(BIGNUM *, const BIGNUM *, const BIGNUM *,
+    const BIGNUM *, BN_CTX *);
+int luaBn_modmul(BIGNUM *, const BIGNUM *, const BIGNUM *,
+    const BIGNUM *, BN_CTX *);
+int luaBn_modpow(BIGNUM *, const BIGNUM *, const BIGNUM *,
+    const BIGNUM *, BN_CTX *);
+int luaBn_lshift(BIGNUM *, const BIGNUM *, int);
+int luaBn_rshift(BIGNUM *, const BIGNUM *, int);
 
 #endif
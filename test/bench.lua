@@ -0,0 +1,75 @@
+-- bench/driver, bench/suite.lua and bench/compare.lua. The script
+-- needs the bench table of bench/driver.
+
+if not bench then
+	return
+end
+
+local bn = require "bn"
+
+local t0 = bench.clock()
+local l0, lb0, s0, sb0 = bench.allocs()
+local keep = {}
+for i = 1, 100 do
+	keep[i] = bn.number(2) ^ 1000 + i
+end
+local t1 = bench.clock()
+local l1, lb1, s1, sb1 = bench.allocs()
+assert(t1 >= t0 and t1 - t0 < 60)
+assert(l1 >= l0 + 100 and lb1 > lb0 and s1 >= s0 + 100 and sb1 > sb0)
+
+-- Runs a script with arguments and captures its output and errors.
+local function run(script, ...)
+	local out, err = {}, {}
+	local saved = { arg = arg, print = print, stderr = io.stderr,
+	    exit = os.exit }
+
+	arg = { [0] = script, ... }
+	print = function(s) out[#out + 1] = s end
+	io.stderr = { write = function(self, ...)
+		err[#err + 1] = table.concat({...})
+	end }
+	os.exit = function(status) error("exit " .. tostring(status)) end
+
+	local ok, msg = pcall(dofile, script)
+
+	arg, print, io.stderr, os.exit = saved.arg, saved.print, saved.stderr,
+	    saved.exit
+	return ok, msg, out, err
+end
+
+local ok, msg, out, err = run("bench/suite.lua", "256", "^i?div$", "0")
+assert(ok, msg)
+assert(out[1] == "op\tbits\ttype\tcalls\tns\tallocs\tbytes\tgc_ns")
+-- div and idiv at 64 and 256 bits with three kinds of operands.
+assert(#out == 1 + 2 * 2 * 3)
+for i = 2, #out do
+	local op, bits, kind, calls, ns, allocs =
+	    out[i]:match("^(%a+)\t(%d+)\t(%a+)\t(%d+)\t([%d.]+)\t([%d.]+)\t")
+	assert(op == "div" or op == "idiv")
+	assert(tonumber(calls) >= 1 and tonumber(ns) > 0 and tonumber(allocs))
+end
+-- Every bn function is benchmarked.
+assert(#err == 0, err[1])
+
+-- compare.lua fails on a regression.
+local function writefile(name, rows)
+	local f = assert(io.open(name, "w"))
+	f:write(out[1], "\n", table.concat(rows, "\n"), "\n")
+	f:close()
+end
+
+local base, res = os.tmpname(), os.tmpname()
+writefile(base, { "add\t64\tbn\t1000\t100.0\t1.00\t64.0\t10.0" })
+writefile(res, { "add\t64\tbn\t1000\t105.0\t1.00\t64.0\t10.0" })
+ok, msg = run("bench/compare.lua", base, res)
+assert(ok, msg)
+ok, msg = run("bench/compare.lua", base, res, "1")
+assert(not ok and msg:find("exit 1"))
+
+writefile(res, { "add\t64\tbn\t1000\t100.0\t2.00\t64.0\t10.0" })
+ok, msg = run("bench/compare.lua", base, res)
+assert(not ok and msg:find("exit 1"))
+
+os.remove(base)
+os.remove(res)
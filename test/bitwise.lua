@@ -0,0 +1,55 @@
+-- Bitwise operations, shifts and bit tests.
+
+local bn = require "bn"
+
+math.randomseed(28)
+
+local function rnd(bits)
+	local x = bn.number(0)
+	for i = 1, bits / 16 do
+		x = x * 65536 + math.random(0, 65535)
+	end
+	return (math.random(0, 1) == 0) and x or -x
+end
+
+for i = 1, 200 do
+	local a, b = rnd(16 * math.random(1, 20)), rnd(16 * math.random(1, 20))
+	local k = math.random(0, 200)
+	local p = bn.number(2) ^ k
+
+	assert(bn.bnot(a) == -a - 1)
+	assert(bn.band(a, b) + bn.bor(a, b) == a + b)
+	assert(bn.bxor(a, b) == bn.bor(a, b) - bn.band(a, b))
+	assert(bn.iszero(bn.band(a, bn.bnot(a))))
+	assert(bn.bor(a, bn.bnot(a)) == bn.number(-1))
+
+	assert(bn.lshift(a, k) == a * p)
+	assert(bn.rshift(a, k) == bn.idiv(a, p))
+
+	assert(bn.testbit(a, k) == bn.isodd(bn.rshift(a, k)))
+	assert(bn.testbit(bn.setbit(a, k), k))
+	assert(not bn.testbit(bn.clearbit(a, k), k))
+	assert(bn.setbit(bn.clearbit(a, k), k) == bn.bor(a, p))
+end
+
+assert(bn.idiv(-7, 2) == bn.number(-4) and bn.div(-7, 2) == bn.number(-3))
+assert(bn.rshift(-1, 100) == bn.number(-1))
+assert(bn.rshift(-5, 1) == bn.number(-3))
+assert(bn.numbits(0) == 0 and bn.numbits(-255) == 8)
+assert(bn.popcount(bn.number(2) ^ 100 - 1) == 100)
+assert(bn.popcount(-7) == 3)
+
+if _VERSION ~= "Lua 5.1" and not jit then
+	local ops = assert(load([[
+		local a, b = ...
+		return a & b, a | b, a ~ b, ~a, a << 3, a // b, a >> 3
+	]]))
+	local a, b = bn.number(-1234567), bn.number(89)
+	local r = { ops(a, b) }
+	local e = { ops(-1234567, 89) }
+	for i = 1, 6 do
+		assert(r[i] == bn.number(e[i]))
+	end
+	-- Unlike Lua integers, >> is an arithmetic shift.
+	assert(r[7] == bn.number(-154321))
+end
@@ -0,0 +1,38 @@
+-- LuaJIT FFI binding, skipped on other interpreters.
+
+if not jit then
+	return
+end
+
+local bn = require "bn"
+local bnffi = require "bnffi"
+
+local a = bnffi.new("123456789012345678901234567890")
+local b = bnffi.new(987654321)
+local m = bn.number("1000000007")
+local r = bnffi.new()
+
+bnffi.mul(r, a, b)
+assert(bnffi.tonumber(r) == bn.number("123456789012345678901234567890") *
+    987654321)
+
+-- The result may alias any operand, including the modulus.
+bnffi.set(r, m)
+bnffi.modmul(r, a, b, r)
+assert(bnffi.tonumber(r) ==
+    bn.modmul("123456789012345678901234567890", 987654321, m))
+
+bnffi.set(r, a)
+bnffi.lshift(r, r, -4)
+assert(bnffi.tonumber(r) == bn.rshift(bnffi.tonumber(a), 4))
+
+assert(tonumber(bnffi.toint(b)) == 987654321)
+assert(bnffi.cmp(a, b) > 0 and bnffi.ucmp(b, b) == 0)
+
+-- Read-only shared handles can be operands but not results.
+local h = bn.share("test.bnffi", bn.number(2) ^ 61 - 1)
+local one = bn.number(1)
+bnffi.add(r, h, one)
+assert(bnffi.tonumber(r) == bn.number(2) ^ 61)
+assert(not pcall(bnffi.add, h, h, one) and not pcall(bnffi.set, h, 1))
+assert(not pcall(bnffi.rshift, h, h, 1) and h == bn.number(2) ^ 61 - 1)
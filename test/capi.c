@@ -0,0 +1,184 @@
+/*
+ * Regression test of the C interface. Every function of the interface
+ * without Lua state is called with the result aliasing each operand
+ * in turn and the result is compared with a result stored in a separate
+ * variable. Functions taking a Lua state push and check bn.number
+ * objects.
+ *
+ * Usage: test/capi
+ */
+
+#include "luaBn.h"
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef int (*binop)(BIGNUM *, const BIGNUM *, const BIGNUM *, BN_CTX *);
+typedef int (*modop)(BIGNUM *, const BIGNUM *, const BIGNUM *,
+    const BIGNUM *, BN_CTX *);
+
+static const struct {
+	const char *name;
+	binop fn;
+} binops[] = {
+	{ "luaBn_mul",   luaBn_mul   },
+	{ "luaBn_div",   luaBn_div   },
+	{ "luaBn_mod",   luaBn_mod   },
+	{ "luaBn_nnmod", luaBn_nnmod }
+};
+
+static const struct {
+	const char *name;
+	modop fn;
+} modops[] = {
+	{ "luaBn_modadd", luaBn_modadd },
+	{ "luaBn_modsub", luaBn_modsub },
+	{ "luaBn_modmul", luaBn_modmul },
+	{ "luaBn_modpow", luaBn_modpow }
+};
+
+#define NELEMS(a) (sizeof(a) / sizeof(a[0]))
+
+static int failures;
+
+static void
+check(int cond, const char *name, const char *what)
+{
+
+	if (!cond) {
+		fprintf(stderr, "%s: %s\n", name, what);
+		failures++;
+	}
+}
+
+static BIGNUM *
+number(const char *s)
+{
+	BIGNUM *rv;
+
+	rv = NULL;
+	if (BN_dec2bn(&rv, s) == 0)
+		abort();
+
+	return rv;
+}
+
+static void
+test_luastate(const BIGNUM *a)
+{
+	lua_State *L;
+	BIGNUM *b, *r;
+
+	if ((L = luaL_newstate()) == NULL)
+		abort();
+
+	luaL_openlibs(L);
+	luaBn_open(L);
+	lua_pop(L, 1);
+
+	r = luaBn_pushbignum(L, a);
+	check(r != a && luaBn_cmp(r, a) == 0, "luaBn_pushbignum", "copy");
+	check(luaBn_testbignum(L, -1) == r && luaBn_checkbignum(L, -1) == r &&
+	    luaBn_tobignum(L, -1) == r, "luaBn_testbignum", "same object");
+
+	if ((b = luaBn_new()) == NULL || !luaBn_copy(b, a))
+		abort();
+	r = luaBn_adoptbignum(L, b);
+	check(luaBn_cmp(r, a) == 0 && luaBn_testbignum(L, -1) == r,
+	    "luaBn_adoptbignum", "value");
+	lua_getmetatable(L, -1);
+	lua_getmetatable(L, -3);
+	check(lua_rawequal(L, -1, -2), "luaBn_adoptbignum", "metatable");
+	lua_pop(L, 2);
+
+	r = luaBn_newbignum(L);
+	check(BN_is_zero(r), "luaBn_newbignum", "zero");
+
+	lua_pushliteral(L, "-42");
+	check(luaBn_testbignum(L, -1) == NULL, "luaBn_testbignum", "string");
+	r = luaBn_tobignum(L, -1);
+	check(r != NULL && luaBn_testbignum(L, -1) == r &&
+	    BN_is_negative(r) && BN_get_word(r) == 42,
+	    "luaBn_tobignum", "string");
+
+	lua_close(L);
+}
+
+int
+main(void)
+{
+	static const char *names[] = { "r == a", "r == b", "r == m" };
+	BIGNUM *v[3], *x[3], *expected, *r;
+	BN_CTX *ctx;
+	size_t i;
+	int j;
+
+	ctx = luaBn_ctx_new();
+	expected = luaBn_new();
+	r = luaBn_new();
+	if (ctx == NULL || expected == NULL || r == NULL)
+		abort();
+
+	v[0] = number("-123456789012345678901234567890123");
+	v[1] = number("98765432109876543210987");
+	v[2] = number("340282366920938463463374607431768211297");
+
+	for (j = 0; j < 3; j++) {
+		if ((x[j] = luaBn_new()) == NULL)
+			abort();
+	}
+
+	for (i = 0; i < NELEMS(binops); i++) {
+		check(binops[i].fn(expected, v[0], v[1], ctx), binops[i].name,
+		    "failed");
+		for (j = 0; j < 2; j++) {
+			luaBn_copy(x[0], v[0]);
+			luaBn_copy(x[1], v[1]);
+			check(binops[i].fn(x[j], x[0], x[1], ctx) &&
+			    luaBn_cmp(x[j], expected) == 0 &&
+			    luaBn_cmp(x[1 - j], v[1 - j]) == 0,
+			    binops[i].name, names[j]);
+		}
+	}
+
+	/* Exponents must be nonnegative. */
+	BN_set_negative(v[0], 0);
+
+	for (i = 0; i < NELEMS(modops); i++) {
+		check(modops[i].fn(expected, v[0], v[1], v[2], ctx),
+		    modops[i].name, "failed");
+		for (j = 0; j < 3; j++) {
+			luaBn_copy(x[0], v[0]);
+			luaBn_copy(x[1], v[1]);
+			luaBn_copy(x[2], v[2]);
+			check(modops[i].fn(x[j], x[0], x[1], x[2], ctx) &&
+			    luaBn_cmp(x[j], expected) == 0,
+			    modops[i].name, names[j]);
+		}
+	}
+
+	luaBn_copy(x[0], v[1]);
+	check(luaBn_lshift(r, x[0], -3) && luaBn_rshift(expected, x[0], 3) &&
+	    luaBn_cmp(r, expected) == 0, "luaBn_lshift", "negative shift");
+	check(luaBn_rshift(r, x[0], -3) && luaBn_lshift(expected, x[0], 3) &&
+	    luaBn_cmp(r, expected) == 0, "luaBn_rshift", "negative shift");
+	check(!luaBn_lshift(r, x[0], INT_MIN), "luaBn_lshift", "INT_MIN");
+	check(!luaBn_rshift(r, x[0], INT_MIN), "luaBn_rshift", "INT_MIN");
+
+	test_luastate(v[2]);
+
+	for (j = 0; j < 3; j++) {
+		luaBn_free(v[j]);
+		luaBn_free(x[j]);
+	}
+	luaBn_free(expected);
+	luaBn_free(r);
+	luaBn_ctx_free(ctx);
+
+	return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
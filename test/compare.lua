@@ -0,0 +1,49 @@
+-- Comparisons with Lua numbers and strings.
+
+local bn = require "bn"
+
+local function sign(c)
+	return (c > 0) and 1 or (c < 0) and -1 or 0
+end
+
+local function expect(a, b)
+	return (a < b) and -1 or (a > b) and 1 or 0
+end
+
+local values = {0, 1, -1, 123, -123, 2^40, -(2^40)}
+local others = {0, 0.5, -0.5, 1, 1.5, -1.5, 122.5, 123, 123.5, -122.5,
+    -123.5, 2^40 - 0.5, 2^40 + 0.5, -(2^40) + 0.5, 1e30, -1e30}
+
+for _, v in ipairs(values) do
+	local x = bn.number(v)
+	for _, n in ipairs(others) do
+		assert(sign(bn.cmp(x, n)) == expect(v, n))
+		assert(sign(bn.cmp(n, x)) == expect(n, v))
+		assert(sign(bn.ucmp(x, n)) == expect(math.abs(v), math.abs(n)))
+	end
+end
+
+-- Infinities compare by sign, NaN can't be compared.
+local big = bn.number(2)^64
+for _, x in ipairs({bn.number(0), big, -big}) do
+	assert(bn.cmp(x, math.huge) == -1 and bn.cmp(math.huge, x) == 1)
+	assert(bn.cmp(x, -math.huge) == 1 and bn.cmp(-math.huge, x) == -1)
+	assert(bn.ucmp(x, -math.huge) == -1 and bn.ucmp(-math.huge, x) == 1)
+	assert(not pcall(bn.cmp, x, 0/0) and not pcall(bn.cmp, 0/0, x))
+	assert(not pcall(bn.ucmp, x, 0/0))
+	assert(not bn.eq(x, 0/0) and not bn.eq(x, math.huge))
+end
+
+-- Operators need Lua 5.3 to compare userdata with numbers.
+if _VERSION ~= "Lua 5.1" and not jit then
+	local b = bn.number(123)
+	assert(b < 123.5 and b <= 123.5 and not (b > 123.5))
+	assert(b > 122.5 and not (b < 122.5) and not (b <= 122.5))
+	assert(-b < -122.5 and -b > -123.5)
+	assert(b <= 123 and b >= 123 and not (b < 123))
+	assert(b < "124" and b > "-1" and b <= "123")
+	assert(bn.number(0) < 0.5 and bn.number(0) > -0.5)
+	assert(big < math.huge and big > -math.huge and -big > -math.huge)
+	assert(not (big < 0/0) and not (big <= 0/0) and not (big > 0/0))
+	assert(not (0/0 < big) and not (0/0 >= big))
+end
@@ -0,0 +1,35 @@
+-- bn.crtctx.
+
+local bn = require "bn"
+
+math.randomseed(41)
+
+for _, n in ipairs{1, 2, 3, 10, 33} do
+	local moduli, p = {}, bn.number(1)
+	for i = 1, n do
+		p = bn.nextprime(p + bn.rand(math.random(2, 200)))
+		moduli[i] = p
+	end
+
+	local c = bn.crtctx(moduli)
+	local M = bn.prod(moduli)
+	assert(c:modulus() == M)
+
+	for k = 1, 20 do
+		local x = bn.rand_range(M)
+		local res = c:split(x)
+		assert(#res == #moduli)
+		for i = 1, #moduli do
+			assert(res[i] == bn.nnmod(x, moduli[i]))
+		end
+		assert(c:combine(res) == x)
+
+		res = c:split(-x - M)
+		for i = 1, #moduli do
+			assert(res[i] == bn.nnmod(-x, moduli[i]))
+		end
+	end
+end
+
+assert(not pcall(bn.crtctx, {6, 10}))
+assert(not pcall(bn.crtctx, {}))
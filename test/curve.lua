@@ -0,0 +1,116 @@
+-- bn.curve on secp256k1 against affine arithmetic on bn.number.
+
+local bn = require "bn"
+
+math.randomseed(50)
+
+local N = bn.number
+
+local p = N("0xFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFEFFFFFC2F")
+local n = N("0xFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFEBAAEDCE6AF48A03BBFD25E8CD0364141")
+local gx = N("0x79BE667EF9DCBBAC55A06295CE870B07029BFCDB2DCE28D959F2815B16F81798")
+local gy = N("0x483ADA7726A3C4655DA4FBFC0E1108A8FD17B448A68554199C47D08FFB10D4B8")
+
+local c = bn.curve{ p, 0, 7, gx, gy, n, 1 }
+
+-- Points are {x, y} tables or false for a point at infinity.
+local function add(P, Q)
+	if not P then
+		return Q
+	elseif not Q then
+		return P
+	end
+	local l
+	if P[1] == Q[1] then
+		if bn.nnmod(P[2] + Q[2], p):iszero() then
+			return false
+		end
+		l = bn.modmul(3 * P[1] * P[1], bn.modinv(2 * P[2], p), p)
+	else
+		l = bn.modmul(Q[2] - P[2], bn.modinv(Q[1] - P[1], p), p)
+	end
+	local x = bn.nnmod(l * l - P[1] - Q[1], p)
+	return { x, bn.nnmod(l * (P[1] - x) - P[2], p) }
+end
+
+local function mul(k, P)
+	local r = false
+	for i = k:numbits() - 1, 0, -1 do
+		r = add(r, r)
+		if k:testbit(i) then
+			r = add(r, P)
+		end
+	end
+	return r
+end
+
+local function same(P, Q)
+	if not Q then
+		return P:isinfinity()
+	end
+	local x, y = P:xy()
+	return x == Q[1] and y == Q[2]
+end
+
+local function rand()
+	return bn.rand_range(n)
+end
+
+local G = { gx, gy }
+local g = c:generator()
+
+assert(same(g, G) and same(c:point(gx, gy), G))
+assert(c:mul(n):isinfinity() and c:mul(n, nil, true):isinfinity())
+assert((g - g):isinfinity() and c:point():isinfinity())
+assert(tostring(c:point()) == "inf")
+assert(tostring(g) == "(" .. tostring(gx) .. ", " .. tostring(gy) .. ")")
+assert(not pcall(c.point, c, gx, gy + 1))
+
+local P = c:mul(rand())
+for _ = 1, 8 do
+	local k = rand()
+	local x, y = P:xy()
+	local Q, R = mul(k, { x, y }), c:mul(k, P)
+	assert(same(R, Q) and same(c:mul(k, P, true), Q))
+	assert(same(k * P, Q) and same(P * k, Q))
+	assert(c:mul(k) == c:mul(k, g) and c:mul(k) == c:mul(k, nil, true))
+	assert(same(P + P, mul(N(2), { x, y })) and P:double() == P + P)
+	assert(-P + P == c:point() and P - R == P + -R)
+	P = R
+end
+
+local points, scalars = {}, {}
+for i = 1, 5 do
+	points[i], scalars[i] = c:mul(rand()), rand()
+end
+
+local k, sum = rand(), c:point()
+for i = 1, 5 do
+	sum = sum + c:mul(scalars[i], points[i])
+end
+assert(c:mulsum(nil, points, scalars) == sum)
+assert(c:mulsum(k, points, scalars) == sum + c:mul(k))
+assert(not pcall(c.mulsum, c, nil, points, { 1 }))
+
+-- Precomputed multiples give the same results on both paths.
+local d = c:precompute(P)
+k = rand()
+assert(d:mul(k) == c:mul(k, P) and d:mul(k, nil, true) == c:mul(k, P))
+assert(c:precompute() == c and c:mul(k, nil, true) == c:mul(k))
+assert(d:mul(k) + g == c:mul(k, P) + g)
+
+-- Points in affine coordinates compare equal to the originals.
+local copies = {}
+for i = 1, 5 do
+	copies[i] = points[i] + c:point()
+end
+c:affine(copies)
+for i = 1, 5 do
+	assert(copies[i] == points[i])
+end
+
+-- p must be prime.
+assert(not pcall(bn.curve, { 15, 1, 1 }))
+assert(not pcall(bn.curve, { p * 3, 0, 7 }))
+assert(not pcall(bn.curve, { p, 0, 0 }))
+assert(pcall(bn.curve, { 23, 1, 1 }))
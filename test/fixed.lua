@@ -0,0 +1,72 @@
+-- Fixed-width types bn.u256, bn.u384 and bn.u512.
+
+local bn = require "bn"
+
+math.randomseed(33)
+
+local function rnd(bits)
+	local x = bn.number(0)
+	for i = 1, bits / 16 do
+		x = x * 65536 + math.random(0, 65535)
+	end
+	return x
+end
+
+for _, N in ipairs{256, 384, 512} do
+	local U = bn["u" .. N]
+	local M = bn.number(2) ^ N
+
+	for k = 1, 100 do
+		local a, b = rnd(N), rnd(N - (k % 3) * 100)
+		local ua, ub = U(a), U(b)
+
+		assert(ua:tonumber() == a and tostring(ua) == tostring(a))
+		assert((ua + ub):tonumber() == bn.nnmod(a + b, M))
+		assert((ua - ub):tonumber() == bn.nnmod(a - b, M))
+		assert((ua * ub):tonumber() == bn.nnmod(a * b, M))
+		assert((-ua):tonumber() == bn.nnmod(-a, M))
+		assert((ua < ub) == (a < b) and (ua <= ub) == (a <= b))
+		assert(ua == U(a) and ua:cmp(ub) == bn.cmp(a, b))
+
+		local m = rnd(N)
+		if m:iseven() then
+			m = m + 1
+		end
+		local x, y = bn.nnmod(a, m), bn.nnmod(b, m)
+		local um, ux, uy = U(m), U(x), U(y)
+		assert(ux:modadd(uy, um):tonumber() == bn.modadd(x, y, m))
+		assert(ux:modsub(uy, um):tonumber() == bn.nnmod(x - y, m))
+
+		local r2 = um:montr2()
+		local xr, yr = ux:montmul(r2, um), uy:montmul(r2, um)
+		assert(xr:montmul(1, um):tonumber() == x)
+		assert(xr:montmul(yr, um):montmul(1, um):tonumber() ==
+		    bn.modmul(x, y, m))
+	end
+
+	assert(U(-1):tonumber() == M - 1)
+	assert(U(5) + 3 == U(8) and 3 + U(5) == U(8))
+	assert(bn.number(U(7)) == bn.number(7) and bn.add(U(7), 1) == bn.number(8))
+	assert(U(bn.u512(M - 1)) == U(-1) and bn.u512(U(-1)):tonumber() == M - 1)
+	assert(U() == U(0) and U(2^40):tonumber() == bn.number(2) ^ 40)
+	assert(not pcall(U(4).montr2, U(4)))
+
+	-- Carries through every limb.
+	local m, x = M - 1, M - 2
+	local um, ux = U(m), U(x)
+	assert((ux + U(3)):tonumber():isone() and (U(1) - U(2)):tonumber() == m)
+	assert(ux * ux == U(4) and ux:modadd(ux, um):tonumber() == x - 1)
+	local r2 = um:montr2()
+	assert(r2 == U(1))
+	assert(ux:montmul(r2, um):montmul(ux, um):montmul(1, um):tonumber() ==
+	    bn.modmul(x, x, m))
+end
+
+-- Since Lua 5.3, comparisons of bn.number with a fixed-width number
+-- call metamethods of bn.number.
+if _VERSION ~= "Lua 5.1" and not jit then
+	local a, u = bn.number(5), bn.u256(7)
+
+	assert(not (a == u) and not (u == a))
+	assert(a < u and a <= u and not (u < a))
+end
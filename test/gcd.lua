@@ -0,0 +1,45 @@
+-- bn.gcdext, bn.lcm, bn.modinv and bn.batchgcd.
+
+local bn = require "bn"
+
+math.randomseed(40)
+
+local function rnd(bits)
+	local x = bn.rand(bits)
+	return (math.random(0, 1) == 0) and x or -x
+end
+
+for i = 1, 300 do
+	local c = bn.rand(math.random(1, 300))
+	local a, b = rnd(math.random(1, 1500)) * c, rnd(math.random(1, 1500)) * c
+	local g, x, y = bn.gcdext(a, b)
+
+	assert(g == bn.gcd(a, b) and a * x + b * y == g)
+	assert(a:gcdext(b) == g)
+
+	local l, ab = bn.lcm(a, b), a * b
+	if ab:isneg() then
+		ab = -ab
+	end
+	assert(l * g == ab and l == a:lcm(b))
+
+	local m = bn.rand(math.random(2, 1000)) + 2
+	local v = bn.modinv(a, m)
+	if bn.gcd(a, m) == bn.number(1) then
+		assert(bn.modmul(a, v, m) == bn.number(1))
+	else
+		assert(v == nil)
+	end
+end
+
+assert(bn.gcdext(0, 0) == bn.number(0))
+assert(bn.modinv(4, 8) == nil and bn.modinv(3, 7) == bn.number(5))
+
+-- Moduli sharing a factor are found by bn.batchgcd.
+local p, q, r, s = bn.genprime(128), bn.genprime(128), bn.genprime(128),
+    bn.genprime(128)
+local t = { p * q, r * s, p * r, bn.genprime(256), bn.number(1) }
+local g = bn.batchgcd(t)
+assert(#g == 5)
+assert(g[1] == p and g[2] == r and g[3] == p * r)
+assert(g[4] == bn.number(1) and g[5] == bn.number(1))
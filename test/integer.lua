@@ -0,0 +1,31 @@
+-- Lua integers and bn.tointeger.
+
+local bn = require "bn"
+
+assert(bn.number(0):tointeger() == 0)
+assert(bn.tointeger(-12345) == -12345)
+assert(bn.tointeger("1" .. string.rep("0", 30)) == nil)
+assert(math.type == nil or math.type(bn.tointeger(7)) == "integer")
+
+if math.maxinteger ~= nil then
+	local max, min = math.maxinteger, math.mininteger
+
+	assert(tostring(bn.number(max)) == "9223372036854775807")
+	assert(tostring(bn.number(min)) == "-9223372036854775808")
+	assert(tostring(bn.number(1) + max) == "9223372036854775808")
+	assert(tostring(bn.number(-1) + min) == "-9223372036854775809")
+	assert(tostring(bn.number(max) * max) ==
+	    "85070591730234615847396907784232501249")
+
+	assert(bn.tointeger(max) == max and bn.tointeger(min) == min)
+	assert(bn.tointeger(bn.number(max) + 1) == nil)
+	assert(bn.tointeger(bn.number(min) - 1) == nil)
+else
+	local x = 2^53 - 1
+
+	assert(tostring(bn.number(x)) == "9007199254740991")
+	assert(bn.tointeger(x) == x and bn.tointeger(-x) == -x)
+end
+
+-- Non-integral values are truncated.
+assert(tostring(bn.number(-2.5)) == "-2")
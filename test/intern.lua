@@ -0,0 +1,39 @@
+-- bn.key and bn.intern.
+
+local bn = require "bn"
+
+local a = bn.number("-123456789012345678901234567890")
+assert(bn.key(a) == a:key() and bn.key(a) == bn.key("-123456789012345678901234567890"))
+assert(bn.key(a) ~= bn.key(-a) and bn.key(0) ~= bn.key(1))
+assert(bn.key(0) == bn.key(bn.number(0)))
+
+-- swap exchanges cached keys.
+local x, y = bn.number(1), bn.number(2)
+local kx, ky = x:key(), y:key()
+bn.swap(x, y)
+assert(x:key() == ky and y:key() == kx)
+
+-- Identity of interned numbers survives collections of other numbers.
+local kept = {}
+for i = 1, 2000 do
+	local n = bn.number(2) ^ (i % 300) + i
+	local v = bn.intern(n)
+	assert(v == n)
+	if i % 2 == 0 then
+		kept[i] = v
+	end
+end
+
+for round = 1, 3 do
+	collectgarbage()
+	collectgarbage()
+	for i = 1, 2000 do
+		local v = bn.intern(tostring(bn.number(2) ^ (i % 300) + i))
+		if i % 2 == 0 then
+			assert(rawequal(v, kept[i]))
+		end
+	end
+end
+
+assert(rawequal(bn.intern(5), bn.intern("5")))
+assert(not rawequal(bn.intern(5), bn.intern(-5)))
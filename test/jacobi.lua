@@ -0,0 +1,46 @@
+-- bn.modsqrt, bn.jacobi and bn.jacobi_many.
+
+local bn = require "bn"
+
+math.randomseed(42)
+
+-- Euler's criterion for odd primes.
+for _, p in ipairs{bn.number(3), bn.number(13), bn.number(65537),
+    bn.number(2) ^ 127 - 1, bn.nextprime(bn.number(2) ^ 200)} do
+	for i = 1, 30 do
+		local a = bn.rand_range(p)
+		local e = bn.modpow(a, (p - 1) / 2, p)
+		local j = bn.jacobi(a, p)
+
+		if a:iszero() then
+			assert(j == 0)
+		else
+			assert((j == 1) == (e == bn.number(1)))
+			assert((j == -1) == (e == p - 1))
+		end
+
+		local s = bn.modsqrt(a, p)
+		if j >= 0 then
+			assert(bn.modmul(s, s, p) == a)
+		else
+			assert(s == nil)
+		end
+	end
+end
+
+-- Multiplicativity in the denominator for composite n.
+for i = 1, 100 do
+	local m, n = bn.rand(100) * 2 + 1, bn.rand(80) * 2 + 1
+	local a = bn.rand(150) - bn.rand(150)
+	assert(bn.jacobi(a, m * n) == bn.jacobi(a, m) * bn.jacobi(a, n))
+end
+
+assert(bn.jacobi(2, 15) == 1 and bn.jacobi(7, 15) == -1 and bn.jacobi(5, 15) == 0)
+assert(not pcall(bn.jacobi, 3, 10))
+
+local t = {1, 2, 3, 4, 5, "-1", bn.number(15)}
+local r = bn.jacobi_many(t, 7)
+assert(#r == #t)
+for i = 1, #t do
+	assert(r[i] == bn.jacobi(t[i], 7))
+end
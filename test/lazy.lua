@@ -0,0 +1,41 @@
+-- bn.lazy expressions.
+
+local bn = require "bn"
+
+math.randomseed(48)
+
+local function rnd(bits)
+	local x = bn.rand(bits)
+	return (math.random(0, 1) == 0) and x or -x
+end
+
+for i = 1, 100 do
+	local x, y = rnd(math.random(1, 600)), rnd(math.random(1, 600))
+	local m = bn.rand(math.random(2, 300)) + 2
+	local e = bn.rand(math.random(1, 60))
+	local lx = bn.lazy(x)
+
+	assert((lx * y % m):eval() == x * y % m)
+	local p = bn.modpow(x:isneg() and -x or x, e, m)
+	if x:isneg() and e:isodd() then
+		p = -p
+	end
+	assert((lx ^ e % m):eval() == p)
+	assert((lx ^ 5 % m):eval() == x ^ 5 % m)
+	assert(((lx + y) * (lx - y) - x * x):eval() == -(y * y))
+	assert((-lx / m + 3):eval() == -x / m + 3)
+	assert(tostring(lx * 2 + y) == tostring(x * 2 + y))
+
+	-- Shared subexpressions.
+	local s = lx * y
+	assert((s + s * s):eval() == x * y + (x * y) ^ 2)
+end
+
+-- Operands are kept by reference and the graph is evaluated again.
+local a = bn.number(5)
+local expr = bn.lazy(a) * 3 + 1
+assert(expr:eval() == bn.number(16))
+a:swap(bn.number(7))
+assert(expr:eval() == bn.number(22))
+
+assert(not pcall(function() return (bn.lazy(1) / 0):eval() end))
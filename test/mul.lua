@@ -0,0 +1,42 @@
+-- Toom-3 and NTT multiplication against OpenSSL multiplication.
+
+local bn = require "bn"
+
+math.randomseed(35)
+
+local function rnd(bits)
+	local x = bn.rshift(bn.rand(bits + 64), 64 - math.random(0, 63))
+	return (math.random(0, 1) == 0) and x or -x
+end
+
+local toom3, ntt = bn.multhresholds()
+local huge = 2^30
+
+local cases = {}
+for _, bits in ipairs{64, 1000, 5000, 20000, 100000} do
+	for k = 1, 4 do
+		local a = rnd(bits)
+		local b = (k == 4) and a or rnd(math.random(64, bits * 2))
+		cases[#cases + 1] = { a, b }
+	end
+end
+
+bn.multhresholds(huge, huge)
+local expected = {}
+for i, c in ipairs(cases) do
+	expected[i] = { c[1] * c[2], bn.sqr(c[1]), c[1] ^ 3 }
+end
+
+for _, th in ipairs{ {256, huge}, {huge, 64}, {256, 4096} } do
+	bn.multhresholds(th[1], th[2])
+	for i, c in ipairs(cases) do
+		local e = expected[i]
+		assert(c[1] * c[2] == e[1] and bn.mul(c[2], c[1]) == e[1])
+		assert(bn.sqr(c[1]) == e[2] and c[1] ^ 3 == e[3])
+		assert(bn.prod{c[1], c[2], c[1]} == e[1] * c[1])
+	end
+end
+
+assert(select("#", bn.multhresholds(toom3, ntt)) == 2)
+assert(bn.multhresholds() == toom3)
+assert(not pcall(bn.multhresholds, -1))
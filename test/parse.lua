@@ -0,0 +1,87 @@
+-- bn.parse_all and bn.lines.
+
+local bn = require "bn"
+
+local t = bn.parse_all(" 1\t-22\n333 ")
+assert(#t == 3 and t[1] == bn.number(1) and t[2] == bn.number(-22) and
+    t[3] == bn.number(333))
+
+t = bn.parse_all("4,5;;6", ",;")
+assert(#t == 3 and t[3] == bn.number(6))
+
+assert(#bn.parse_all("") == 0)
+assert(not pcall(bn.parse_all, "1 2x 3"))
+assert(not pcall(bn.parse_all, "1,2"))
+
+-- Numbers span several blocks of the iterator.
+local big = string.rep("1234567890", 10)
+local name = os.tmpname()
+local f = assert(io.open(name, "w"))
+for i = 1, 2000 do
+	f:write(big, i, i % 7 == 0 and "\n" or " ")
+end
+f:close()
+
+f = assert(io.open(name))
+local n = 0
+for x in bn.lines(f) do
+	n = n + 1
+	assert(x == bn.number(big .. n))
+end
+f:close()
+assert(n == 2000)
+
+f = assert(io.open(name, "w"))
+f:write("7:8:9")
+f:close()
+
+f = assert(io.open(name))
+n = 0
+for x in bn.lines(f, ":") do
+	n = n + 1
+	assert(x == bn.number(n + 6))
+end
+f:close()
+assert(n == 3)
+
+-- Errors report offsets in the file, not in a block.
+f = assert(io.open(name, "w"))
+f:write(string.rep("12345 ", 20000), "x")
+f:close()
+
+f = assert(io.open(name))
+local ok, err = pcall(function()
+	for _ in bn.lines(f) do
+	end
+end)
+f:close()
+assert(not ok and err:find("at offset 120001", 1, true), err)
+
+os.remove(name)
+
+-- A line without newlines is read in blocks and a number longer than
+-- a block is still read whole.
+local data = string.rep("987654321,", 30000) .. string.rep("5", 100000)
+local pos, maxread = 1, 0
+local file = {}
+function file:read(len)
+	assert(type(len) == "number")
+	if pos > #data then
+		return nil
+	end
+	local s = data:sub(pos, pos + len - 1)
+	pos = pos + #s
+	maxread = math.max(maxread, #s)
+	return s
+end
+
+n = 0
+for x in bn.lines(file, ",") do
+	n = n + 1
+	if n <= 30000 then
+		assert(x == bn.number(987654321))
+	else
+		assert(x == bn.number(string.rep("5", 100000)))
+	end
+end
+assert(n == 30001 and maxread <= 65536)
@@ -0,0 +1,30 @@
+-- bn.pow and the power operator.
+
+local bn = require "bn"
+
+local function naivepow(a, e)
+	local r = bn.number(1)
+	for i = 1, e do
+		r = r * a
+	end
+	return r
+end
+
+for _, a in ipairs{0, 1, -1, 2, -2, 8, -8, 10, -10, 3, -7, "123456789012345678901"} do
+	for e = 0, 40 do
+		local r = naivepow(a, e)
+		assert(bn.pow(a, e) == r and bn.number(a) ^ e == r)
+		assert(bn.pow(bn.number(a), bn.number(e)) == r)
+		assert(bn.pow(a, -e) == r)
+	end
+end
+
+assert(bn.pow(10, 300) == bn.number("1" .. string.rep("0", 300)))
+assert(tostring(bn.pow(-2, 127)) == "-170141183460469231731687303715884105728")
+
+-- Exponents wider than a word go through BIGNUM exponentiation.
+local e = bn.number(2) ^ 80 + 1
+assert(bn.pow(1, e) == bn.number(1) and bn.pow(-1, e) == bn.number(-1))
+assert(bn.pow(-1, e + 1) == bn.number(1) and bn.pow(0, e) == bn.number(0))
+assert(bn.pow(bn.number(-1), -e) == bn.number(-1))
+assert(not pcall(bn.pow, 2, e))
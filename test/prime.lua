@@ -0,0 +1,43 @@
+-- bn.isprime, bn.nextprime and bn.genprime.
+
+local bn = require "bn"
+
+local function sieve(n)
+	local composite = {}
+	for i = 2, n do
+		if not composite[i] then
+			for j = i * i, n, i do
+				composite[j] = true
+			end
+		end
+	end
+	return composite
+end
+
+local composite = sieve(3000)
+for i = -5, 3000 do
+	assert(bn.isprime(i) == (i >= 2 and not composite[i]))
+end
+
+-- Carmichael numbers and a strong pseudoprime to bases 2 to 11.
+for _, c in ipairs{"561", "41041", "3825123056546413051"} do
+	assert(not bn.isprime(c))
+end
+
+local m127 = bn.number(2) ^ 127 - 1
+assert(bn.isprime(m127) and bn.isprime(m127, 5) and not bn.isprime(m127 + 2))
+assert(bn.nextprime(m127 - 1) == m127 and bn.nextprime(1) == bn.number(2))
+assert(bn.nextprime(bn.number(10) ^ 30) ==
+    bn.number("1000000000000000000000000000057"))
+
+for _, threads in ipairs{1, 4} do
+	for _, bits in ipairs{16, 100, 256} do
+		local p = bn.genprime(bits, false, threads)
+		assert(bn.numbits(p) == bits and bn.isprime(p, 10))
+	end
+
+	local q = bn.genprime(128, true, threads)
+	assert(bn.numbits(q) == 128 and bn.isprime(q) and bn.isprime((q - 1) / 2))
+end
+
+assert(not pcall(bn.genprime, 1))
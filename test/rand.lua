@@ -0,0 +1,45 @@
+-- bn.rand, bn.rand_range and bn.rand_vector.
+
+local bn = require "bn"
+
+for _, bits in ipairs{1, 7, 64, 65, 1000} do
+	for i = 1, 50 do
+		local x = bn.rand(bits)
+		assert(not x:isneg() and bn.numbits(x) <= bits)
+		-- The top bit is set.
+		assert(bn.numbits(bn.rand(bits, 0)) == bits)
+	end
+end
+
+-- Two top bits and the bottom bit.
+for i = 1, 50 do
+	local x = bn.rand(100, 1, 1)
+	assert(bn.numbits(x) == 100 and bn.testbit(x, 98) and x:isodd())
+end
+
+local n = bn.number(10) ^ 20 + 7
+local seen = {}
+for i = 1, 200 do
+	local x = bn.rand_range(n)
+	assert(not x:isneg() and x < n)
+	seen[tostring(bn.nnmod(x, 4))] = true
+end
+assert(seen["0"] and seen["1"] and seen["2"] and seen["3"])
+
+for i = 1, 200 do
+	local x = bn.rand_range(3)
+	assert(x == bn.number(0) or x == bn.number(1) or x == bn.number(2))
+end
+
+local t = bn.rand_vector(1000, 77, 0, 1)
+assert(#t == 1000)
+local distinct, count = {}, 0
+for i = 1, #t do
+	assert(bn.numbits(t[i]) == 77 and t[i]:isodd())
+	if not distinct[tostring(t[i])] then
+		distinct[tostring(t[i])] = true
+		count = count + 1
+	end
+end
+assert(count == 1000)
+assert(#bn.rand_vector(0, 10) == 0)
@@ -0,0 +1,73 @@
+-- bn.rational.
+
+local bn = require "bn"
+
+math.randomseed(49)
+
+local R = bn.rational
+
+assert(tostring(R(6, -4)) == "-3/2" and tostring(R("10/4")) == "5/2")
+assert(tostring(R(0.5)) == "1/2" and tostring(R(-0.75)) == "-3/4")
+assert(tostring(R(0.1)) == "3602879701896397/36028797018963968")
+assert(tostring(R(1.5, 0.25)) == "6")
+assert(R(2^-1074):den() == bn.number(2) ^ 1074)
+assert(R(0.5) + 0.25 == R(3, 4) and R(3, 4) - 0.5 == R(1, 4))
+assert(R(1, 3) < R(0.5) and R(2, 3) > R(0.5))
+assert(not pcall(R, 1 / 0) and not pcall(R, 0 / 0))
+assert(not pcall(R, 1, 0))
+
+-- Reference arithmetic on numerator and denominator pairs.
+local function reduce(n, d)
+	local g = bn.gcd(n, d)
+	if d:isneg() then
+		g = -g
+	end
+	return n / g, d / g
+end
+
+local function same(r, n, d)
+	n, d = reduce(n, d)
+	return r:num() == n and r:den() == d
+end
+
+local function rnd(bits)
+	local x = bn.rand(bits)
+	return (math.random(0, 1) == 0) and x or -x
+end
+
+for i = 1, 200 do
+	local a, b = rnd(math.random(1, 200)), bn.rand(math.random(1, 200)) + 1
+	local c, d = rnd(math.random(1, 200)), bn.rand(math.random(1, 200)) + 1
+	local x, y = R(a, b), R(c, d)
+
+	assert(same(x, a, b))
+	assert(same(x + y, a * d + c * b, b * d))
+	assert(same(x - y, a * d - c * b, b * d))
+	assert(same(x * y, a * c, b * d))
+	if not c:iszero() then
+		assert(same(x / y, a * d, b * c))
+	end
+	assert(same(-x, -a, b) and same(x ^ 3, a ^ 3, b ^ 3))
+	assert(a:iszero() or same(x ^ -2, b ^ 2, a ^ 2))
+
+	assert((x < y) == (a * d < c * b) and (x <= y) == (a * d <= c * b))
+	assert((x == y) == (a * d == c * b))
+
+	-- floor and % with the sign of the divisor.
+	local f = x:floor()
+	assert(R(f) <= x and x < R(f + 1))
+	if not c:iszero() then
+		local m = x % y
+		assert(m == x - y * (x / y):floor())
+		assert(m:num():iszero() or m:num():isneg() == y:num():isneg())
+	end
+
+	assert(x + a == R(a * b + a, b) and x == R(tostring(x)))
+end
+
+-- Long sums stay exact with lazy reduction.
+local h = R(0)
+for k = 1, 200 do
+	h = h + R(1, k * (k + 1))
+end
+assert(h == R(200, 201))
@@ -0,0 +1,60 @@
+-- bn.prod, bn.sum, bn.dot, bn.min, bn.max, bn.argmax, bn.factorial
+-- and bn.binomial.
+
+local bn = require "bn"
+
+local function naiveprod(t)
+	local r = bn.number(1)
+	for i = 1, #t do
+		r = r * t[i]
+	end
+	return r
+end
+
+for n = 0, 40 do
+	local t = {}
+	for i = 1, n do
+		t[i] = (i % 3 == 0) and tostring(-i * 1000003) or
+		    bn.number(2) ^ (i * 7) + i
+	end
+	assert(bn.prod(t) == naiveprod(t))
+end
+
+local big = {}
+for i = 1, 1000 do
+	big[i] = bn.number(2) ^ 64 + i
+end
+assert(bn.prod(big) == naiveprod(big))
+
+assert(bn.sum{} == bn.number(0) and bn.sum{1, "2", bn.number(-4)} == bn.number(-1))
+assert(bn.dot({1, 2, 3}, {4, 5, 6}) == bn.number(32))
+assert(bn.dot({1, 2, 3}, {4, 5, 6}, 7) == bn.number(4))
+
+local t = {5, "-3", bn.number(2) ^ 70, 9}
+assert(bn.min(t) == bn.number(-3) and bn.max(t) == bn.number(2) ^ 70)
+assert(bn.min{} == nil and bn.max{} == nil)
+local i, v = bn.argmax(t)
+assert(i == 3 and v == bn.number(2) ^ 70)
+
+assert(bn.factorial(0) == bn.number(1))
+assert(tostring(bn.factorial(25)) == "15511210043330985984000000")
+assert(bn.factorial(200) == naiveprod((function()
+	local f = {}
+	for k = 1, 200 do
+		f[k] = k
+	end
+	return f
+end)()))
+
+assert(bn.binomial(10, 3) == bn.number(120) and bn.binomial(5, 6) == bn.number(0))
+assert(bn.binomial(100, 50) * bn.factorial(50) ^ 2 == bn.factorial(100))
+
+-- Results of bn.dot modulo m and bn.binomial don't alias operands.
+local xs, ys = {}, {}
+for i = 1, 20 do
+	xs[i], ys[i] = bn.number(3) ^ (40 + i), bn.number(7) ^ (30 + i) + i
+end
+local m = bn.number(2) ^ 127 - 1
+assert(bn.dot(xs, ys, m) == bn.nnmod(bn.dot(xs, ys), m))
+assert(bn.dot(xs, ys, -m) == bn.nnmod(bn.dot(xs, ys), m))
+assert(bn.binomial(300, 150) == bn.factorial(300) / bn.factorial(150) ^ 2)
@@ -0,0 +1,34 @@
+-- bn.sqrt, bn.sqrtrem, bn.root and bn.isperfectpower.
+
+local bn = require "bn"
+
+math.randomseed(37)
+
+for i = 1, 200 do
+	local a = bn.rand(math.random(1, 2000))
+	local s = bn.sqrt(a)
+	assert(s * s <= a and (s + 1) * (s + 1) > a)
+
+	local s2, r = bn.sqrtrem(a)
+	assert(s2 == s and s * s + r == a)
+
+	local k = math.random(2, 9)
+	local x = bn.root(a, k)
+	assert(x ^ k <= a and (x + 1) ^ k > a)
+
+	if k % 2 == 1 then
+		assert(bn.root(-a, k) == -x)
+	end
+end
+
+assert(not pcall(bn.sqrt, -4))
+assert(not pcall(bn.root, -8, 2))
+assert(bn.sqrt(0) == bn.number(0) and bn.root(1, 5) == bn.number(1))
+
+local ok, b, k = bn.isperfectpower(bn.number(3) ^ 35)
+assert(ok and b == bn.number(3) ^ 5 and k == 7 or
+    ok and b == bn.number(3) ^ 7 and k == 5)
+ok, b, k = bn.isperfectpower(bn.number(12345) ^ 2)
+assert(ok and b == bn.number(12345) and k == 2)
+assert(not bn.isperfectpower(bn.number(2) ^ 61 - 1))
+assert(not bn.isperfectpower(bn.number(12345) ^ 2 + 1))
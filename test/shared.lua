@@ -0,0 +1,30 @@
+-- Process-wide shared read-only numbers.
+
+local bn = require "bn"
+
+local p = bn.number(2) ^ 127 - 1
+local h = bn.share("test.p", p)
+
+assert(h == p and bn.isshared(h) and h:isshared() and not bn.isshared(p))
+assert(bn.shared("test.p") == p and bn.shared("test.none") == nil)
+
+-- Sharing an equal value returns a handle of the first copy.
+assert(bn.share("test.p", p + 0) == p)
+assert(not pcall(bn.share, "test.p", p + 1))
+
+-- Handles are read-only.
+assert(not pcall(bn.swap, h, bn.number(1)))
+assert(not pcall(bn.swap, bn.number(1), h))
+
+assert(h + 1 == p + 1 and h * h == p * p)
+assert(bn.modpow(3, p - 1, h) == bn.number(1))
+assert(bn.modpow(3, p - 1, bn.shared("test.p")) == bn.number(1))
+
+bn.unshare("test.p")
+assert(bn.shared("test.p") == nil)
+
+-- Handles outlive the name.
+collectgarbage()
+assert(h == p and bn.isshared(h))
+h = nil
+collectgarbage()
@@ -0,0 +1,98 @@
+-- bn.sort, bn.unique and bn.bsearch.
+
+local bn = require "bn"
+
+math.randomseed(43)
+
+local t, ref = {}, {}
+for i = 1, 500 do
+	local x = bn.rand(math.random(1, 300)) - bn.rand(math.random(1, 300))
+	if i % 5 == 0 then
+		t[i] = tostring(x)
+	elseif i % 7 == 0 then
+		t[i] = math.random(-1000, 1000)
+	else
+		t[i] = x
+	end
+	ref[i] = bn.number(t[i])
+end
+t[501], ref[501] = t[1], ref[1]
+
+local orig = {}
+for i = 1, #t do
+	orig[i] = t[i]
+end
+
+assert(bn.sort(t) == t and #t == #orig)
+table.sort(ref, function(a, b) return a < b end)
+for i = 1, #t do
+	assert(bn.number(t[i]) == ref[i])
+end
+
+-- Original values are kept.
+local kept = {}
+for i = 1, #orig do
+	kept[orig[i]] = (kept[orig[i]] or 0) + 1
+end
+for i = 1, #t do
+	kept[t[i]] = kept[t[i]] - 1
+end
+for _, v in pairs(kept) do
+	assert(v == 0)
+end
+
+bn.sort(t, true)
+for i = 2, #t do
+	assert(bn.number(t[i - 1]) >= bn.number(t[i]))
+end
+
+local distinct, count = {}, 0
+for i = 1, #orig do
+	local k = tostring(bn.number(orig[i]))
+	if not distinct[k] then
+		distinct[k] = true
+		count = count + 1
+	end
+end
+
+local u = bn.unique(orig)
+assert(#u == count and count < #orig)
+for i = 2, #u do
+	assert(bn.number(u[i - 1]) < bn.number(u[i]))
+end
+
+for i = 1, #u do
+	assert(bn.bsearch(u, u[i]) == i)
+end
+local idx, pos = bn.bsearch(u, bn.number(u[10]) + 0)
+assert(idx == 10)
+for i = 2, #u do
+	local x = bn.number(u[i - 1]) + 1
+	if x < bn.number(u[i]) then
+		idx, pos = bn.bsearch(u, x)
+		assert(idx == nil and pos == i)
+	end
+end
+idx, pos = bn.bsearch(u, bn.number(u[#u]) + 1)
+assert(idx == nil and pos == #u + 1)
+
+bn.sort(u, true)
+assert(bn.bsearch(u, u[3], true) == 3)
+assert(#bn.unique{} == 0 and #bn.sort{} == 0)
+
+-- The sort is stable in both orders.
+local three, five = bn.number(3), bn.number(5)
+local function input()
+	return { "5", 5, three, "0x5", 3, five, "3" }
+end
+local function same(x, y)
+	for i = 1, #y do
+		if not rawequal(x[i], y[i]) then
+			return false
+		end
+	end
+	return #x == #y
+end
+
+assert(same(bn.sort(input()), { three, 3, "3", "5", 5, "0x5", five }))
+assert(same(bn.sort(input(), true), { "5", 5, "0x5", five, three, 3, "3" }))
@@ -0,0 +1,55 @@
+-- bn.stats, bn.stats_enable and bn.stats_reset.
+
+local bn = require "bn"
+
+if bn.stats() == nil then
+	-- Built without -DLUABN_STATS.
+	return
+end
+
+local function isinteger(x)
+	if math.type then
+		return math.type(x) == "integer"
+	end
+	return x == math.floor(x)
+end
+
+assert(bn.stats_enable(true) == false)
+bn.stats_reset()
+
+local a = bn.number("123456789012345678901234567890")
+for i = 1, 10 do
+	local r = a * i + "7"
+end
+
+local st = bn.stats()
+assert(st.enabled)
+assert(st.created >= 20 and isinteger(st.created) and isinteger(st.collected))
+-- Strings which fit into a word aren't converted.
+assert(st.conversions.strings == 1 and isinteger(st.conversions.numbers))
+assert(isinteger(st.ctx))
+
+assert(st.functions["bn.number.__mul"].calls == 10)
+for name, fs in pairs(st.functions) do
+	assert(isinteger(fs.calls) and fs.calls > 0 and fs.time >= 0)
+	for k, v in pairs(fs.latency) do
+		assert(isinteger(k) and isinteger(v))
+	end
+	for k, v in pairs(fs.sizes) do
+		assert(isinteger(k) and isinteger(v))
+	end
+end
+
+assert(bn.stats_enable(false) == true)
+bn.stats_reset()
+assert(next(bn.stats().functions) == nil)
+
+-- Counters of replaced and collected functions are still reported.
+bn.stats_enable(true)
+bn.sub(1, 2)
+bn.sub, bn.mul = nil, nil
+collectgarbage()
+collectgarbage()
+assert(bn.stats().functions["bn.sub"].calls == 1)
+bn.stats_reset()
+bn.stats_enable(false)
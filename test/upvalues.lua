@@ -0,0 +1,32 @@
+-- Functions find the metatable and BN_CTX in their upvalues.
+
+local bn = require "bn"
+
+local a = bn.number(12345)
+local mt = getmetatable(a)
+local reg = debug.getregistry()
+
+-- Registry entries aren't needed after luaopen_bn.
+local saved = reg["bn.number"]
+reg["bn.number"] = nil
+reg["bn.ctx"] = nil
+
+assert(tostring(a * a) == "152399025")
+assert(tostring(bn.modmul(a, a, 1000)) == "25")
+assert(getmetatable(bn.add(a, 1)) == mt)
+
+reg["bn.number"] = saved
+
+-- Userdata of other types are rejected.
+assert(not pcall(bn.add, io.stdout, 1))
+assert(not pcall(bn.add, 1, io.stdout))
+assert(not pcall(bn.tostring, io.stdout))
+
+-- Methods and functions called from a coroutine.
+local co = coroutine.wrap(function(x)
+	while true do
+		x = coroutine.yield(x:mul(x):add(1))
+	end
+end)
+assert(tostring(co(a)) == "152399026")
+assert(tostring(co(bn.number(2))) == "5")